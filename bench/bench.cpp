@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cstdlib>
+#include <cxxopts.hpp>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include "bench.h"
+
+using namespace ClangStruct;
+using namespace ClangStruct::Bench;
+
+using Msg = Message<std::string>;
+
+std::atomic<uint64_t> Bench::allocations;
+
+/* new[] and the nothrow variants end up here too */
+void *operator new(std::size_t size)
+{
+	Bench::allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	free(ptr);
+}
+
+void Runner::report(std::string_view name, uint64_t ops, uint64_t bytes, Clock::duration time,
+		    std::optional<uint64_t> allocs)
+{
+	if (!wants(name))
+		return;
+
+	auto ns = std::chrono::duration<double, std::nano>(time).count();
+	auto secs = ns / 1e9;
+	std::ostringstream ss;
+
+	ss.precision(1);
+	ss << std::fixed;
+
+	ss << "{\"name\":\"" << name << "\",\"ops\":" << ops << ",\"bytes\":" << bytes <<
+	      ",\"ns\":" << ns << ",\"ns_per_op\":" << (ops ? ns / ops : 0.0) <<
+	      ",\"ops_per_s\":" << (secs > 0 ? ops / secs : 0.0) <<
+	      ",\"bytes_per_s\":" << (secs > 0 ? bytes / secs : 0.0);
+	if (allocs)
+		ss << ",\"allocs_per_op\":" << (ops ? (double)*allocs / ops : 0.0);
+	ss << "}";
+
+	os << ss.str() << std::endl;
+}
+
+Msg Bench::makeSource(unsigned i)
+{
+	Msg msg(Msg::SOURCE);
+
+	msg.add("src", "drivers/net/ethernet/intel/e1000e/netdev" + std::to_string(i) + ".c");
+
+	return msg;
+}
+
+Msg Bench::makeStruct(unsigned i)
+{
+	Msg msg(Msg::STRUCT);
+
+	msg.add("name", "e1000_adapter" + std::to_string(i));
+	msg.add("type", "s");
+	msg.add("attrs", "");
+	msg.add("packed", 0);
+	msg.add("inMacro", 0);
+	msg.add("src", "drivers/net/ethernet/intel/e1000e/e1000.h");
+	msg.add("begLine", 220 + i);
+	msg.add("begCol", 1);
+	msg.add("endLine", 340 + i);
+	msg.add("endCol", 1);
+
+	return msg;
+}
+
+Msg Bench::makeMember(unsigned i)
+{
+	Msg msg(Msg::MEMBER);
+
+	msg.add("name", "tx_ring_count");
+	msg.add("struct", "e1000_adapter" + std::to_string(i));
+	msg.add("src", "drivers/net/ethernet/intel/e1000e/e1000.h");
+	msg.add("strBegLine", 220 + i);
+	msg.add("strBegCol", 1);
+	msg.add("begLine", 251 + i);
+	msg.add("begCol", 2);
+	msg.add("endLine", 251 + i);
+	msg.add("endCol", 6);
+
+	return msg;
+}
+
+Msg Bench::makeUse(unsigned i)
+{
+	Msg msg(Msg::USE);
+
+	msg.add("member", "tx_ring_count");
+	msg.add("struct", "e1000_adapter" + std::to_string(i));
+	msg.add("strSrc", "drivers/net/ethernet/intel/e1000e/e1000.h");
+	msg.add("strLine", 220 + i);
+	msg.add("strCol", 1);
+	msg.add("use_src", "drivers/net/ethernet/intel/e1000e/ethtool.c");
+	msg.add("load", 1);
+	msg.add("implicit", 0);
+	msg.add("begLine", 712 + i);
+	msg.add("begCol", 24);
+	msg.add("endLine", 712 + i);
+	msg.add("endCol", 33);
+
+	return msg;
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter;
+	unsigned minTime;
+	unsigned records;
+	std::vector<unsigned> producers;
+	std::string dbDir;
+	long mqMaxMsg, mqMsgSize;
+	cxxopts::Options options { argv[0], "Benchmark the hot paths of clang-struct" };
+	options.add_options()
+		("h,help", "Print this help message")
+		("f,filter", "Run only benchmarks whose name contains this",
+		 cxxopts::value(filter))
+		("min-time", "Minimal run time of one benchmark in ms",
+		 cxxopts::value(minTime)->default_value("500"))
+		("records", "Records inserted or sent by the database and transport benchmarks",
+		 cxxopts::value(records)->default_value("100000"))
+		("producers", "Numbers of producer threads of the transport benchmarks",
+		 cxxopts::value(producers)->default_value("1,4"))
+		("db-dir", "Directory for the on-disk database",
+		 cxxopts::value(dbDir)->default_value(std::filesystem::temp_directory_path().string()))
+		("mq-maxmsg", "Depth of the message queue (0 = system default)",
+		 cxxopts::value(mqMaxMsg)->default_value("64"))
+		("mq-msgsize", "Maximum size of one message in the queue (0 = system default)",
+		 cxxopts::value(mqMsgSize)->default_value("65536"))
+	;
+
+	try {
+		const auto opts = options.parse(argc, argv);
+		if (opts.contains("help")) {
+			std::cout << options.help();
+			return 0;
+		}
+	} catch (const cxxopts::exceptions::parsing &e) {
+		std::cerr << "arguments error: " << e.what() << "\n";
+		std::cerr << options.help();
+		return EXIT_FAILURE;
+	}
+
+	Runner runner(std::cout, filter, std::chrono::milliseconds(minTime));
+
+	benchMessage(runner);
+	benchSQLConn(runner, dbDir, std::max(records, 1U));
+	benchTransport(runner, producers, std::max(records, 1U), mqMaxMsg, mqMsgSize);
+
+	return 0;
+}
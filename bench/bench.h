@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/Message.h"
+
+namespace ClangStruct::Bench {
+
+/* heap allocations of the process, counted by the replaced operator new */
+extern std::atomic<uint64_t> allocations;
+
+/*
+ * Runs the benchmarks matching a filter and prints one JSON line per
+ * result, so that they can be compared across commits by a script.
+ */
+class Runner {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	Runner(std::ostream &os, std::string filter, std::chrono::milliseconds minTime) :
+		os(os), filter(std::move(filter)), minTime(minTime) {}
+
+	bool wants(std::string_view name) const {
+		return filter.empty() || name.find(filter) != std::string_view::npos;
+	}
+
+	/*
+	 * Calls @f(n) to do n operations, for n = 1, 2, 4, ... until one call
+	 * takes at least the minimal time. Only that last call is reported,
+	 * with the allocations it did.
+	 */
+	template <typename F>
+	void run(std::string_view name, uint64_t bytesPerOp, F f) {
+		if (!wants(name))
+			return;
+
+		for (uint64_t n = 1; ; n *= 2) {
+			auto allocs = allocations.load(std::memory_order_relaxed);
+			auto start = Clock::now();
+			f(n);
+			auto time = Clock::now() - start;
+			allocs = allocations.load(std::memory_order_relaxed) - allocs;
+			if (time >= minTime || n >= (1ULL << 40)) {
+				report(name, n, n * bytesPerOp, time, allocs);
+				return;
+			}
+		}
+	}
+
+	/* for benchmarks which cannot be repeated at will, skipped if not wanted */
+	void report(std::string_view name, uint64_t ops, uint64_t bytes, Clock::duration time,
+		    std::optional<uint64_t> allocs = std::nullopt);
+
+	/* keeps the compiler from optimizing away the computation of @val */
+	template <typename T>
+	static void keep(const T &val) {
+		asm volatile("" : : "r"(&val) : "memory");
+	}
+private:
+	std::ostream &os;
+	std::string filter;
+	std::chrono::milliseconds minTime;
+};
+
+/* records as the plugin sends them for a kernel TU, @i makes them unique */
+Message<std::string> makeSource(unsigned i);
+Message<std::string> makeStruct(unsigned i);
+Message<std::string> makeMember(unsigned i);
+Message<std::string> makeUse(unsigned i);
+
+void benchMessage(Runner &runner);
+void benchSQLConn(Runner &runner, const std::filesystem::path &dir, unsigned records);
+void benchTransport(Runner &runner, const std::vector<unsigned> &producers, unsigned records,
+		    long mqMaxMsg, long mqMsgSize);
+
+}
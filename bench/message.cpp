@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <iostream>
+
+#include "../src/Packet.h"
+#include "bench.h"
+
+using namespace ClangStruct;
+using namespace ClangStruct::Bench;
+
+using Msg = Message<std::string>;
+using MsgView = Message<std::string_view>;
+
+namespace {
+
+/*
+ * A use as StructVisitor builds it and PacketConnection batches it: a record
+ * put by fromRecord() into one message, and one buffer reused for all
+ * records. The names and paths are owned elsewhere (the AST, the source
+ * cache).
+ */
+void benchBuild(Runner &runner)
+{
+	static const std::string member = "tx_ring_count_per_queue";
+	static const std::string strct = "e1000_adapter_private";
+	static const std::string strSrc = "drivers/net/ethernet/intel/e1000e/e1000.h";
+	static const std::string useSrc = "drivers/net/ethernet/intel/e1000e/ethtool.c";
+	auto addUse = [](auto &msg, uint64_t i) {
+		msg.add("member", member);
+		msg.add("struct", strct);
+		msg.add("strSrc", strSrc);
+		msg.add("strLine", 220);
+		msg.add("strCol", 1);
+		msg.add("use_src", useSrc);
+		msg.add("load", i & 1);
+		msg.add("implicit", 0);
+		msg.add("begLine", 712 + i);
+		msg.add("begCol", 24);
+		msg.add("endLine", 712 + i);
+		msg.add("endCol", 33);
+	};
+	auto wire = makeUse(0).serialize();
+
+	runner.run("message/build/use", wire.length(), [&](uint64_t n) {
+		MsgView msg;
+		std::string buf;
+		Packet packet(1 << 16);
+		for (uint64_t i = 0; i < n; i++) {
+			msg.fromRecord(Record::Use {
+				.member = member,
+				.strct = strct,
+				.strSrc = strSrc,
+				.strLine = 220,
+				.strCol = 1,
+				.useSrc = useSrc,
+				.load = (Record::Int)(i & 1),
+				.implicit = 0,
+				.begLine = (Record::Int)(712 + i),
+				.begCol = 24,
+				.endLine = (Record::Int)(712 + i),
+				.endCol = 33,
+			});
+			buf.clear();
+			msg.serialize(buf);
+			if (!packet.fits(buf.length()))
+				packet.clear();
+			packet.append(buf);
+		}
+		Runner::keep(packet);
+	});
+
+	/* a message owning copies of its values, as the plugin used to build */
+	runner.run("message/build/use-owned", wire.length(), [&](uint64_t n) {
+		std::string buf;
+		Packet packet(1 << 16);
+		for (uint64_t i = 0; i < n; i++) {
+			Msg msg(Msg::KIND::USE);
+			addUse(msg, i);
+			buf.clear();
+			msg.serialize(buf);
+			if (!packet.fits(buf.length()))
+				packet.clear();
+			packet.append(buf);
+		}
+		Runner::keep(packet);
+	});
+}
+
+}
+
+void Bench::benchMessage(Runner &runner)
+{
+	static const struct {
+		const char *name;
+		Msg msg;
+	} kinds[] = {
+		{ "member", makeMember(0) },
+		{ "use", makeUse(0) },
+	};
+	static const struct {
+		const char *name;
+		Msg::FORMAT format;
+	} formats[] = {
+		{ "binary", Msg::FORMAT::BINARY },
+		{ "text", Msg::FORMAT::TEXT },
+	};
+
+	for (const auto &k : kinds) {
+		for (const auto &f : formats) {
+			auto suffix = std::string(k.name) + "/" + f.name;
+			auto wire = k.msg.serialize(f.format);
+
+			/* one buffer reused, as PacketConnection does */
+			runner.run("message/serialize/" + suffix, wire.length(), [&](uint64_t n) {
+				std::string buf;
+				for (uint64_t i = 0; i < n; i++) {
+					buf.clear();
+					k.msg.serialize(buf, f.format);
+					Runner::keep(buf);
+				}
+			});
+
+			/* into views, as db_filler does */
+			runner.run("message/deserialize/" + suffix, wire.length(), [&](uint64_t n) {
+				Message<std::string_view> msg;
+				for (uint64_t i = 0; i < n; i++) {
+					if (!msg.deserialize(wire)) {
+						std::cerr << "cannot deserialize " << suffix << "\n";
+						return;
+					}
+					Runner::keep(msg);
+				}
+			});
+		}
+	}
+
+	benchBuild(runner);
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <iostream>
+
+#include "../src/sqlconn.h"
+#include "bench.h"
+
+using namespace ClangStruct;
+using namespace ClangStruct::Bench;
+
+namespace {
+
+using Msg = Message<std::string_view>;
+
+/* serialized records of one kind and their views, as db_filler decodes them */
+struct Records {
+	Records(Message<std::string> (*make)(unsigned), unsigned count) : wire(count) {
+		msgs.resize(count);
+		for (unsigned i = 0; i < count; i++) {
+			wire[i] = make(i).serialize();
+			msgs[i].deserialize(wire[i]);
+		}
+	}
+
+	uint64_t bytes() const {
+		uint64_t ret = 0;
+		for (const auto &w : wire)
+			ret += w.length();
+		return ret;
+	}
+
+	std::vector<std::string> wire;
+	std::vector<Msg> msgs;
+};
+
+void removeDB(const std::filesystem::path &db)
+{
+	std::filesystem::remove(db);
+	std::filesystem::remove(db.string() + "-journal");
+}
+
+bool benchDB(Runner &runner, const std::string &prefix, const std::filesystem::path &db,
+	     bool bulk, const std::vector<std::pair<const char *, const Records *>> &kinds)
+{
+	SQLConn sqlConn;
+
+	if (!sqlConn.open(db, bulk)) {
+		std::cerr << "cannot open " << db << ": " << sqlConn.lastError() << "\n";
+		return false;
+	}
+	if (!sqlConn.begin()) {
+		std::cerr << sqlConn.lastError() << "\n";
+		return false;
+	}
+
+	/* each kind refers to the previous ones, so they go in this order */
+	for (const auto &[name, records] : kinds) {
+		auto start = Runner::Clock::now();
+		for (const auto &msg : records->msgs) {
+			if (sqlConn.handleMessage(msg) < 0) {
+				std::cerr << prefix << name << ": insert failed\n";
+				return false;
+			}
+		}
+		runner.report(prefix + name, records->msgs.size(), records->bytes(),
+			      Runner::Clock::now() - start);
+	}
+
+	auto start = Runner::Clock::now();
+	if (bulk) {
+		if (!sqlConn.finalizeBulk())
+			return false;
+		runner.report(prefix + "finalize", kinds.back().second->msgs.size(), 0,
+			      Runner::Clock::now() - start);
+		start = Runner::Clock::now();
+	}
+
+	if (!sqlConn.end()) {
+		std::cerr << sqlConn.lastError() << "\n";
+		return false;
+	}
+	runner.report(prefix + "commit", 1, 0, Runner::Clock::now() - start);
+
+	return true;
+}
+
+}
+
+/*
+ * One pass over @records unique records per kind into a fresh database, all
+ * in one transaction like db_filler does between commits.
+ */
+void Bench::benchSQLConn(Runner &runner, const std::filesystem::path &dir, unsigned records)
+{
+	static const struct {
+		const char *name;
+		bool onDisk;
+		bool bulk;
+	} configs[] = {
+		{ "memory", false, false },
+		{ "memory/bulk", false, true },
+		{ "disk", true, false },
+		{ "disk/bulk", true, true },
+	};
+	std::optional<Records> sources, structs, members, uses;
+
+	for (const auto &c : configs) {
+		std::string prefix = std::string("sqlconn/") + c.name + "/";
+		bool wanted = false;
+		for (auto name : { "source", "struct", "member", "use", "finalize", "commit" })
+			wanted |= runner.wants(prefix + name);
+		if (!wanted)
+			continue;
+
+		if (!sources) {
+			sources.emplace(makeSource, records);
+			structs.emplace(makeStruct, records);
+			members.emplace(makeMember, records);
+			uses.emplace(makeUse, records);
+		}
+
+		auto db = c.onDisk ? dir / "cs-bench.db" : std::filesystem::path(":memory:");
+		if (c.onDisk)
+			removeDB(db);
+
+		benchDB(runner, prefix, db, c.bulk, {
+			{ "source", &*sources },
+			{ "struct", &*structs },
+			{ "member", &*members },
+			{ "use", &*uses },
+		});
+
+		if (c.onDisk)
+			removeDB(db);
+	}
+}
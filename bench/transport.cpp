@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+#include <mqueue.h>
+
+#include "../src/Packet.h"
+#include "../src/server.h"
+#include "bench.h"
+
+using namespace ClangStruct;
+using namespace ClangStruct::Bench;
+
+namespace {
+
+/* what MQConnection in the plugin does for every record */
+void produce(unsigned id, unsigned count)
+{
+	auto mq = mq_open(MQServer::queue_name, O_WRONLY);
+	if (mq < 0) {
+		std::cerr << "cannot open msg queue: " << strerror(errno) << "\n";
+		return;
+	}
+
+	mq_attr attr;
+	if (mq_getattr(mq, &attr) < 0) {
+		std::cerr << "cannot get msg attr: " << strerror(errno) << "\n";
+		mq_close(mq);
+		return;
+	}
+
+	/* time out rather than block forever if the consumer failed */
+	auto send = [mq](const std::string &data) {
+		struct timespec timeout = {
+			.tv_sec = time(NULL) + 5,
+		};
+		if (mq_timedsend(mq, data.c_str(), data.length(), 0, &timeout) < 0) {
+			std::cerr << "mq_send: " << strerror(errno) << "\n";
+			return false;
+		}
+		return true;
+	};
+	auto msg = makeUse(id);
+	Packet packet(attr.mq_msgsize);
+	std::string buf;
+
+	bool ok = true;
+	for (unsigned i = 0; ok && i < count; i++) {
+		buf.clear();
+		msg.serialize(buf);
+		if (!packet.fits(buf.length())) {
+			ok = send(packet.data());
+			packet.clear();
+		}
+		packet.append(buf);
+	}
+	if (ok && !packet.empty())
+		send(packet.data());
+
+	mq_close(mq);
+}
+
+/* receives and decodes @total records, returns their bytes */
+std::optional<uint64_t> consume(Server &server, uint64_t total)
+{
+	Message<std::string_view> msg;
+	uint64_t received = 0;
+	uint64_t bytes = 0;
+
+	while (received < total) {
+		auto data = server.read();
+		if (!data)
+			return std::nullopt;
+		if (data->empty()) {
+			std::cerr << "timed out after " << received << " of " << total <<
+				     " records\n";
+			return std::nullopt;
+		}
+
+		Packet::Reader reader(*data);
+		while (auto rec = reader.next()) {
+			if (!msg.deserialize(*rec)) {
+				std::cerr << "malformed message of size " << rec->size() << "\n";
+				return std::nullopt;
+			}
+			received++;
+			bytes += rec->size();
+		}
+	}
+
+	return bytes;
+}
+
+}
+
+/*
+ * @records USE records split among the producers and received and decoded by
+ * one thread, as in db_filler. It needs the queue name, so it cannot run
+ * along a db_filler.
+ */
+void Bench::benchTransport(Runner &runner, const std::vector<unsigned> &producers,
+			   unsigned records, long mqMaxMsg, long mqMsgSize)
+{
+	for (auto nr : producers) {
+		auto name = "transport/mq/p" + std::to_string(nr);
+		if (!nr || !runner.wants(name))
+			continue;
+
+		MQServer server(mqMaxMsg, mqMsgSize);
+		if (server.open() < 0) {
+			std::cerr << name << ": skipped\n";
+			continue;
+		}
+
+		auto per = records / nr;
+		auto start = Runner::Clock::now();
+
+		std::vector<std::thread> threads;
+		for (unsigned i = 0; i < nr; i++)
+			threads.emplace_back(produce, i, per);
+
+		auto bytes = consume(server, (uint64_t)per * nr);
+		auto time = Runner::Clock::now() - start;
+
+		for (auto &t : threads)
+			t.join();
+		server.close();
+
+		if (bytes)
+			runner.report(name, (uint64_t)per * nr, *bytes, time);
+	}
+}
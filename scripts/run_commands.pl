@@ -16,6 +16,7 @@ my $basepath = "";
 my $clean;
 my $dbfile = 'structs.db';
 my $filter;
+my $incremental;
 my $jobs;
 my $silent = 0;
 my $skip = 0;
@@ -25,6 +26,7 @@ GetOptions(
 	"clean"		=> \$clean,
 	"jobs=i"	=> \$jobs,
 	"filter=s"	=> \$filter,
+	"incremental"	=> \$incremental,
 	"silent+"	=> \$silent,
 	"skip"		=> \$skip,
 	"verbose+"	=> \$verbose)
@@ -98,6 +100,51 @@ if ($skip) {
 		$abs => 1
 	} $dbh->selectall_array(q@SELECT src FROM source WHERE src LIKE '%.c';@);
 }
+
+# Skip TUs none of whose files changed since the last run. Rows of changed
+# files and of TUs to be reindexed are deleted (by ON DELETE CASCADE).
+if ($incremental) {
+	{
+		local $dbh->{AutoCommit} = 1;
+		$dbh->do('PRAGMA foreign_keys = ON;') || die "cannot enable foreign keys";
+	}
+
+	my %stale;
+	foreach my $row ($dbh->selectall_array(q@SELECT id, src, hash FROM source WHERE hash IS NOT NULL;@)) {
+		my ($id, $src, $hash) = @{$row};
+		my $content;
+		if (open(my $f, '<:raw', File::Spec->catfile($basepath, $src))) {
+			local $/;
+			$content = <$f>;
+			close $f;
+		}
+		$stale{$id} = 1 if (!defined $content || sha1_hex($content) ne $hash);
+	}
+
+	my %tus;
+	foreach my $row ($dbh->selectall_array(q@SELECT tu, dep, src FROM tu_dep LEFT JOIN source ON tu = source.id;@)) {
+		my ($tu, $dep, $src) = @{$row};
+		$tus{$tu}{src} = $src;
+		$tus{$tu}{stale} = 1 if ($stale{$dep});
+	}
+
+	my $del = $dbh->prepare('DELETE FROM source WHERE id = ?') || die "cannot prepare";
+	foreach my $tu (keys %tus) {
+		if ($tus{$tu}{stale}) {
+			$del->execute($tu) || die $dbh->errstr;
+			next;
+		}
+		my $abs = abs_path(File::Spec->catfile($basepath, $tus{$tu}{src}));
+		$skip_files{$abs} = 1 if (defined $abs);
+	}
+	foreach my $id (keys %stale) {
+		$del->execute($id) || die $dbh->errstr;
+	}
+	$dbh->commit;
+
+	print STDERR scalar(keys %stale), " files changed, ",
+		scalar(grep { $tus{$_}{stale} } keys %tus), " TUs to reindex\n";
+}
 $dbh->disconnect;
 
 my $json;
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace ClangStruct {
+
+/*
+ * A bounded lock-free multi-producer/multi-consumer queue (Vyukov's array
+ * queue). Each cell carries a sequence number telling whether it is free
+ * for the producer at that position or filled for the consumer.
+ *
+ * push() and pop() block on a full resp. empty queue (backpressure). Waiters
+ * sleep on the pushed/popped generation counters, which are notified only
+ * when somebody actually waits.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+	struct Stats {
+		size_t depth;
+		size_t maxSize;
+		uint64_t fullWaits;
+		uint64_t emptyWaits;
+	};
+
+	/* @depth is rounded up to a power of 2 */
+	BoundedQueue(size_t depth) {
+		size_t d = 2;
+		while (d < depth)
+			d <<= 1;
+		mask = d - 1;
+		cells = std::make_unique<Cell[]>(d);
+		for (size_t i = 0; i < d; i++)
+			cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+	/* @val is moved from only on success */
+	bool tryPush(T &val) {
+		auto pos = enqPos.load(std::memory_order_relaxed);
+		while (true) {
+			auto &c = cells[pos & mask];
+			auto seq = c.seq.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)pos;
+			if (!diff) {
+				if (enqPos.compare_exchange_weak(pos, pos + 1,
+								 std::memory_order_relaxed)) {
+					c.val = std::move(val);
+					c.seq.store(pos + 1, std::memory_order_release);
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else
+				pos = enqPos.load(std::memory_order_relaxed);
+		}
+
+		noteSize(pos + 1 - deqPos.load(std::memory_order_relaxed));
+		pushed.fetch_add(1);
+		if (popWaiters.load())
+			pushed.notify_all();
+
+		return true;
+	}
+
+	std::optional<T> tryPop() {
+		auto pos = deqPos.load(std::memory_order_relaxed);
+		std::optional<T> ret;
+		while (true) {
+			auto &c = cells[pos & mask];
+			auto seq = c.seq.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (!diff) {
+				if (deqPos.compare_exchange_weak(pos, pos + 1,
+								 std::memory_order_relaxed)) {
+					ret.emplace(std::move(c.val));
+					c.seq.store(pos + mask + 1, std::memory_order_release);
+					break;
+				}
+			} else if (diff < 0) {
+				return ret;
+			} else
+				pos = deqPos.load(std::memory_order_relaxed);
+		}
+
+		popped.fetch_add(1);
+		if (pushWaiters.load())
+			popped.notify_all();
+
+		return ret;
+	}
+
+	/* false if the queue was closed */
+	bool push(T &&val) {
+		while (!closed.load()) {
+			auto gen = popped.load();
+			if (tryPush(val))
+				return true;
+			fullWaits.fetch_add(1, std::memory_order_relaxed);
+			pushWaiters.fetch_add(1);
+			if (!closed.load())
+				popped.wait(gen);
+			pushWaiters.fetch_sub(1);
+		}
+
+		return false;
+	}
+
+	/* std::nullopt once the queue is closed and empty */
+	std::optional<T> pop() {
+		while (true) {
+			auto gen = pushed.load();
+			if (auto ret = tryPop())
+				return ret;
+			if (closed.load())
+				return std::nullopt;
+			emptyWaits.fetch_add(1, std::memory_order_relaxed);
+			popWaiters.fetch_add(1);
+			if (!closed.load())
+				pushed.wait(gen);
+			popWaiters.fetch_sub(1);
+		}
+	}
+
+	void close() {
+		closed.store(true);
+		pushed.fetch_add(1);
+		popped.fetch_add(1);
+		pushed.notify_all();
+		popped.notify_all();
+	}
+
+	size_t size() const {
+		return enqPos.load(std::memory_order_relaxed) - deqPos.load(std::memory_order_relaxed);
+	}
+
+	Stats stats() const {
+		return { mask + 1, maxSize.load(std::memory_order_relaxed),
+			fullWaits.load(std::memory_order_relaxed),
+			emptyWaits.load(std::memory_order_relaxed) };
+	}
+private:
+	struct Cell {
+		std::atomic<size_t> seq;
+		T val;
+	};
+
+	void noteSize(size_t size) {
+		auto max = maxSize.load(std::memory_order_relaxed);
+		while (size > max && !maxSize.compare_exchange_weak(max, size,
+								     std::memory_order_relaxed))
+			;
+	}
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> enqPos = 0;
+	alignas(64) std::atomic<size_t> deqPos = 0;
+	alignas(64) std::atomic<uint32_t> pushed = 0;
+	std::atomic<uint32_t> popWaiters = 0;
+	alignas(64) std::atomic<uint32_t> popped = 0;
+	std::atomic<uint32_t> pushWaiters = 0;
+	std::atomic<bool> closed = false;
+
+	std::atomic<size_t> maxSize = 0;
+	std::atomic<uint64_t> fullWaits = 0;
+	std::atomic<uint64_t> emptyWaits = 0;
+};
+
+}
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace ClangStruct {
+
+/*
+ * A shared memory hash table of headers claimed by clang processes. The
+ * first TU to reach a header (identified by a hash of its path and content)
+ * owns it and emits its records; all other TUs skip it. db_filler creates
+ * the table, the plugin only attaches to it.
+ *
+ * An owner marks its claims done once its records are sent. Claims of
+ * owners which died before that are taken over by the next TU, as are claims
+ * released by an owner whose TU failed.
+ *
+ * A private table serves threads of a single process instead, the owners are
+ * thread ids then.
+ */
+class ClaimTable {
+public:
+	static constexpr char shm_name[] = "/db_filler_claims";
+
+	enum STATE : uint32_t {
+		CLAIMED = 1,
+		DONE = 2,
+		RELEASED = 3,
+	};
+
+	struct Entry {
+		std::atomic<uint64_t> key;
+		std::atomic<int32_t> owner;
+		std::atomic<uint32_t> state;
+	};
+
+	ClaimTable() {}
+	~ClaimTable() {
+		if (entries)
+			munmap(entries, nrEntries * sizeof(Entry));
+	}
+
+	ClaimTable(const ClaimTable &) = delete;
+	ClaimTable &operator=(const ClaimTable &) = delete;
+
+	/* @nrEntries has to be a power of 2 */
+	int create(uint64_t nrEntries) {
+		if (!nrEntries || (nrEntries & (nrEntries - 1))) {
+			errno = EINVAL;
+			return -1;
+		}
+		return map(O_CREAT | O_EXCL | O_RDWR, nrEntries);
+	}
+	int attach() { return map(O_RDWR, 0); }
+	int createPrivate(uint64_t nrEntries);
+	static void unlink() { shm_unlink(shm_name); }
+
+	bool isMapped() const { return entries; }
+
+	static uint64_t makeKey(uint64_t pathHash, uint64_t contentHash) {
+		auto key = pathHash ^ (contentHash + 0x9e3779b97f4a7c15ULL +
+				       (pathHash << 6) + (pathHash >> 2));
+		return key ? key : 1;
+	}
+
+	/* returns true if the caller owns @key and shall emit its records */
+	bool claim(uint64_t key);
+	void done(uint64_t key);
+	/* gives up a claim which is not done, so that another TU takes it */
+	void release(uint64_t key);
+private:
+	int map(int flags, uint64_t nrEntries);
+	Entry *find(uint64_t key);
+
+	pid_t self() const {
+		return perThread ? syscall(SYS_gettid) : getpid();
+	}
+
+	static bool ownerDead(pid_t pid) {
+		return pid && kill(pid, 0) < 0 && errno == ESRCH;
+	}
+
+	Entry *entries = nullptr;
+	uint64_t nrEntries = 0;
+	bool perThread = false;
+};
+
+inline int ClaimTable::createPrivate(uint64_t nrEntries)
+{
+	if (!nrEntries || (nrEntries & (nrEntries - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	auto mem = mmap(nullptr, nrEntries * sizeof(Entry), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	entries = static_cast<Entry *>(mem);
+	this->nrEntries = nrEntries;
+	perThread = true;
+
+	return 0;
+}
+
+inline int ClaimTable::map(int flags, uint64_t nrEntries)
+{
+	int fd = shm_open(shm_name, flags, 0600);
+	if (fd < 0)
+		return -1;
+
+	if (flags & O_CREAT) {
+		if (ftruncate(fd, nrEntries * sizeof(Entry)) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			return -1;
+		}
+		nrEntries = st.st_size / sizeof(Entry);
+		if (!nrEntries || (nrEntries & (nrEntries - 1))) {
+			close(fd);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	auto mem = mmap(nullptr, nrEntries * sizeof(Entry), PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	entries = static_cast<Entry *>(mem);
+	this->nrEntries = nrEntries;
+
+	return 0;
+}
+
+inline ClaimTable::Entry *ClaimTable::find(uint64_t key)
+{
+	auto mask = nrEntries - 1;
+
+	for (uint64_t i = 0; i < nrEntries; i++) {
+		auto &e = entries[(key + i) & mask];
+		auto cur = e.key.load(std::memory_order_acquire);
+		if (cur == key)
+			return &e;
+		if (!cur)
+			return nullptr;
+	}
+
+	return nullptr;
+}
+
+inline bool ClaimTable::claim(uint64_t key)
+{
+	pid_t me = self();
+	auto mask = nrEntries - 1;
+
+	for (uint64_t i = 0; i < nrEntries; i++) {
+		auto &e = entries[(key + i) & mask];
+		uint64_t cur = 0;
+		if (e.key.compare_exchange_strong(cur, key)) {
+			e.owner.store(me);
+			e.state.store(CLAIMED, std::memory_order_release);
+			return true;
+		}
+		if (cur != key)
+			continue;
+
+		auto state = e.state.load(std::memory_order_acquire);
+		if (state == DONE)
+			return false;
+
+		/* the owner gave up */
+		if (state == RELEASED && e.state.compare_exchange_strong(state, CLAIMED)) {
+			e.owner.store(me);
+			return true;
+		}
+
+		/* the owner died before sending everything, take over */
+		int32_t owner = e.owner.load();
+		if (owner == me)
+			return true;
+		if (ownerDead(owner) && e.owner.compare_exchange_strong(owner, me))
+			return true;
+
+		return false;
+	}
+
+	/* the table is full, rather emit duplicates than lose anything */
+	return true;
+}
+
+inline void ClaimTable::done(uint64_t key)
+{
+	if (auto e = find(key))
+		if (e->owner.load() == self())
+			e->state.store(DONE, std::memory_order_release);
+}
+
+inline void ClaimTable::release(uint64_t key)
+{
+	if (auto e = find(key)) {
+		uint32_t state = CLAIMED;
+		if (e->owner.load() == self())
+			e->state.compare_exchange_strong(state, RELEASED, std::memory_order_release);
+	}
+}
+
+}
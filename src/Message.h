@@ -2,15 +2,19 @@
 
 #pragma once
 
-#include <cassert>
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
 #include <cstring>
 #include <ostream>
+#include <span>
 #include <string>
-#include <sstream>
-#include <tuple>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "Record.h"
+
 namespace ClangStruct {
 
 template<typename T>
@@ -23,19 +27,38 @@ public:
 	};
 	enum KIND {
 		INVALID = -1,
-		SOURCE = 'S',
-		STRUCT = 'T',
-		MEMBER = 'M',
-		USE = 'U',
+		SOURCE = Record::Schema<Record::Source>::kind,
+		STRUCT = Record::Schema<Record::Struct>::kind,
+		MEMBER = Record::Schema<Record::Member>::kind,
+		USE = Record::Schema<Record::Use>::kind,
+		DEP = Record::Schema<Record::Dep>::kind,
+		STATS = Record::Schema<Record::Stats>::kind,
+	};
+	/*
+	 * TEXT is the original format with key names and decimal integers. It
+	 * is kept for debugging. BINARY sends numeric field tags and varints.
+	 */
+	enum class FORMAT {
+		TEXT,
+		BINARY,
+	};
+
+	struct entry {
+		TYPE type;
+		T key;
+		T val;
+		int64_t num;
 	};
-	using entry = std::tuple<TYPE, const T, const T>;
 	using storage = std::vector<entry>;
 
+	/* the first byte of a binary message, the version is in the low bits */
+	static constexpr unsigned char BINARY_V1 = 0xb1;
+
 	Message() : Message(KIND::INVALID) { }
 	Message(const KIND &kind) : kind(kind) { entries.reserve(10); }
 
-	void add(TYPE type, T key, T val) {
-		entries.emplace_back(std::move(type), std::move(key), std::move(val));
+	void add(TYPE type, T key, T val, int64_t num = 0) {
+		entries.push_back({ type, std::move(key), std::move(val), num });
 	}
 
 	void add(T key, T val) {
@@ -43,12 +66,12 @@ public:
 	}
 
 	void add(T key) {
-		add(NUL, std::move(key), "");
+		add(NUL, std::move(key), T());
 	}
 
-	template<typename U>
+	template<typename U> requires std::is_arithmetic_v<U>
 	void add(T key, U val) {
-		add(INT, std::move(key), std::to_string(val));
+		add(INT, std::move(key), T(), static_cast<int64_t>(val));
 	}
 
 	void renew(const KIND &kind) {
@@ -64,70 +87,371 @@ public:
 	typename storage::const_iterator begin() const { return entries.begin(); }
 	typename storage::const_iterator end() const { return entries.end(); }
 
-	std::string serialize() const;
-	void deserialize(const std::string_view &str);
+	/* appends to @out, so that callers can reuse one buffer */
+	void serialize(std::string &out, FORMAT format = FORMAT::BINARY) const;
+	std::string serialize(FORMAT format = FORMAT::BINARY) const {
+		std::string out;
+		serialize(out, format);
+		return out;
+	}
+	/*
+	 * Both formats are detected automatically. With T=std::string_view,
+	 * keys point to static storage and values into @str.
+	 */
+	bool deserialize(const std::string_view &str);
+
+	/* replaces the content by @rec, whose texts have to outlive this */
+	template <Record::IsRecord R>
+	void fromRecord(const R &rec);
+	/*
+	 * Fills @rec, whose texts then point into this message. False if the
+	 * kind differs, a field is missing, or has a wrong type. Unknown fields
+	 * are ignored.
+	 */
+	template <Record::IsRecord R>
+	bool toRecord(R &rec) const;
+
+	static std::span<const std::string_view> keys(const KIND &kind);
 private:
+	static constexpr unsigned TAG_ESCAPE = 0x3f;
 
 	void setKind(const KIND &kind) { this->kind = kind; }
 
-	static void serializeString(std::stringstream &ss, const std::string &str);
-	static std::string_view deserializeString(std::string_view &str);
+	static int keyTag(const KIND &kind, std::string_view key);
+	static unsigned typeCode(const TYPE &type);
+
+	void serializeText(std::string &out) const;
+	void serializeBinary(std::string &out) const;
+	bool deserializeText(std::string_view str);
+	bool deserializeBinary(std::string_view str);
+
+	static void serializeString(std::string &out, std::string_view str);
+	static bool deserializeString(std::string_view &str, std::string_view &out);
+
+	static void serializeVarint(std::string &out, uint64_t val);
+	static bool deserializeVarint(std::string_view &str, uint64_t &val);
+	static bool deserializeBlob(std::string_view &str, std::string_view &blob);
 
 	KIND kind;
 	storage entries;
 };
 
-template<typename T> inline void Message<T>::serializeString(std::stringstream &ss, const std::string &str)
+/* the index is the wire tag, as in the schemas */
+template<typename T> inline std::span<const std::string_view> Message<T>::keys(const KIND &kind)
+{
+	switch (kind) {
+	case KIND::SOURCE:
+		return Record::keys<Record::Source>;
+	case KIND::STRUCT:
+		return Record::keys<Record::Struct>;
+	case KIND::MEMBER:
+		return Record::keys<Record::Member>;
+	case KIND::USE:
+		return Record::keys<Record::Use>;
+	case KIND::DEP:
+		return Record::keys<Record::Dep>;
+	case KIND::STATS:
+		return Record::keys<Record::Stats>;
+	default:
+		return {};
+	}
+}
+
+template<typename T> inline int Message<T>::keyTag(const KIND &kind, std::string_view key)
+{
+	auto k = keys(kind);
+
+	for (unsigned i = 0; i < k.size(); i++)
+		if (k[i] == key)
+			return i;
+
+	return -1;
+}
+
+template<typename T> inline unsigned Message<T>::typeCode(const TYPE &type)
+{
+	switch (type) {
+	case TYPE::NUL:
+		return 0;
+	case TYPE::INT:
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+template<typename T> inline void Message<T>::serializeString(std::string &out, std::string_view str)
 {
 	uint16_t sz = str.length();
-	ss.write((char *)&sz, sizeof(sz));
-	ss << str;
+	out.append((const char *)&sz, sizeof(sz));
+	out.append(str);
 }
 
-template<typename T> inline std::string_view Message<T>::deserializeString(std::string_view &str)
+/* false if @str is shorter than the length prefix or the string, may be empty */
+template<typename T> inline bool Message<T>::deserializeString(std::string_view &str,
+							       std::string_view &out)
 {
 	using slen = uint16_t;
-	assert(str.length() > sizeof(slen));
+	if (str.length() < sizeof(slen))
+		return false;
+
+	slen len;
+	memcpy(&len, str.data(), sizeof(len));
+	if (str.length() - sizeof(slen) < len)
+		return false;
+
+	out = str.substr(sizeof(slen), len);
+	str.remove_prefix(sizeof(slen) + len);
+	return true;
+}
+
+template<typename T> inline void Message<T>::serializeVarint(std::string &out, uint64_t val)
+{
+	while (val >= 0x80) {
+		out.push_back((char)(val | 0x80));
+		val >>= 7;
+	}
+	out.push_back((char)val);
+}
 
-	auto len = *(slen *)str.data();
-	auto ret = str.substr(sizeof(slen), len);
-	str = str.substr(sizeof(slen) + len);
-	return ret;
+template<typename T> inline bool Message<T>::deserializeVarint(std::string_view &str, uint64_t &val)
+{
+	val = 0;
+	for (unsigned shift = 0, i = 0; i < str.length() && shift < 64; i++, shift += 7) {
+		auto b = (unsigned char)str[i];
+		val |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			str.remove_prefix(i + 1);
+			return true;
+		}
+	}
+
+	return false;
 }
 
-template<typename T> inline std::string Message<T>::serialize() const
+template<typename T> inline bool Message<T>::deserializeBlob(std::string_view &str,
+							    std::string_view &blob)
 {
-	std::stringstream ss;
+	uint64_t len;
+	if (!deserializeVarint(str, len) || len > str.length())
+		return false;
+
+	blob = str.substr(0, len);
+	str.remove_prefix(len);
+	return true;
+}
 
-	ss.put(kind);
+template<typename T> inline void Message<T>::serializeText(std::string &out) const
+{
+	out.push_back(kind);
 
 	for (auto &e : entries) {
-		const auto [type, key, val] = e;
+		out.push_back(e.type);
+		serializeString(out, e.key);
+		if (e.type == TYPE::INT) {
+			char num[24];
+			auto res = std::to_chars(num, num + sizeof(num), e.num);
+			serializeString(out, std::string_view(num, res.ptr - num));
+		} else
+			serializeString(out, e.val);
+	}
+}
+
+template<typename T> inline void Message<T>::serializeBinary(std::string &out) const
+{
+	out.push_back(BINARY_V1);
+	out.push_back(kind);
 
-		ss.put(type);
-		serializeString(ss, key);
-		serializeString(ss, val);
+	for (auto &e : entries) {
+		auto tag = keyTag(kind, e.key);
+		auto code = typeCode(e.type);
+
+		if (tag < 0) {
+			out.push_back(TAG_ESCAPE << 2 | code);
+			serializeVarint(out, std::string_view(e.key).length());
+			out.append(e.key);
+		} else
+			out.push_back(tag << 2 | code);
+
+		if (e.type == TYPE::INT) {
+			/* zigzag, so that -1 is a single byte too */
+			serializeVarint(out, ((uint64_t)e.num << 1) ^ (uint64_t)(e.num >> 63));
+		} else if (e.type == TYPE::TEXT) {
+			serializeVarint(out, std::string_view(e.val).length());
+			out.append(e.val);
+		}
 	}
+}
 
-	return ss.str();
+template<typename T> inline void Message<T>::serialize(std::string &out, FORMAT format) const
+{
+	if (format == FORMAT::TEXT)
+		serializeText(out);
+	else
+		serializeBinary(out);
 }
 
-template<typename T> inline void Message<T>::deserialize(const std::string_view &str)
+template<typename T> inline bool Message<T>::deserializeText(std::string_view cur)
 {
-	renew((KIND)str[0]);
-	auto cur = str.substr(1);
+	renew((KIND)cur[0]);
+	cur.remove_prefix(1);
 
 	while (cur.length()) {
 		auto type = cur[0];
 		if (type == EOF)
 			break;
 
-		cur = cur.substr(1);
-		auto key = deserializeString(cur);
-		auto val = deserializeString(cur);
+		cur.remove_prefix(1);
+		std::string_view key, val;
+		if (!deserializeString(cur, key) || !deserializeString(cur, val))
+			return false;
+
+		if (type == TYPE::INT) {
+			auto end = val.data() + val.size();
+			int64_t num = 0;
+			auto res = std::from_chars(val.data(), end, num);
+			if (res.ptr != end)
+				return false;
+			add(TYPE::INT, T(key), T(), num);
+		} else
+			add((TYPE)type, T(key), T(val));
+	}
+
+	return true;
+}
+
+template<typename T> inline bool Message<T>::deserializeBinary(std::string_view cur)
+{
+	if (cur.length() < 2 || (unsigned char)cur[0] != BINARY_V1)
+		return false;
+
+	renew((KIND)cur[1]);
+	cur.remove_prefix(2);
+
+	auto k = keys(kind);
+	while (cur.length()) {
+		unsigned tag = (unsigned char)cur[0] >> 2;
+		unsigned code = cur[0] & 3;
+		cur.remove_prefix(1);
+
+		std::string_view key;
+		if (tag == TAG_ESCAPE) {
+			if (!deserializeBlob(cur, key))
+				return false;
+		} else if (tag < k.size()) {
+			key = k[tag];
+		} else
+			return false;
+
+		if (code == 0) {
+			add(TYPE::NUL, T(key), T());
+		} else if (code == 1) {
+			uint64_t zz;
+			if (!deserializeVarint(cur, zz))
+				return false;
+			add(TYPE::INT, T(key), T(), (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1));
+		} else {
+			std::string_view val;
+			if (!deserializeBlob(cur, val))
+				return false;
+			add(TYPE::TEXT, T(key), T(val));
+		}
+	}
+
+	return true;
+}
+
+template<typename T> inline bool Message<T>::deserialize(const std::string_view &str)
+{
+	if (str.empty()) {
+		renew(KIND::INVALID);
+		return false;
+	}
+
+	if ((unsigned char)str[0] == BINARY_V1)
+		return deserializeBinary(str);
+
+	return deserializeText(str);
+}
+
+template<typename T> template <Record::IsRecord R>
+inline void Message<T>::fromRecord(const R &rec)
+{
+	renew((KIND)Record::Schema<R>::kind);
+
+	Record::forEachField<R>([this, &rec](auto, const auto &field) {
+		const auto &val = rec.*field.member;
+		using V = std::decay_t<decltype(val)>;
+
+		if constexpr (std::is_same_v<V, Record::Text>) {
+			add(TYPE::TEXT, T(field.key), T(val));
+		} else if constexpr (std::is_same_v<V, Record::Int>) {
+			add(TYPE::INT, T(field.key), T(), val);
+		} else {
+			if (val)
+				add(TYPE::INT, T(field.key), T(), *val);
+			else
+				add(TYPE::NUL, T(field.key), T());
+		}
+	});
+}
 
-		add((TYPE)type, key, val);
+template<typename T> template <Record::IsRecord R>
+inline bool Message<T>::toRecord(R &rec) const
+{
+	constexpr auto &k = Record::keys<R>;
+	uint64_t seen = 0;
+	size_t next = 0;
+
+	if (kind != Record::Schema<R>::kind)
+		return false;
+
+	for (const auto &e : entries) {
+		std::string_view key(e.key);
+
+		/* the fields come in the schema order usually */
+		size_t idx = next < k.size() && k[next] == key ? next :
+			std::find(k.begin(), k.end(), key) - k.begin();
+		if (idx == k.size())
+			continue;
+		next = idx + 1;
+
+		bool ok = false;
+		Record::forEachField<R>([&e, &rec, &ok, idx](auto i, const auto &field) {
+			if (i != idx)
+				return;
+
+			auto &val = rec.*field.member;
+			using V = std::decay_t<decltype(val)>;
+
+			if constexpr (std::is_same_v<V, Record::Text>) {
+				if ((ok = e.type == TYPE::TEXT))
+					val = std::string_view(e.val);
+			} else if constexpr (std::is_same_v<V, Record::Int>) {
+				if ((ok = e.type == TYPE::INT))
+					val = e.num;
+			} else {
+				if (e.type == TYPE::NUL)
+					val.reset();
+				else
+					val = e.num;
+				ok = e.type == TYPE::NUL || e.type == TYPE::INT;
+			}
+		});
+		if (!ok)
+			return false;
+
+		seen |= 1ULL << idx;
 	}
+
+	/* missing optional fields are NULL */
+	Record::forEachField<R>([&rec, seen](auto i, const auto &field) {
+		if constexpr (!(Record::requiredMask<R> & (1ULL << i)))
+			if (!(seen & (1ULL << i)))
+				(rec.*field.member).reset();
+	});
+
+	return (seen & Record::requiredMask<R>) == Record::requiredMask<R>;
 }
 
 template<typename T> inline std::ostream& operator<<(std::ostream &os, const Message<T> &msg)
@@ -135,10 +459,13 @@ template<typename T> inline std::ostream& operator<<(std::ostream &os, const Mes
 	os.put(msg.getKind());
 
 	for (auto &e : msg) {
-		const auto [type, key, val] = e;
-		os << " --- " << key << "(";
-		os.put(type);
-		os << ")" << '=' << val;
+		os << " --- " << e.key << "(";
+		os.put(e.type);
+		os << ")" << '=';
+		if (e.type == Message<T>::TYPE::INT)
+			os << e.num;
+		else
+			os << e.val;
 	}
 
 	return os;
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace ClangStruct {
+
+/*
+ * A packet coalesces many serialized messages into one transport unit:
+ * a PACKET_MAGIC byte followed by records of [uint32_t length][message].
+ * Anything not starting with PACKET_MAGIC is a single bare message.
+ */
+class Packet {
+public:
+	static constexpr unsigned char PACKET_MAGIC = 0xba;
+	using rlen = uint32_t;
+
+	Packet(size_t limit = 0) : limit(limit) { }
+
+	void setLimit(size_t limit) { this->limit = limit; }
+	size_t getLimit() const { return limit; }
+
+	bool empty() const { return buf.size() <= 1; }
+	size_t size() const { return buf.size(); }
+	const std::string &data() const { return buf; }
+	void clear() { buf.clear(); }
+	std::string release() { return std::exchange(buf, std::string()); }
+
+	/* whether @len bytes of a message still fit into this packet */
+	bool fits(size_t len) const {
+		return (buf.empty() ? 1 : buf.size()) + sizeof(rlen) + len <= limit;
+	}
+
+	void append(std::string_view msg) {
+		if (buf.empty())
+			buf.push_back(PACKET_MAGIC);
+
+		rlen len = msg.length();
+		buf.append((const char *)&len, sizeof(len));
+		buf.append(msg);
+	}
+
+	static bool isPacket(std::string_view data) {
+		return !data.empty() && (unsigned char)data[0] == PACKET_MAGIC;
+	}
+
+	class Reader {
+	public:
+		Reader(std::string_view data) : cur(data), bare(!isPacket(data)) {
+			if (!bare)
+				cur.remove_prefix(1);
+		}
+
+		/* std::nullopt at the end, "" for a truncated packet */
+		std::optional<std::string_view> next() {
+			if (bare) {
+				if (cur.empty())
+					return std::nullopt;
+				return std::exchange(cur, std::string_view());
+			}
+
+			if (cur.empty())
+				return std::nullopt;
+
+			rlen len;
+			if (cur.length() < sizeof(len))
+				return std::exchange(cur, std::string_view()).substr(0, 0);
+			memcpy(&len, cur.data(), sizeof(len));
+			cur.remove_prefix(sizeof(len));
+			if (cur.length() < len)
+				return std::exchange(cur, std::string_view()).substr(0, 0);
+
+			auto ret = cur.substr(0, len);
+			cur.remove_prefix(len);
+			return ret;
+		}
+	private:
+		std::string_view cur;
+		bool bare;
+	};
+private:
+	size_t limit;
+	std::string buf;
+};
+
+}
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace ClangStruct::Record {
+
+/*
+ * The records sent from the plugin to db_filler, each defined once: a struct
+ * and its Schema, the list of its fields. The order of the fields is the wire
+ * tag (see Message::keys()), so only append to them.
+ *
+ * Fields are texts, integers, or integers which may be missing (NUL on the
+ * wire). Texts refer to storage of the sender resp. of the received message.
+ */
+using Text = std::string_view;
+using Int = int64_t;
+using OptInt = std::optional<int64_t>;
+
+template <typename R, typename V>
+struct Field {
+	using Value = V;
+
+	std::string_view key;
+	V R::*member;
+};
+
+template <typename R, typename V>
+constexpr Field<R, V> field(std::string_view key, V R::*member)
+{
+	static_assert(std::is_same_v<V, Text> || std::is_same_v<V, Int> ||
+		      std::is_same_v<V, OptInt>, "unsupported field type");
+	return { key, member };
+}
+
+struct Source {
+	Text src;
+};
+
+struct Struct {
+	Text name;
+	Text type;
+	Text attrs;
+	Int packed;
+	Int inMacro;
+	Text src;
+	Int begLine;
+	Int begCol;
+	Int endLine;
+	Int endCol;
+};
+
+struct Member {
+	Text name;
+	Text strct;
+	Text src;
+	Int strBegLine;
+	Int strBegCol;
+	Int begLine;
+	Int begCol;
+	Int endLine;
+	Int endCol;
+};
+
+struct Use {
+	Text member;
+	Text strct;
+	Text strSrc;
+	Int strLine;
+	Int strCol;
+	Text useSrc;
+	/* unknown whether loaded or stored */
+	OptInt load;
+	Int implicit;
+	Int begLine;
+	Int begCol;
+	Int endLine;
+	Int endCol;
+};
+
+struct Dep {
+	Text tu;
+	Text dep;
+	Text hash;
+};
+
+struct Stats {
+	Text tu;
+	Int wallUs;
+	Int matchUs;
+	Int structs;
+	Int members;
+	Int uses;
+	/* only if the transport serializes */
+	OptInt bytes;
+	OptInt maxRss;
+};
+
+template <typename R>
+struct Schema;
+
+template <>
+struct Schema<Source> {
+	static constexpr char kind = 'S';
+	static constexpr auto fields = std::make_tuple(
+		field("src", &Source::src));
+};
+
+template <>
+struct Schema<Struct> {
+	static constexpr char kind = 'T';
+	static constexpr auto fields = std::make_tuple(
+		field("name", &Struct::name),
+		field("type", &Struct::type),
+		field("attrs", &Struct::attrs),
+		field("packed", &Struct::packed),
+		field("inMacro", &Struct::inMacro),
+		field("src", &Struct::src),
+		field("begLine", &Struct::begLine),
+		field("begCol", &Struct::begCol),
+		field("endLine", &Struct::endLine),
+		field("endCol", &Struct::endCol));
+};
+
+template <>
+struct Schema<Member> {
+	static constexpr char kind = 'M';
+	static constexpr auto fields = std::make_tuple(
+		field("name", &Member::name),
+		field("struct", &Member::strct),
+		field("src", &Member::src),
+		field("strBegLine", &Member::strBegLine),
+		field("strBegCol", &Member::strBegCol),
+		field("begLine", &Member::begLine),
+		field("begCol", &Member::begCol),
+		field("endLine", &Member::endLine),
+		field("endCol", &Member::endCol));
+};
+
+template <>
+struct Schema<Use> {
+	static constexpr char kind = 'U';
+	static constexpr auto fields = std::make_tuple(
+		field("member", &Use::member),
+		field("struct", &Use::strct),
+		field("strSrc", &Use::strSrc),
+		field("strLine", &Use::strLine),
+		field("strCol", &Use::strCol),
+		field("use_src", &Use::useSrc),
+		field("load", &Use::load),
+		field("implicit", &Use::implicit),
+		field("begLine", &Use::begLine),
+		field("begCol", &Use::begCol),
+		field("endLine", &Use::endLine),
+		field("endCol", &Use::endCol));
+};
+
+template <>
+struct Schema<Dep> {
+	static constexpr char kind = 'D';
+	static constexpr auto fields = std::make_tuple(
+		field("tu", &Dep::tu),
+		field("dep", &Dep::dep),
+		field("hash", &Dep::hash));
+};
+
+template <>
+struct Schema<Stats> {
+	static constexpr char kind = 'P';
+	static constexpr auto fields = std::make_tuple(
+		field("tu", &Stats::tu),
+		field("wall_us", &Stats::wallUs),
+		field("match_us", &Stats::matchUs),
+		field("structs", &Stats::structs),
+		field("members", &Stats::members),
+		field("uses", &Stats::uses),
+		field("bytes", &Stats::bytes),
+		field("max_rss", &Stats::maxRss));
+};
+
+template <typename R>
+concept IsRecord = requires { Schema<R>::kind; Schema<R>::fields; };
+
+template <IsRecord R>
+inline constexpr size_t fieldCount = std::tuple_size_v<decltype(Schema<R>::fields)>;
+
+/* calls @f(index, field) for each field, the index is a std::integral_constant */
+template <IsRecord R, typename F>
+constexpr void forEachField(F &&f)
+{
+	[&f]<size_t... I>(std::index_sequence<I...>) {
+		(f(std::integral_constant<size_t, I>(), std::get<I>(Schema<R>::fields)), ...);
+	}(std::make_index_sequence<fieldCount<R>>());
+}
+
+template <IsRecord R>
+inline constexpr auto keys = [] {
+	std::array<std::string_view, fieldCount<R>> ret {};
+	forEachField<R>([&ret](auto idx, const auto &field) { ret[idx] = field.key; });
+	return ret;
+}();
+
+namespace Detail {
+
+struct Any {
+	template <typename V>
+	operator V() const;
+};
+
+/* the number of members of an aggregate, by how many initializers it takes */
+template <typename R, typename... A>
+constexpr size_t memberCount()
+{
+	if constexpr (requires { R { A()..., Any() }; })
+		return memberCount<R, A..., Any>();
+	else
+		return sizeof...(A);
+}
+
+}
+
+/*
+ * The schema has to list each member of the struct exactly once, so that a
+ * member missing on one side does not compile. Keys have to be unique and
+ * fit the masks below.
+ */
+template <IsRecord R>
+constexpr bool isValid()
+{
+	bool ret = fieldCount<R> == Detail::memberCount<R>() && fieldCount<R> < 64;
+
+	forEachField<R>([&ret](auto i, const auto &a) {
+		forEachField<R>([&ret, &a, i](auto j, const auto &b) {
+			if constexpr (i < j) {
+				if (a.key == b.key)
+					ret = false;
+				if constexpr (std::is_same_v<decltype(a), decltype(b)>)
+					if (a.member == b.member)
+						ret = false;
+			}
+		});
+	});
+
+	return ret;
+}
+
+static_assert(isValid<Source>() && isValid<Struct>() && isValid<Member>() &&
+	      isValid<Use>() && isValid<Dep>() && isValid<Stats>());
+
+/* the fields which a received record has to contain */
+template <IsRecord R>
+inline constexpr uint64_t requiredMask = [] {
+	uint64_t mask = 0;
+	forEachField<R>([&mask](auto idx, const auto &field) {
+		if (!std::is_same_v<typename std::decay_t<decltype(field)>::Value, OptInt>)
+			mask |= 1ULL << idx;
+	});
+	return mask;
+}();
+
+template <IsRecord R>
+std::ostream &operator<<(std::ostream &os, const R &rec)
+{
+	os.put(Schema<R>::kind);
+	forEachField<R>([&os, &rec](auto, const auto &field) {
+		const auto &val = rec.*field.member;
+		os << " --- " << field.key << '=';
+		if constexpr (std::is_same_v<std::decay_t<decltype(val)>, OptInt>) {
+			if (val)
+				os << *val;
+			else
+				os << "NULL";
+		} else
+			os << val;
+	});
+
+	return os;
+}
+
+}
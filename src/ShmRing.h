@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <optional>
+#include <string_view>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace ClangStruct {
+
+/*
+ * Shared memory transport: a header followed by an array of single
+ * producer/single consumer rings. Each producer (clang process) claims one
+ * ring by storing its pid into Ring::owner. Records are [rlen][data], aligned
+ * to 8 bytes and never wrapped; a PAD length skips to the start of the ring.
+ *
+ * Ring::head is advanced only after a record is completely written, so a
+ * producer which crashes mid-write never exposes a partial record. Its ring
+ * is drained and then freed by the consumer once the pid is found dead.
+ *
+ * The consumer sleeps on Header::doorbell. Producers ring it only when their
+ * ring goes from empty to non-empty. Both sides store their index and then
+ * load the other one, with a full fence in between, so that at least one of
+ * them sees the other's store: either the producer rings, or the consumer
+ * finds the record before sleeping.
+ */
+class ShmRing {
+public:
+	static constexpr char shm_name[] = "/db_filler_shm";
+	static constexpr uint32_t MAGIC = 0x314d4853; // "SHM1"
+	using rlen = uint32_t;
+	static constexpr rlen PAD = ~0U;
+
+	struct Header {
+		std::atomic<uint32_t> magic;
+		uint32_t nrRings;
+		uint64_t ringSize;
+		std::atomic<uint32_t> doorbell;
+		std::atomic<uint32_t> sleeping;
+	};
+
+	struct alignas(64) Ring {
+		std::atomic<int32_t> owner;
+		/* bumped by the consumer when tail moves, producers wait on it */
+		std::atomic<uint32_t> consumed;
+		std::atomic<uint32_t> producerWaiting;
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+	};
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free);
+	static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+	ShmRing() {}
+	~ShmRing() { unmap(); }
+
+	ShmRing(const ShmRing &) = delete;
+	ShmRing &operator=(const ShmRing &) = delete;
+
+	/* consumer side */
+	int create(unsigned nrRings, uint64_t ringSize);
+	std::optional<std::string_view> peek(unsigned idx);
+	void pop(unsigned idx, std::string_view rec);
+	bool reap(unsigned idx);
+	void wakeConsumer();
+	static void unlink() { shm_unlink(shm_name); }
+
+	/* producer side */
+	int attach();
+	bool claim(unsigned timeoutSec);
+	void release();
+	bool push(std::string_view rec);
+	uint64_t maxRecord() const { return hdr ? hdr->ringSize / 2 - sizeof(rlen) : 0; }
+
+	bool isMapped() const { return hdr; }
+	unsigned nrRings() const { return hdr ? hdr->nrRings : 0; }
+	Header *header() { return hdr; }
+
+	static long futexWait(std::atomic<uint32_t> &word, uint32_t val,
+			      const struct timespec *timeout) {
+		return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+			       val, timeout, nullptr, 0);
+	}
+	static long futexWake(std::atomic<uint32_t> &word) {
+		return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE,
+			       INT_MAX, nullptr, nullptr, 0);
+	}
+private:
+	static uint64_t align(uint64_t val) { return (val + 7) & ~7ULL; }
+	static size_t ringsOffset() { return align(sizeof(Header) + 63) & ~63ULL; }
+	static size_t mapSize(unsigned nrRings, uint64_t ringSize) {
+		return ringsOffset() + nrRings * (sizeof(Ring) + ringSize);
+	}
+	static bool ownerDead(pid_t pid) {
+		return kill(pid, 0) < 0 && errno == ESRCH;
+	}
+
+	Ring &ring(unsigned idx) {
+		return reinterpret_cast<Ring *>(base + ringsOffset())[idx];
+	}
+	char *data(unsigned idx) {
+		return base + ringsOffset() + hdr->nrRings * sizeof(Ring) + idx * hdr->ringSize;
+	}
+
+	void unmap() {
+		if (base)
+			munmap(base, size);
+		base = nullptr;
+		hdr = nullptr;
+	}
+
+	char *base = nullptr;
+	Header *hdr = nullptr;
+	size_t size = 0;
+	int myRing = -1;
+};
+
+inline int ShmRing::create(unsigned nrRings, uint64_t ringSize)
+{
+	if (!nrRings || ringSize < 4096 || (ringSize & (ringSize - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return -1;
+
+	size = mapSize(nrRings, ringSize);
+	if (ftruncate(fd, size) < 0) {
+		::close(fd);
+		return -1;
+	}
+
+	auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	/* ftruncate zeroed everything, only the geometry needs to be set */
+	base = static_cast<char *>(mem);
+	hdr = reinterpret_cast<Header *>(base);
+	hdr->nrRings = nrRings;
+	hdr->ringSize = ringSize;
+	hdr->magic.store(MAGIC, std::memory_order_release);
+
+	return 0;
+}
+
+inline int ShmRing::attach()
+{
+	int fd = shm_open(shm_name, O_RDWR, 0600);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+		::close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = st.st_size;
+	auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	base = static_cast<char *>(mem);
+	hdr = reinterpret_cast<Header *>(base);
+	if (hdr->magic.load(std::memory_order_acquire) != MAGIC ||
+			size < mapSize(hdr->nrRings, hdr->ringSize)) {
+		unmap();
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+inline bool ShmRing::claim(unsigned timeoutSec)
+{
+	pid_t me = getpid();
+	auto deadline = time(nullptr) + timeoutSec;
+
+	do {
+		for (unsigned i = 0; i < hdr->nrRings; i++) {
+			auto &r = ring(i);
+			int32_t owner = r.owner.load(std::memory_order_relaxed);
+			if (owner && !ownerDead(owner))
+				continue;
+			if (r.owner.compare_exchange_strong(owner, me, std::memory_order_acquire)) {
+				myRing = i;
+				return true;
+			}
+		}
+		usleep(10000);
+	} while (time(nullptr) < deadline);
+
+	return false;
+}
+
+inline void ShmRing::release()
+{
+	if (myRing < 0)
+		return;
+
+	/* unconsumed records stay in the ring, the next owner appends to them */
+	ring(myRing).owner.store(0, std::memory_order_release);
+	myRing = -1;
+}
+
+inline bool ShmRing::push(std::string_view rec)
+{
+	if (myRing < 0 || rec.length() > maxRecord())
+		return false;
+
+	auto &r = ring(myRing);
+	auto ringSize = hdr->ringSize;
+	auto need = align(sizeof(rlen) + rec.length());
+	auto oldHead = r.head.load(std::memory_order_relaxed);
+	auto head = oldHead;
+	auto off = head & (ringSize - 1);
+	auto contiguous = ringSize - off;
+	auto total = need + (contiguous < need ? contiguous : 0);
+
+	while (true) {
+		auto consumed = r.consumed.load(std::memory_order_acquire);
+		if (head + total - r.tail.load(std::memory_order_acquire) <= ringSize)
+			break;
+
+		/* full, wait for the consumer to make some space */
+		r.producerWaiting.store(1);
+		struct timespec timeout = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+		if (head + total - r.tail.load() > ringSize)
+			futexWait(r.consumed, consumed, &timeout);
+		r.producerWaiting.store(0, std::memory_order_relaxed);
+	}
+
+	auto d = data(myRing);
+	if (contiguous < need) {
+		memcpy(d + off, &PAD, sizeof(PAD));
+		head += contiguous;
+		off = 0;
+	}
+
+	rlen len = rec.length();
+	memcpy(d + off, &len, sizeof(len));
+	memcpy(d + off + sizeof(len), rec.data(), len);
+	r.head.store(head + need, std::memory_order_release);
+
+	/* a release store can be reordered with the load of tail */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (r.tail.load() == oldHead) {
+		hdr->doorbell.fetch_add(1);
+		if (hdr->sleeping.load())
+			futexWake(hdr->doorbell);
+	}
+
+	return true;
+}
+
+inline std::optional<std::string_view> ShmRing::peek(unsigned idx)
+{
+	auto &r = ring(idx);
+	auto ringSize = hdr->ringSize;
+
+	while (true) {
+		auto tail = r.tail.load(std::memory_order_relaxed);
+		if (tail == r.head.load(std::memory_order_acquire))
+			return std::nullopt;
+
+		auto off = tail & (ringSize - 1);
+		rlen len;
+		memcpy(&len, data(idx) + off, sizeof(len));
+		if (len == PAD) {
+			r.tail.store(tail + ringSize - off, std::memory_order_release);
+			continue;
+		}
+
+		return std::string_view(data(idx) + off + sizeof(len), len);
+	}
+}
+
+inline void ShmRing::pop(unsigned idx, std::string_view rec)
+{
+	auto &r = ring(idx);
+
+	r.tail.fetch_add(align(sizeof(rlen) + rec.length()), std::memory_order_release);
+	/* pairs with push(), orders the tail store before the next load of head */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	r.consumed.fetch_add(1);
+	if (r.producerWaiting.load())
+		futexWake(r.consumed);
+}
+
+/* free a ring whose producer died, returns true if it did so */
+inline bool ShmRing::reap(unsigned idx)
+{
+	auto &r = ring(idx);
+	int32_t owner = r.owner.load(std::memory_order_relaxed);
+
+	if (!owner || !ownerDead(owner))
+		return false;
+
+	return r.owner.compare_exchange_strong(owner, 0);
+}
+
+inline void ShmRing::wakeConsumer()
+{
+	if (!hdr)
+		return;
+
+	hdr->doorbell.fetch_add(1);
+	futexWake(hdr->doorbell);
+}
+
+}
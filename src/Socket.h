@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace ClangStruct {
+
+/*
+ * The socket transport is a SOCK_STREAM in the abstract namespace, so that
+ * it does not depend on the current directory of clang processes. Frames
+ * are [uint32_t length][packet]. A zero length frame marks the end of a TU.
+ */
+class Socket {
+public:
+	static constexpr char socket_name[] = "db_filler";
+	using flen = uint32_t;
+	static constexpr flen max_frame = 64 << 20;
+	/* the size of packets the clients batch messages into */
+	static constexpr size_t batch_size = 1 << 20;
+
+	static socklen_t fillAddr(struct sockaddr_un &addr,
+				  std::string_view name = socket_name) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		/* sun_path[0] stays '\0' for the abstract namespace */
+		memcpy(addr.sun_path + 1, name.data(), name.size());
+		return offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+	}
+};
+
+}
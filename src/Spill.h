@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/uio.h>
+
+namespace ClangStruct {
+
+/*
+ * Packets which a producer cannot send without blocking go to its own spill
+ * file instead, so that it can finish its TU, exit, and free its memory.
+ * db_filler ingests the files once it caught up.
+ *
+ * A file is [rlen][packet]... It is created as .tmp, locked, and only then
+ * renamed to .spill, so every .spill file is locked by its producer until
+ * it exits, killed or not. db_filler takes only files it can lock, i.e.
+ * finished ones. A producer killed mid-write leaves a truncated last
+ * packet, which was never sent and is dropped. Names start with the time
+ * of creation, so the files are ingested in order.
+ */
+class SpillFile {
+public:
+	static constexpr char default_dir[] = "/tmp/db_filler-spill";
+	static constexpr char suffix[] = ".spill";
+	using rlen = uint32_t;
+
+	SpillFile() {}
+	~SpillFile() { close(); }
+
+	SpillFile(const SpillFile &) = delete;
+	SpillFile &operator=(const SpillFile &) = delete;
+
+	bool isOpen() const { return fd >= 0; }
+
+	int open(const std::filesystem::path &dir);
+	/* unlocks the file, db_filler can take it then */
+	void close() {
+		if (fd >= 0)
+			::close(std::exchange(fd, -1));
+	}
+	int append(std::string_view packet);
+
+	/* sorts by the creation time */
+	static std::string makeName(pid_t pid);
+private:
+	int fd = -1;
+	off_t size = 0;
+};
+
+/* db_filler's side: the packets of finished spill files in @dir */
+class SpillDir {
+public:
+	SpillDir(std::filesystem::path dir) : dir(std::move(dir)) {}
+	~SpillDir() { closeCur(); }
+
+	SpillDir(const SpillDir &) = delete;
+	SpillDir &operator=(const SpillDir &) = delete;
+
+	int create();
+
+	/* queues the files present now, returns how many are queued */
+	size_t scan();
+	/* valid until the next call, std::nullopt when no finished file is left */
+	std::optional<std::string_view> next();
+
+	/* queued files which are still being written */
+	size_t pending() const { return files.size(); }
+	size_t ingested() const { return nrIngested; }
+private:
+	bool openNext();
+	void closeCur();
+
+	std::filesystem::path dir;
+	std::deque<std::filesystem::path> files;
+
+	int fd = -1;
+	std::filesystem::path curPath;
+	const char *data = nullptr;
+	size_t len = 0;
+	size_t off = 0;
+	size_t nrIngested = 0;
+};
+
+inline std::string SpillFile::makeName(pid_t pid)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%010lld.%09ld-%d", (long long)ts.tv_sec, ts.tv_nsec, pid);
+
+	return buf;
+}
+
+inline int SpillFile::open(const std::filesystem::path &dir)
+{
+	auto name = makeName(getpid());
+	auto tmp = dir / (name + ".tmp");
+
+	fd = ::open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_APPEND | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	if (flock(fd, LOCK_EX) < 0 || rename(tmp.c_str(), (dir / (name + suffix)).c_str()) < 0) {
+		auto err = errno;
+		unlink(tmp.c_str());
+		close();
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+inline int SpillFile::append(std::string_view packet)
+{
+	rlen len = packet.length();
+	struct iovec iov[] = {
+		{ .iov_base = &len, .iov_len = sizeof(len) },
+		{ .iov_base = const_cast<char *>(packet.data()), .iov_len = packet.length() },
+	};
+	size_t total = sizeof(len) + packet.length();
+	size_t done = 0;
+
+	while (done < total) {
+		auto ret = writev(fd, iov, std::size(iov));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* do not leave a partial packet in front of the next ones */
+			auto err = errno;
+			if (ftruncate(fd, size) < 0)
+				close();
+			errno = err;
+			return -1;
+		}
+		done += ret;
+		for (auto &v : iov) {
+			auto skip = std::min<size_t>(ret, v.iov_len);
+			v.iov_base = (char *)v.iov_base + skip;
+			v.iov_len -= skip;
+			ret -= skip;
+		}
+	}
+
+	size += total;
+
+	return 0;
+}
+
+}
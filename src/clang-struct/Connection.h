@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "../Message.h"
+
+namespace ClangStruct {
+
+/*
+ * Where StructVisitor sends the records to. The messages only refer to their
+ * keys and values, which are valid until write() returns.
+ */
+class Connection {
+public:
+	using Msg = Message<std::string_view>;
+
+	Connection() {}
+	virtual ~Connection() {}
+
+	virtual int open() = 0;
+	virtual void write(const Msg &msg) = 0;
+	virtual void flush() {}
+	virtual void endTU() { flush(); }
+	/* serialized size of the records written so far, if they are serialized */
+	virtual std::optional<size_t> bytes() const { return std::nullopt; }
+};
+
+}
@@ -0,0 +1,539 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "clang/AST/ParentMapContext.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/xxhash.h"
+
+#include "StructVisitor.h"
+
+using namespace clang;
+using namespace ClangStruct;
+
+StructVisitor::Loc StructVisitor::getLoc(const SourceLocation &SLOC) const
+{
+	auto PLoc = SM.getPresumedLoc(SLOC);
+	if (PLoc.isInvalid())
+		return { nullptr, 0, 0 };
+
+	return { PLoc.getFilename(), PLoc.getLine(), PLoc.getColumn() };
+}
+
+/*
+ * Not per FileID: #line can change the name within a file and macro
+ * locations resolve to other files.
+ */
+StructVisitor::Src &StructVisitor::getSrc(const char *file)
+{
+	auto [it, inserted] = srcCache.try_emplace(file, nullptr);
+	if (inserted)
+		it->second = &srcs.emplace_back(Src { normalizeSrc(file ? file : ""), false });
+
+	return *it->second;
+}
+
+std::string StructVisitor::normalizeSrc(llvm::StringRef src)
+{
+	std::filesystem::path p(src.str());
+
+	p = p.lexically_normal();
+
+	if (!basePath.empty()) {
+		auto rel = p.lexically_relative(basePath);
+		if (!rel.empty())
+			p = std::move(rel);
+	}
+
+	return p.string();
+}
+
+StructVisitor::~StructVisitor()
+{
+	/* owners stay alive in clang-struct-index, so give up what is not done */
+	if (claims)
+		for (auto key : owned)
+			claims->release(key);
+}
+
+bool StructVisitor::isForeign(const SourceLocation &SLOC)
+{
+	if (!claims)
+		return false;
+
+	auto FID = SM.getFileID(SM.getExpansionLoc(SLOC));
+	if (FID.isInvalid() || FID == SM.getMainFileID())
+		return false;
+
+	auto [it, inserted] = foreign.try_emplace(FID, false);
+	if (!inserted)
+		return it->second;
+
+	bool invalid = false;
+	auto content = SM.getBufferData(FID, &invalid);
+	if (invalid || !SM.getFileEntryForID(FID))
+		return false;
+
+	/* the same path can differ in content, e.g. generated headers */
+	auto key = ClaimTable::makeKey(llvm::xxHash64(getSrc(SLOC).name), llvm::xxHash64(content));
+	if (claims->claim(key))
+		owned.push_back(key);
+	else
+		it->second = true;
+
+	return it->second;
+}
+
+namespace {
+
+/* the key type differs among clang versions */
+[[maybe_unused]] llvm::StringRef fileName(const FileEntry *FE) { return FE->getName(); }
+[[maybe_unused]] llvm::StringRef fileName(const FileEntryRef &FE) { return FE.getName(); }
+
+}
+
+void StructVisitor::addDeps()
+{
+	auto &tuSrc = getSrc(SM.getLocForStartOfFile(SM.getMainFileID()));
+	std::string_view tu = tuSrc.name;
+
+	addSrc(tuSrc);
+
+	for (auto it = SM.fileinfo_begin(); it != SM.fileinfo_end(); ++it) {
+		auto buf = it->second->getBufferIfLoaded();
+		if (!buf)
+			continue;
+
+		auto dep = normalizeSrc(fileName(it->first));
+		auto hash = llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(buf->getBuffer())),
+					true);
+
+		addSrc(dep);
+
+		write(Record::Dep { .tu = tu, .dep = dep, .hash = hash });
+	}
+}
+
+void StructVisitor::addSrc(Src &src)
+{
+	if (src.added)
+		return;
+
+	src.added = true;
+	addSrc(src.name);
+}
+
+void StructVisitor::addSrc(std::string_view src)
+{
+	if (!sources.insert(llvm::StringRef(src.data(), src.size())).second)
+		return;
+
+	write(Record::Source { .src = src });
+}
+
+void StructVisitor::handleUse(const SourceRange &initSR, const NamedDecl *ND, const RecordDecl *RD,
+			      int load, bool implicit)
+{
+	auto strLoc = getLoc(RD->getBeginLoc());
+	auto begLoc = getLoc(initSR.getBegin());
+	auto &strSrc = getSrc(strLoc.file);
+	auto &useSrc = getSrc(begLoc.file);
+	auto endLoc = getLoc(initSR.getEnd());
+
+	addSrc(useSrc);
+
+	write(Record::Use {
+		.member = getNDName(ND),
+		.strct = getRDName(RD),
+		.strSrc = strSrc.name,
+		.strLine = strLoc.line,
+		.strCol = strLoc.col,
+		.useSrc = useSrc.name,
+		.load = load < 0 ? Record::OptInt() : load,
+		.implicit = implicit,
+		.begLine = begLoc.line,
+		.begCol = begLoc.col,
+		.endLine = endLoc.line,
+		.endCol = endLoc.col,
+	});
+	nrUses++;
+}
+
+void StructVisitor::handleME(const MemberExpr *ME, int store)
+{
+	//ME->dumpColor();
+	//auto &SM = C.getSourceManager();
+
+	auto T = ME->getBase()->getType();
+	if (auto PT = T->getAs<PointerType>())
+		T = PT->getPointeeType();
+
+	if (auto ST = T->getAsStructureType()) {
+		handleUse(ME, ST->getDecl(), store);
+	} else if (auto RD = T->getAsRecordDecl()) {
+		handleUse(ME, RD, store);
+	} else {
+		llvm::errs() << __PRETTY_FUNCTION__ << ": unhandled type\n";
+		ME->getSourceRange().dump(SM);
+		ME->dumpColor();
+		T->dump();
+		abort();
+	}
+}
+
+std::string_view StructVisitor::getNDName(const NamedDecl *ND)
+{
+	if (!ND->getIdentifier())
+		return "<unnamed>";
+
+	auto name = ND->getName();
+	return { name.data(), name.size() };
+}
+
+std::string_view StructVisitor::getRDName(const RecordDecl *RD)
+{
+	if (RD->isAnonymousStructOrUnion())
+		return "<anonymous>";
+
+	return getNDName(RD);
+}
+
+void StructVisitor::handleRD(const RecordDecl *RD)
+{
+	//RD->dumpColor();
+
+	auto RDSR = RD->getSourceRange();
+	auto RDName = getRDName(RD);
+	auto begLoc = getLoc(RDSR.getBegin());
+	auto endLoc = getLoc(RDSR.getEnd());
+	auto &src = getSrc(begLoc.file);
+
+	addSrc(src);
+
+	std::string_view type;
+	if (RD->isStruct())
+		type = "s";
+	else if (RD->isUnion())
+		type = "u";
+	else {
+		llvm::errs() << src.name << ": unknown RD type:\n";
+		RD->dumpColor();
+		return;
+	}
+
+	bool packed = false;
+	attrs.clear();
+	for (const auto &f : RD->attrs()) {
+		// implicit attrs don't have names
+		// so VisibilityAttr do not
+		if (!f->getAttrName()) {
+			if (!f->isImplicit() && !llvm::isa<VisibilityAttr>(f)) {
+				llvm::errs() << src.name << ": unnamed attribute: ";
+				f->printPretty(llvm::errs(), RD->getASTContext().getPrintingPolicy());
+				llvm::errs() << " in:\n";
+				RD->dumpColor();
+			}
+			continue;
+		}
+		if (!attrs.empty())
+			attrs.push_back('|');
+		auto attr = f->getNormalizedFullName();
+		if (attr == "packed")
+			packed = true;
+		attrs.append(attr);
+	}
+
+	write(Record::Struct {
+		.name = RDName,
+		.type = type,
+		.attrs = attrs,
+		.packed = packed,
+		.inMacro = RDSR.getBegin().isMacroID(),
+		.src = src.name,
+		.begLine = begLoc.line,
+		.begCol = begLoc.col,
+		.endLine = endLoc.line,
+		.endCol = endLoc.col,
+	});
+	nrStructs++;
+
+	for (const auto &f : RD->fields()) {
+		//f->dumpColor();
+		/*llvm::errs() << __func__ << ": " << RD->getNameAsString() <<
+				"." << f->getNameAsString() << "\n";*/
+		auto SR = f->getSourceRange();
+		auto memBegLoc = getLoc(SR.getBegin());
+		auto memEndLoc = getLoc(SR.getEnd());
+
+		write(Record::Member {
+			.name = getNDName(f),
+			.strct = RDName,
+			.src = src.name,
+			.strBegLine = begLoc.line,
+			.strBegCol = begLoc.col,
+			.begLine = memBegLoc.line,
+			.begCol = memBegLoc.col,
+			.endLine = memEndLoc.line,
+			.endCol = memEndLoc.col,
+		});
+		nrMembers++;
+	}
+}
+
+void StructVisitor::handleILE(const InitListExpr *ILE, ASTContext *AC)
+{
+	auto T = ILE->getType().getCanonicalType();
+	if (auto RT = T->getAsStructureType()) {
+		auto RD = RT->getDecl();
+		//RD->dumpColor();
+		for (auto field: RD->fields()) {
+			SourceRange SR;
+			bool implicit = true;
+			auto idx = field->getFieldIndex();
+			if (idx < ILE->getNumInits()) {
+				auto init = ILE->getInit(idx);
+				if (!init) {
+					llvm::errs() << "null initializer for " <<
+							field->getFieldIndex() << "\n";
+					field->dumpColor();
+					RD->dumpColor();
+					ILE->dumpColor();
+					abort();
+				}
+
+				SR = init->getSourceRange();
+				implicit = llvm::isa<ImplicitValueInitExpr>(init);
+
+				/*llvm::errs() << "field " << field->getFieldIndex() << "\n";
+				field->dumpColor();
+				llvm::errs() << "init\n";
+				init->dumpColor();
+				SR.dump(SM);*/
+			}
+			// implicit initializers have invalid SR, so have nested ILEs
+			if (SR.isInvalid()) {
+				auto parent = DynTypedNode::create(*ILE);
+				auto &map = AC->getParentMapContext();
+				for (unsigned jumps = 1;; jumps++) {
+					SR = parent.getSourceRange();
+					if (SR.isValid())
+						break;
+					parent = map.getParents(parent)[0];
+					if (!parent.get<InitListExpr>()) {
+						llvm::errs() << "idx=" << idx << " jumps=" <<
+								jumps << "\n";
+						field->dumpColor();
+						RD->dumpColor();
+						ILE->dumpColor();
+						parent.dump(llvm::errs(), *AC);
+						abort();
+					}
+				}
+			}
+
+			handleUse(SR, field, RD, 0, implicit);
+		}
+	} else if (T->isUnionType()) {
+	} else if (!T->isConstantArrayType() && !llvm::isa<TypeOfType>(T) &&
+		   !llvm::isa<BuiltinType>(T) && !llvm::isa<PointerType>(T)) {
+		llvm::errs() << __PRETTY_FUNCTION__ << ": unhandled type\n";
+		ILE->getSourceRange().dump(SM);
+		ILE->dumpColor();
+		T->dump();
+		abort();
+	}
+}
+
+/*
+ * Calls @f for the member expressions which @S loads from or stores to. The
+ * left-hand side is checked first and wins, the right one is not considered
+ * then.
+ */
+template <typename F>
+void StructVisitor::forEachBound(const Stmt *S, F f)
+{
+	if (auto BO = llvm::dyn_cast<BinaryOperator>(S)) {
+		if (auto ME = llvm::dyn_cast<MemberExpr>(BO->getLHS()->IgnoreUnlessSpelledInSource()))
+			f(ME, BO->isAssignmentOp() ? 0 : 1);
+		else if (auto ME = llvm::dyn_cast<MemberExpr>(BO->getRHS()->IgnoreUnlessSpelledInSource()))
+			f(ME, 1);
+	} else if (auto UO = llvm::dyn_cast<UnaryOperator>(S)) {
+		if (UO->getOpcode() != UO_LNot)
+			return;
+		if (auto ME = llvm::dyn_cast<MemberExpr>(UO->getSubExpr()->IgnoreUnlessSpelledInSource()))
+			f(ME, 1);
+	} else if (auto CE = llvm::dyn_cast<CallExpr>(S)) {
+		/* only arguments with a parameter, i.e. not the variadic ones */
+		auto FD = llvm::dyn_cast_or_null<FunctionDecl>(CE->getCalleeDecl());
+		if (!FD)
+			return;
+		auto args = std::min(CE->getNumArgs(), FD->getNumParams());
+		for (unsigned i = 0; i < args; i++) {
+			auto arg = CE->getArg(i)->IgnoreUnlessSpelledInSource();
+			if (auto ME = llvm::dyn_cast<MemberExpr>(arg))
+				f(ME, 1);
+		}
+	}
+}
+
+/* only the nearest ancestor which is more than parens or casts can bind @ME */
+bool StructVisitor::isBound(const MemberExpr *ME) const
+{
+	for (auto it = parents.rbegin(); it != parents.rend(); ++it) {
+		auto E = llvm::dyn_cast<Expr>(*it);
+		if (E && E->IgnoreParenCasts() == ME)
+			continue;
+
+		bool bound = false;
+		forEachBound(*it, [ME, &bound](const MemberExpr *boundME, int) {
+			bound |= boundME == ME;
+		});
+		return bound;
+	}
+
+	return false;
+}
+
+/*
+ * The records are written in pre-order. A member expression bound by its
+ * parent is written together with the parent, so that it is before the
+ * parent's other children.
+ */
+void StructVisitor::visit(const Stmt *S)
+{
+	if (auto ILE = llvm::dyn_cast<InitListExpr>(S)) {
+		handleILE(ILE, AC);
+		return;
+	}
+
+	/* all of these were seen already in the syntactic form */
+	if (semanticForms)
+		return;
+
+	if (auto ME = llvm::dyn_cast<MemberExpr>(S)) {
+		if (isBound(ME))
+			return;
+		auto base = ME->getBase()->IgnoreUnlessSpelledInSource();
+		handleME(ME, llvm::isa<MemberExpr>(base) ? 1 : -1);
+		return;
+	}
+
+	forEachBound(S, [this](const MemberExpr *ME, int load) {
+		handleME(ME, load);
+	});
+}
+
+bool StructVisitor::TraverseDecl(Decl *D)
+{
+	/* builtins like __va_list_tag */
+	if (!D || D->isImplicit())
+		return true;
+
+	if (auto RD = llvm::dyn_cast<RecordDecl>(D))
+		if (RD->isThisDeclarationADefinition())
+			handleRD(RD);
+
+	return RecursiveASTVisitor::TraverseDecl(D);
+}
+
+bool StructVisitor::TraverseStmt(Stmt *S, DataRecursionQueue *queue)
+{
+	if (!S)
+		return true;
+
+	visit(S);
+
+	parents.push_back(S);
+	auto ret = RecursiveASTVisitor::TraverseStmt(S, queue);
+	parents.pop_back();
+
+	return ret;
+}
+
+/*
+ * Both forms are walked: handleILE() needs the semantic one, incl. the ILEs
+ * made up for designators. The initializers themselves are shared by the two.
+ */
+bool StructVisitor::TraverseInitListExpr(InitListExpr *ILE)
+{
+	auto traverseChildren = [this](InitListExpr *form) {
+		if (form)
+			for (auto child : form->children())
+				if (!TraverseStmt(child))
+					return false;
+		return true;
+	};
+
+	if (ILE->isSemanticForm() && ILE->isSyntacticForm())
+		return traverseChildren(ILE);
+
+	if (!traverseChildren(ILE->isSemanticForm() ? ILE->getSyntacticForm() : ILE))
+		return false;
+
+	semanticForms++;
+	auto ret = traverseChildren(ILE->isSemanticForm() ? ILE : ILE->getSemanticForm());
+	semanticForms--;
+
+	return ret;
+}
+
+void StructVisitor::match(ASTContext &AC)
+{
+	this->AC = &AC;
+
+	/* skip top-level declarations (and their bodies) in foreign headers */
+	if (claims) {
+		std::vector<Decl *> scope;
+		for (auto D : AC.getTranslationUnitDecl()->decls())
+			if (!isForeign(D->getBeginLoc()))
+				scope.push_back(D);
+		AC.setTraversalScope(scope);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	TraverseAST(AC);
+	matchTime = std::chrono::steady_clock::now() - start;
+
+	addDeps();
+}
+
+void StructVisitor::addStats(std::chrono::steady_clock::time_point start)
+{
+	auto us = [](const std::chrono::steady_clock::duration &d) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	};
+	auto bytes = conn.bytes();
+	struct rusage ru;
+	bool haveRU = !getrusage(RUSAGE_SELF, &ru);
+
+	write(Record::Stats {
+		.tu = getSrc(SM.getLocForStartOfFile(SM.getMainFileID())).name,
+		.wallUs = us(std::chrono::steady_clock::now() - start),
+		.matchUs = us(matchTime),
+		.structs = nrStructs,
+		.members = nrMembers,
+		.uses = nrUses,
+		.bytes = bytes ? Record::OptInt(*bytes) : std::nullopt,
+		.maxRss = haveRU ? Record::OptInt(ru.ru_maxrss) : std::nullopt,
+	});
+}
+
+void StructVisitor::finish(ASTContext &AC)
+{
+	if (!claims)
+		return;
+
+	/* headers may be incomplete after errors, leave them to other TUs */
+	if (!AC.getDiagnostics().hasErrorOccurred()) {
+		for (auto key : owned)
+			claims->done(key);
+		owned.clear();
+	}
+
+	AC.setTraversalScope({ AC.getTranslationUnitDecl() });
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
+
+#include "../ClaimTable.h"
+#include "Connection.h"
+
+namespace ClangStruct {
+
+/*
+ * Finds struct definitions and member uses in a TU and writes them to a
+ * Connection. Shared by the plugin and clang-struct-index.
+ *
+ * A single walk over the AST. Whether a member is loaded or stored is decided
+ * when the member expression is reached, from its parent: assignments,
+ * binary operators, '!', and arguments of calls with a matching parameter.
+ */
+class StructVisitor : public clang::RecursiveASTVisitor<StructVisitor> {
+public:
+	using Msg = Connection::Msg;
+
+	StructVisitor(clang::SourceManager &SM, Connection &conn,
+		      const std::filesystem::path &basePath, ClaimTable *claims) :
+		SM(SM), conn(conn), basePath(basePath), claims(claims) { }
+	~StructVisitor();
+
+	/* walk the TU */
+	void match(clang::ASTContext &AC);
+	/* @start is when the TU began to be parsed */
+	void addStats(std::chrono::steady_clock::time_point start);
+	/*
+	 * To be called once the records are sent. Claims not marked done here,
+	 * e.g. as the TU failed, are released on destruction.
+	 */
+	void finish(clang::ASTContext &AC);
+
+	/* RecursiveASTVisitor */
+	bool shouldVisitImplicitCode() const { return true; }
+	bool TraverseDecl(clang::Decl *D);
+	bool TraverseStmt(clang::Stmt *S, DataRecursionQueue *queue = nullptr);
+	bool TraverseInitListExpr(clang::InitListExpr *ILE);
+private:
+	void visit(const clang::Stmt *S);
+	bool isBound(const clang::MemberExpr *ME) const;
+	template <typename F>
+	static void forEachBound(const clang::Stmt *S, F f);
+
+	/* whether @SLOC lies in a header claimed by another TU */
+	bool isForeign(const clang::SourceLocation &SLOC);
+	/* report all files read by this TU with their hashes */
+	void addDeps();
+
+	/* a presumed location, decomposed once */
+	struct Loc {
+		const char *file;
+		unsigned line;
+		unsigned col;
+	};
+
+	struct Src {
+		std::string name;
+		bool added;
+	};
+
+	Loc getLoc(const clang::SourceLocation &SLOC) const;
+	Src &getSrc(const char *file);
+	Src &getSrc(const clang::SourceLocation &SLOC) { return getSrc(getLoc(SLOC).file); }
+	std::string normalizeSrc(llvm::StringRef src);
+	template <typename R>
+	void write(const R &rec) {
+		msg.fromRecord(rec);
+		conn.write(msg);
+	}
+	void addSrc(Src &src);
+	void addSrc(std::string_view src);
+
+	void handleUse(const clang::SourceRange &initSR, const clang::NamedDecl *ND,
+		       const clang::RecordDecl *RD, int load, bool implicit);
+	void handleUse(const clang::MemberExpr *ME, const clang::RecordDecl *RD, int load) {
+		handleUse(ME->getSourceRange(), ME->getMemberDecl(), RD, load, false);
+	}
+	void handleME(const clang::MemberExpr *ME, int store);
+	void handleRD(const clang::RecordDecl *RD);
+	void handleILE(const clang::InitListExpr *ILE, clang::ASTContext *AC);
+
+	/* the names live in the identifier table of the TU */
+	static std::string_view getNDName(const clang::NamedDecl *ND);
+	static std::string_view getRDName(const clang::RecordDecl *RD);
+
+	clang::SourceManager &SM;
+	clang::ASTContext *AC = nullptr;
+
+	Connection &conn;
+	/* reused for all records, so that they do not allocate once it has grown */
+	Msg msg;
+	std::string attrs;
+	const std::filesystem::path &basePath;
+	/* by presumed file names, they are unique strings owned by SM */
+	llvm::DenseMap<const char *, Src *> srcCache;
+	std::deque<Src> srcs;
+	llvm::StringSet<> sources;
+
+	std::chrono::steady_clock::duration matchTime {};
+	Record::Int nrStructs = 0;
+	Record::Int nrMembers = 0;
+	Record::Int nrUses = 0;
+
+	llvm::SmallVector<const clang::Stmt *, 32> parents;
+	unsigned semanticForms = 0;
+
+	ClaimTable *claims;
+	llvm::DenseMap<clang::FileID, bool> foreign;
+	std::vector<uint64_t> owned;
+};
+
+}
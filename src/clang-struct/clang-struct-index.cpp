@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include "../BoundedQueue.h"
+#include "../ClaimTable.h"
+#include "../Packet.h"
+#include "../sqlconn.h"
+#include "Connection.h"
+#include "StructVisitor.h"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace ClangStruct;
+namespace cl = llvm::cl;
+
+namespace {
+
+cl::OptionCategory category("clang-struct-index options");
+
+cl::opt<std::string> buildPath("p", cl::desc("Directory containing compile_commands.json"),
+			       cl::init("."), cl::cat(category));
+cl::opt<std::string> dbFile("db", cl::desc("Database file to store into"),
+			    cl::init("structs.db"), cl::cat(category));
+cl::opt<std::string> basePath("base-path",
+			      cl::desc("Path to resolve file paths against (empty = absolute paths)"),
+			      cl::cat(category));
+cl::opt<std::string> filter("filter", cl::desc("Index only files matching this regex"),
+			    cl::cat(category));
+cl::opt<unsigned> jobs("j", cl::desc("Number of indexing threads (0 = number of CPUs)"),
+		       cl::init(0), cl::cat(category));
+cl::opt<unsigned> claims("claims",
+			 cl::desc("Slots of the header claim table (power of 2, "
+				  "0 = every TU records all headers)"),
+			 cl::init(1 << 20), cl::cat(category));
+cl::opt<bool> bulk("bulk", cl::desc("Append to unindexed tables and build the real ones at exit"),
+		   cl::cat(category));
+cl::opt<std::string> sqlite("sqlite",
+			    cl::desc("SQLite pragmas set on open (journal_mode=wal;synchronous=off;...)"),
+			    cl::cat(category));
+cl::opt<unsigned> commitEvery("commit-every", cl::desc("Commit after this many TUs"),
+			      cl::init(100), cl::cat(category));
+cl::opt<bool> verbose("v", cl::desc("Print every indexed file"), cl::cat(category));
+
+/* collects the records of one TU into a packet for the writer */
+class BatchConnection : public Connection {
+public:
+	BatchConnection(BoundedQueue<std::string> &queue) : Connection(), queue(queue) {}
+
+	virtual int open() { return 0; }
+	virtual void write(const Msg &msg);
+	virtual void endTU();
+	virtual std::optional<size_t> bytes() const { return written; }
+
+private:
+	BoundedQueue<std::string> &queue;
+	std::string buf;
+	Packet packet;
+	size_t written = 0;
+};
+
+class IndexConsumer : public ASTConsumer {
+public:
+	IndexConsumer(Connection &conn, ClaimTable *claimTable) : conn(conn),
+		claimTable(claimTable), start(std::chrono::steady_clock::now()) {}
+
+	virtual void HandleTranslationUnit(ASTContext &AC) override;
+private:
+	Connection &conn;
+	ClaimTable *claimTable;
+	std::chrono::steady_clock::time_point start;
+};
+
+class IndexAction : public ASTFrontendAction {
+public:
+	IndexAction(Connection &conn, ClaimTable *claimTable) : conn(conn),
+		claimTable(claimTable) {}
+
+	virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+							       llvm::StringRef file) override {
+		return std::make_unique<IndexConsumer>(conn, claimTable);
+	}
+private:
+	Connection &conn;
+	ClaimTable *claimTable;
+};
+
+class Indexer {
+public:
+	Indexer(std::vector<CompileCommand> cmds, ClaimTable *claimTable) :
+		cmds(std::move(cmds)), claimTable(claimTable), queue(256) {}
+
+	int run(unsigned threads);
+private:
+	void worker();
+	bool index(const CompileCommand &cmd);
+	int write();
+
+	static CommandLineArguments rewriteArgs(const CommandLineArguments &args,
+						llvm::StringRef file);
+
+	std::vector<CompileCommand> cmds;
+	ClaimTable *claimTable;
+	BoundedQueue<std::string> queue;
+	SQLConn sqlConn;
+
+	std::atomic<size_t> next = 0;
+	std::atomic<unsigned> running = 0;
+	std::atomic<unsigned> failed = 0;
+};
+
+}
+
+void BatchConnection::write(const Msg &msg)
+{
+	buf.clear();
+	msg.serialize(buf);
+	written += buf.length();
+	packet.append(buf);
+}
+
+void BatchConnection::endTU()
+{
+	if (!packet.empty())
+		queue.push(packet.release());
+}
+
+void IndexConsumer::HandleTranslationUnit(ASTContext &AC)
+{
+	/* like the analyzer, do not index broken code; the TU is reported failed */
+	if (AC.getDiagnostics().hasErrorOccurred())
+		return;
+
+	std::filesystem::path base(basePath.getValue());
+	StructVisitor SV(AC.getSourceManager(), conn, base, claimTable);
+
+	SV.match(AC);
+	SV.addStats(start);
+
+	conn.endTU();
+
+	SV.finish(AC);
+}
+
+/* what run_commands.pl does to the commands by regexes */
+CommandLineArguments Indexer::rewriteArgs(const CommandLineArguments &args, llvm::StringRef file)
+{
+	CommandLineArguments ret;
+
+	for (size_t i = 0; i < args.size(); i++) {
+		const auto &arg = args[i];
+		if (!i && llvm::sys::path::filename(arg) == "ccache")
+			continue;
+		/* also -Wp,-MMD,... which would write dependency files */
+		if (arg.rfind("-W", 0) == 0)
+			continue;
+		ret.push_back(arg);
+	}
+	ret.push_back("-w");
+
+	return ret;
+}
+
+bool Indexer::index(const CompileCommand &cmd)
+{
+	auto adjuster = combineAdjusters(rewriteArgs,
+					 combineAdjusters(getClangStripOutputAdjuster(),
+							  getClangSyntaxOnlyAdjuster()));
+	auto args = adjuster(cmd.CommandLine, cmd.Filename);
+
+	/* a private working directory, chdir() would affect all threads */
+	llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs(
+			llvm::vfs::createPhysicalFileSystem().release());
+	if (auto err = fs->setCurrentWorkingDirectory(cmd.Directory)) {
+		llvm::errs() << "cannot cd to " << cmd.Directory << ": " << err.message() << "\n";
+		return false;
+	}
+
+	auto files = llvm::makeIntrusiveRefCnt<FileManager>(FileSystemOptions(), fs);
+	BatchConnection conn(queue);
+	IgnoringDiagConsumer diags;
+
+	ToolInvocation invocation(std::move(args), std::make_unique<IndexAction>(conn, claimTable),
+				  files.get());
+	invocation.setDiagnosticConsumer(&diags);
+
+	return invocation.run();
+}
+
+/*
+ * TUs are handed out one by one from a shared cursor, so a thread which got
+ * short TUs simply takes more of them.
+ */
+void Indexer::worker()
+{
+	while (true) {
+		auto idx = next.fetch_add(1);
+		if (idx >= cmds.size())
+			break;
+
+		const auto &cmd = cmds[idx];
+		if (verbose)
+			llvm::errs() << idx + 1 << "/" << cmds.size() << " " << cmd.Filename << "\n";
+		if (!index(cmd)) {
+			llvm::errs() << cmd.Filename << ": indexing failed\n";
+			failed++;
+		}
+	}
+
+	/* the last one tells the writer to finish */
+	if (running.fetch_sub(1) == 1)
+		queue.close();
+}
+
+int Indexer::write()
+{
+	Message<std::string_view> msg;
+	unsigned tus = 0;
+
+	while (auto packet = queue.pop()) {
+		Packet::Reader reader(*packet);
+		while (auto rec = reader.next()) {
+			if (!msg.deserialize(*rec)) {
+				llvm::errs() << "malformed message of size " << rec->size() << "\n";
+				continue;
+			}
+			sqlConn.handleMessage(msg);
+		}
+
+		if (commitEvery && ++tus % commitEvery == 0) {
+			sqlConn.retryDeferred(false);
+			if (!sqlConn.end() || !sqlConn.begin())
+				return -1;
+		}
+	}
+
+	sqlConn.retryDeferred(true);
+
+	if (bulk && !sqlConn.finalizeBulk())
+		return -1;
+
+	if (!sqlConn.end())
+		return -1;
+
+	/* outside of the transaction, as db_filler does */
+	return sqlConn.refreshSummaries() ? 0 : -1;
+}
+
+int Indexer::run(unsigned threads)
+{
+	SQLConn::Options sqlOpts;
+	if (!sqlOpts.parse(sqlite))
+		return -1;
+
+	if (!sqlConn.open(dbFile.getValue(), bulk, sqlOpts)) {
+		llvm::errs() << "cannot open db: " << sqlConn.lastError() << "\n";
+		return -1;
+	}
+	if (!sqlConn.begin()) {
+		llvm::errs() << sqlConn.lastError() << "\n";
+		return -1;
+	}
+
+	std::vector<std::thread> workers;
+	running = threads;
+	for (unsigned i = 0; i < threads; i++)
+		workers.emplace_back(&Indexer::worker, this);
+
+	auto ret = write();
+	if (ret < 0) {
+		/* let the workers finish on their own */
+		next = cmds.size();
+		queue.close();
+	}
+
+	for (auto &t : workers)
+		t.join();
+
+	if (failed)
+		llvm::errs() << failed << " files failed to index\n";
+
+	return ret;
+}
+
+int main(int argc, const char **argv)
+{
+	cl::HideUnrelatedOptions(category);
+	cl::ParseCommandLineOptions(argc, argv,
+				    "Index structs and their members of a whole project "
+				    "in one process\n");
+
+	std::string err;
+	auto db = CompilationDatabase::autoDetectFromDirectory(buildPath, err);
+	if (!db) {
+		llvm::errs() << "cannot load compilation database: " << err << "\n";
+		return EXIT_FAILURE;
+	}
+
+	llvm::Regex filterRE(filter);
+	if (!filter.empty() && !filterRE.isValid(err)) {
+		llvm::errs() << "bad filter: " << err << "\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<CompileCommand> cmds;
+	for (auto &cmd : db->getAllCompileCommands()) {
+		if (!cmd.Filename.ends_with(".c"))
+			continue;
+		if (!filter.empty() && !filterRE.match(cmd.Filename))
+			continue;
+		cmds.push_back(std::move(cmd));
+	}
+
+	ClaimTable claimTable;
+	if (claims && claimTable.createPrivate(claims) < 0) {
+		llvm::errs() << "cannot create claim table: " << strerror(errno) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	unsigned threads = jobs ? jobs.getValue() : std::thread::hardware_concurrency();
+	auto nrCmds = cmds.size();
+	auto start = std::chrono::steady_clock::now();
+
+	Indexer indexer(std::move(cmds), claims ? &claimTable : nullptr);
+	if (indexer.run(std::max(threads, 1U)) < 0)
+		return EXIT_FAILURE;
+
+	auto secs = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now() - start).count();
+	llvm::errs() << "indexed " << nrCmds << " files in " << secs << " s\n";
+
+	return 0;
+}
@@ -1,14 +1,22 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
-#include <set>
+#include <memory>
 
-#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/StaticAnalyzer/Core/Checker.h"
 #include "clang/StaticAnalyzer/Core/PathSensitive/AnalysisManager.h"
 #include "clang/StaticAnalyzer/Frontend/CheckerRegistry.h"
 
+#include "../ClaimTable.h"
 #include "../Message.h"
+#include "../Packet.h"
+#include "Connection.h"
+#include "StructVisitor.h"
 
 #ifdef STANDALONE
 #include "../sqlconn.h"
@@ -17,97 +25,165 @@
 #include <mqueue.h>
 
 #include <sys/stat.h>
+
+#include "../ShmRing.h"
+#include "../Socket.h"
+#include "../Spill.h"
 #endif
 
 using namespace clang;
-using namespace clang::ast_matchers;
 using namespace clang::ento;
 using namespace ClangStruct;
-using Msg = Message<std::string>;
-
-class Connection {
-public:
-	Connection() {}
-
-	virtual int open() = 0;
-	virtual void write(const Msg &msg) = 0;
-};
+using Msg = Connection::Msg;
 
 #ifdef STANDALONE
 class SQLConnection : public Connection {
 public:
-	SQLConnection(std::filesystem::path dbFile) : Connection(), dbFile(std::move(dbFile)) {}
+	SQLConnection(std::filesystem::path dbFile, const SQLConn::Options &sqlOpts) :
+		Connection(), dbFile(std::move(dbFile)), sqlOpts(sqlOpts) {}
 
 	virtual int open();
 	virtual void write(const Msg &msg);
+	virtual void endTU();
 
 private:
 	std::filesystem::path dbFile;
+	SQLConn::Options sqlOpts;
 	SQLConn sql;
 };
 #else
-class MQConnection : public Connection {
+/* Batches messages into packets, subclasses only send them. */
+class PacketConnection : public Connection {
+public:
+	PacketConnection(Msg::FORMAT format, size_t batchSize) : Connection(), format(format),
+		batchSize(batchSize) {}
+
+	virtual void write(const Msg &msg);
+	virtual void flush();
+	virtual std::optional<size_t> bytes() const { return written; }
+
+protected:
+	virtual void send(const std::string &data) = 0;
+	void setLimit(size_t limit);
+
+private:
+	Msg::FORMAT format;
+	size_t batchSize;
+	std::string buf;
+	Packet packet;
+	size_t written = 0;
+};
+
+/*
+ * Sends do not block unless @spillDir is empty. When the queue is full, the
+ * rest of the packets is appended to a spill file, which db_filler ingests
+ * later. If the spill file fails, the rest is sent blocking.
+ */
+class MQConnection : public PacketConnection {
 public:
-	MQConnection() : Connection() {}
+	MQConnection(Msg::FORMAT format, size_t batchSize, std::filesystem::path spillDir) :
+		PacketConnection(format, batchSize), spillDir(std::move(spillDir)) {}
 	~MQConnection();
 
 	virtual int open();
-	virtual void write(const Msg &msg);
 
 private:
-#if 0
-	int sock = -1;
-#else
+	virtual void send(const std::string &data);
+	void sendBlocking(const std::string &data);
+
 	mqd_t mq = -1;
-#endif
+	std::filesystem::path spillDir;
+	SpillFile spill;
+};
+
+class ShmConnection : public PacketConnection {
+public:
+	ShmConnection(Msg::FORMAT format, size_t batchSize) :
+		PacketConnection(format, batchSize) {}
+	~ShmConnection();
+
+	virtual int open();
+
+private:
+	virtual void send(const std::string &data);
+
+	ShmRing shm;
+};
+
+class SocketConnection : public PacketConnection {
+public:
+	SocketConnection(Msg::FORMAT format, size_t batchSize) :
+		PacketConnection(format, batchSize) {}
+	~SocketConnection();
+
+	virtual int open();
+	virtual void endTU();
+
+private:
+	virtual void send(const std::string &data);
+	void sendAll(const char *data, size_t len);
+
+	int sock = -1;
 };
 #endif
 
 namespace {
+/* the same for the checker and the frontend action */
+struct Options {
+	std::string basePath;
+#ifdef STANDALONE
+	std::string dbFile = "structs.db";
+	std::string sqlite;
+#else
+	bool textMessages = false;
+	int batchSize = 0;
+	std::string transport = "mq";
+	bool claimHeaders = true;
+	std::string spillDir = SpillFile::default_dir;
+#endif
+};
+
 class MyChecker final : public Checker<check::EndOfTranslationUnit> {
 public:
   void checkEndOfTranslationUnit(const TranslationUnitDecl *TU,
 				 AnalysisManager &A, BugReporter &BR) const;
 };
 
-class MatchCallback : public MatchFinder::MatchCallback {
+class StructConsumer : public ASTConsumer {
 public:
-	MatchCallback(SourceManager &SM, Connection &conn,
-		      std::filesystem::path &basePath) :
-		SM(SM), conn(conn), basePath(basePath) { }
+	StructConsumer(const Options &opts) : opts(opts) {}
 
-	void run(const MatchFinder::MatchResult &res);
+	virtual void HandleTranslationUnit(ASTContext &AC) override;
 private:
-	void bindLoc(Msg &msg, const SourceRange &SR);
-	std::string getSrc(const SourceLocation &SLOC);
-	void addSrc(Msg &msg, const std::string &src);
-
-	void handleUse(const SourceRange &initSR, const NamedDecl *ND, const RecordDecl *RD,
-		       int load, bool implicit);
-	void handleUse(const MemberExpr *ME, const RecordDecl *RD, int load) {
-		handleUse(ME->getSourceRange(), ME->getMemberDecl(), RD, load, false);
-	}
-	void handleME(const MemberExpr *ME, int store);
-	void handleRD(const RecordDecl *RD);
-	void handleILE(const InitListExpr *ILE, ASTContext *AC);
-
-	static std::string getNDName(const NamedDecl *ND);
-	static std::string getRDName(const RecordDecl *RD);
-
-	SourceManager &SM;
+	Options opts;
+};
 
-	Connection &conn;
-	std::filesystem::path &basePath;
-	std::set<const MemberExpr *> visited;
-	std::set<std::string> sources;
+/*
+ * Runs after the main action (-fsyntax-only or a normal compilation), so that
+ * the tree can be indexed by -fplugin as a part of its build.
+ */
+class StructAction : public PluginASTAction {
+protected:
+	virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+							       llvm::StringRef file) override;
+	virtual bool ParseArgs(const CompilerInstance &CI,
+			       const std::vector<std::string> &args) override;
+	virtual ActionType getActionType() override { return AddAfterMainAction; }
+private:
+	Options opts;
 };
 
 }
 
+static void indexTU(ASTContext &AC, const Options &opts);
+
+/* the module is loaded before the TU is parsed */
+static const auto loadTime = std::chrono::steady_clock::now();
+
 #ifdef STANDALONE
 int SQLConnection::open()
 {
-	if (!sql.open(dbFile)) {
+	if (!sql.open(dbFile, false, sqlOpts)) {
 		llvm::errs() << "cannot open db: " << sql.lastError() << '\n';
 		return -1;
 	}
@@ -119,385 +195,341 @@ void SQLConnection::write(const Msg &msg)
 	sql.handleMessage(msg);
 }
 
+void SQLConnection::endTU()
+{
+	/* a single TU sends everything it refers to, nothing can come later */
+	sql.retryDeferred(true);
+	/* there is no db_filler to do it, no transaction is open here */
+	sql.refreshSummaries();
+}
+
 #else
+void PacketConnection::setLimit(size_t limit)
+{
+	if (batchSize)
+		limit = std::min(limit, batchSize);
+	packet.setLimit(limit);
+}
+
+void PacketConnection::write(const Msg &msg)
+{
+	buf.clear();
+	msg.serialize(buf, format);
+	written += buf.length();
+
+	//std::cerr << "sending: " << msg << "\n";
+
+	if (!packet.fits(buf.length())) {
+		flush();
+		/* too big to be batched even alone, send it bare */
+		if (!packet.fits(buf.length())) {
+			send(buf);
+			return;
+		}
+	}
+
+	packet.append(buf);
+}
+
+void PacketConnection::flush()
+{
+	if (packet.empty())
+		return;
+
+	send(packet.data());
+	packet.clear();
+}
+
 MQConnection::~MQConnection()
 {
-#if 0
-	if (sock >= 0)
-		close(sock);
-#else
+	flush();
 	if (mq >= 0)
 		mq_close(mq);
-#endif
 }
 
 int MQConnection::open()
 {
-#if 0
-	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-	if (sock < 0) {
-		llvm::errs() << "cannot create socket: " << strerror(errno) << "\n";
+	auto flags = O_WRONLY | (spillDir.empty() ? 0 : O_NONBLOCK);
+	mq = mq_open("/db_filler", flags,  0600, NULL);
+	if (mq < 0) {
+		llvm::errs() << "cannot open msg queue: " << strerror(errno) << "\n";
 		return -1;
 	}
 
-	struct sockaddr_un addr = {
-		.sun_family = AF_UNIX,
-		.sun_path = "db_filler",
-	};
-
-	int ret = connect(sock, (const struct sockaddr *)&addr, sizeof(addr));
-	if (ret < 0) {
-		llvm::errs() << "cannot connect: " << strerror(errno) << "\n";
-		return -1;
-	}
-#else
-	mq = mq_open("/db_filler", O_WRONLY,  0600, NULL);
-	if (mq < 0) {
-		llvm::errs() << "cannot open msg queue: " << strerror(errno) << "\n";
+	mq_attr attr;
+	if (mq_getattr(mq, &attr) < 0) {
+		llvm::errs() << "cannot get msg attr: " << strerror(errno) << "\n";
 		return -1;
 	}
-#endif
+
+	/* the queue size set up by db_filler is the upper bound */
+	setLimit(attr.mq_msgsize);
 
 	return 0;
 }
 
-void MQConnection::write(const Msg &msg)
+/* for this and all later packets, the spill file is given up */
+void MQConnection::sendBlocking(const std::string &data)
 {
-#if 0
-	auto ret = ::write(sock, msg.c_str(), msg.length());
-	if (ret < 0) {
-		llvm::errs() << "write: " << strerror(errno) << "\n";
-		return;
-	}
+	spill.close();
+	spillDir.clear();
 
-	if ((size_t)ret != msg.length())
-		llvm::errs() << "stray write: " << ret << "/" << msg.length() << "\n";
-#else
-	auto msgStr = msg.serialize();
-
-	//std::cerr << "sending: " << msg << "\n";
+	mq_attr attr = {};
+	if (mq_setattr(mq, &attr, nullptr) < 0)
+		llvm::errs() << "cannot make msg queue blocking: " << strerror(errno) << "\n";
 
-	if (mq_send(mq, msgStr.c_str(), msgStr.length(), 0) < 0) {
+	if (mq_send(mq, data.c_str(), data.length(), 0) < 0)
 		llvm::errs() << "mq_send: " << strerror(errno) << "\n";
-		return;
-	}
-#endif
 }
-#endif
 
-void MatchCallback::bindLoc(Msg &msg, const SourceRange &SR)
+void MQConnection::send(const std::string &data)
 {
-	msg.add("begLine", SM.getPresumedLineNumber(SR.getBegin()));
-	msg.add("begCol", SM.getPresumedColumnNumber(SR.getBegin()));
-	msg.add("endLine", SM.getPresumedLineNumber(SR.getEnd()));
-	msg.add("endCol", SM.getPresumedColumnNumber(SR.getEnd()));
+	/* once spilling, all the rest goes there to keep the order */
+	if (!spill.isOpen()) {
+		if (!mq_send(mq, data.c_str(), data.length(), 0))
+			return;
+		if (errno != EAGAIN) {
+			llvm::errs() << "mq_send: " << strerror(errno) << "\n";
+			return;
+		}
+		if (spill.open(spillDir) < 0) {
+			llvm::errs() << "cannot create spill file in " << spillDir.string() << ": " <<
+				strerror(errno) << "\n";
+			sendBlocking(data);
+			return;
+		}
+	}
+
+	if (spill.append(data) < 0) {
+		llvm::errs() << "cannot spill " << data.length() << " bytes: " <<
+			strerror(errno) << "\n";
+		sendBlocking(data);
+	}
 }
 
-std::string MatchCallback::getSrc(const SourceLocation &SLOC)
+ShmConnection::~ShmConnection()
 {
-	auto src = SM.getPresumedLoc(SLOC).getFilename();
-	std::filesystem::path p(src);
+	flush();
+	shm.release();
+}
 
-	p = p.lexically_normal();
+int ShmConnection::open()
+{
+	if (shm.attach() < 0) {
+		llvm::errs() << "cannot attach shared memory: " << strerror(errno) << "\n";
+		return -1;
+	}
 
-	if (!basePath.empty()) {
-		auto rel = p.lexically_relative(basePath);
-		if (!rel.empty())
-			p = std::move(rel);
+	if (!shm.claim(60)) {
+		llvm::errs() << "no free ring in shared memory\n";
+		return -1;
 	}
 
-	return p.string();
+	setLimit(shm.maxRecord());
+
+	return 0;
 }
 
-void MatchCallback::addSrc(Msg &msg, const std::string &src)
+void ShmConnection::send(const std::string &data)
 {
-	if (!sources.insert(src).second)
-		return;
-
-	msg.renew(Msg::KIND::SOURCE);
-
-	msg.add("src", src);
-	conn.write(msg);
+	if (!shm.push(data))
+		llvm::errs() << "cannot push " << data.length() << " bytes to shared memory\n";
 }
 
-void MatchCallback::handleUse(const SourceRange &initSR, const NamedDecl *ND, const RecordDecl *RD,
-			      int load, bool implicit)
+SocketConnection::~SocketConnection()
 {
-	auto strLoc = RD->getBeginLoc();
-	auto strSrc = getSrc(strLoc);
-	auto useSrc = getSrc(initSR.getBegin());
-	Msg msg;
-
-	addSrc(msg, useSrc);
-
-	msg.renew(Msg::KIND::USE);
-	msg.add("member", getNDName(ND));
-	msg.add("struct", getRDName(RD));
-	msg.add("strSrc", strSrc);
-	msg.add("strLine", SM.getPresumedLineNumber(strLoc));
-	msg.add("strCol", SM.getPresumedColumnNumber(strLoc));
-	msg.add("use_src", useSrc);
-	if (load < 0)
-		msg.add("load");
-	else
-		msg.add("load", load);
-	msg.add("implicit", implicit);
-
-	bindLoc(msg, initSR);
-
-	conn.write(msg);
+	if (sock >= 0) {
+		flush();
+		close(sock);
+	}
 }
 
-void MatchCallback::handleME(const MemberExpr *ME, int store)
+int SocketConnection::open()
 {
-	if (!visited.insert(ME).second)
-		return;
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		llvm::errs() << "cannot create socket: " << strerror(errno) << "\n";
+		return -1;
+	}
 
-	//ME->dumpColor();
-	//auto &SM = C.getSourceManager();
-
-	auto T = ME->getBase()->getType();
-	if (auto PT = T->getAs<PointerType>())
-		T = PT->getPointeeType();
-
-	if (auto ST = T->getAsStructureType()) {
-		handleUse(ME, ST->getDecl(), store);
-	} else if (auto RD = T->getAsRecordDecl()) {
-		handleUse(ME, RD, store);
-	} else {
-		llvm::errs() << __PRETTY_FUNCTION__ << ": unhandled type\n";
-		ME->getSourceRange().dump(SM);
-		ME->dumpColor();
-		T->dump();
-		abort();
+	struct sockaddr_un addr;
+	auto addrLen = Socket::fillAddr(addr);
+	if (connect(sock, (const struct sockaddr *)&addr, addrLen) < 0) {
+		llvm::errs() << "cannot connect: " << strerror(errno) << "\n";
+		close(sock);
+		sock = -1;
+		return -1;
 	}
+
+	setLimit(Socket::batch_size);
+
+	return 0;
 }
 
-std::string MatchCallback::getNDName(const NamedDecl *ND)
+void SocketConnection::sendAll(const char *data, size_t len)
 {
-	if (!ND->getIdentifier())
-		return "<unnamed>";
-
-	return ND->getNameAsString();
+	while (len) {
+		auto ret = ::send(sock, data, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			llvm::errs() << "send: " << strerror(errno) << "\n";
+			return;
+		}
+		data += ret;
+		len -= ret;
+	}
 }
 
-std::string MatchCallback::getRDName(const RecordDecl *RD)
+void SocketConnection::send(const std::string &data)
 {
-	if (RD->isAnonymousStructOrUnion())
-		return "<anonymous>";
+	Socket::flen len = data.length();
 
-	return getNDName(RD);
+	sendAll((const char *)&len, sizeof(len));
+	sendAll(data.c_str(), data.length());
 }
 
-void MatchCallback::handleRD(const RecordDecl *RD)
+void SocketConnection::endTU()
 {
-	//RD->dumpColor();
-
-	auto RDSR = RD->getSourceRange();
-	auto RDName = getRDName(RD);
-	auto src = getSrc(RDSR.getBegin());
-	Msg msg;
-
-	addSrc(msg, src);
-
-	msg.renew(Msg::KIND::STRUCT);
-	msg.add("name", RDName);
-
-	std::string type;
-	if (RD->isStruct())
-		type = "s";
-	else if (RD->isUnion())
-		type = "u";
-	else {
-		llvm::errs() << src << ": unknown RD type:\n";
-		RD->dumpColor();
-		return;
-	}
+	flush();
 
-	std::stringstream ss;
-	bool cont = false;
-	bool packed = false;
-	for (const auto &f : RD->attrs()) {
-		// implicit attrs don't have names
-		// so VisibilityAttr do not
-		if (!f->getAttrName()) {
-			if (!f->isImplicit() && !llvm::isa<VisibilityAttr>(f)) {
-				llvm::errs() << src << ": unnamed attribute: ";
-				f->printPretty(llvm::errs(), RD->getASTContext().getPrintingPolicy());
-				llvm::errs() << " in:\n";
-				RD->dumpColor();
-			}
-			continue;
-		}
-		if (cont)
-			ss << "|";
-		auto attr = f->getNormalizedFullName();
-		if (attr == "packed")
-			packed = true;
-		ss << attr;
-		cont = true;
-	}
-
-	msg.add("type", type);
-	msg.add("attrs", ss.str());
-	msg.add("packed", packed);
-	msg.add("inMacro", RDSR.getBegin().isMacroID());
-	msg.add("src", src);
-	bindLoc(msg, RDSR);
-	conn.write(msg);
-
-	for (const auto &f : RD->fields()) {
-		//f->dumpColor();
-		/*llvm::errs() << __func__ << ": " << RD->getNameAsString() <<
-				"." << f->getNameAsString() << "\n";*/
-		auto SR = f->getSourceRange();
-		msg.renew(Msg::KIND::MEMBER);
-		msg.add("name", getNDName(f));
-		msg.add("struct", RDName);
-		msg.add("src", src);
-		msg.add("strBegLine", SM.getPresumedLineNumber(RDSR.getBegin()));
-		msg.add("strBegCol", SM.getPresumedColumnNumber(RDSR.getBegin()));
-
-		bindLoc(msg, SR);
-		conn.write(msg);
-	}
+	Socket::flen end = 0;
+	sendAll((const char *)&end, sizeof(end));
 }
+#endif
 
-void MatchCallback::handleILE(const InitListExpr *ILE, ASTContext *AC)
+static std::unique_ptr<Connection> makeConnection(const Options &opts)
 {
-	auto T = ILE->getType().getCanonicalType();
-	if (auto RT = T->getAsStructureType()) {
-		auto RD = RT->getDecl();
-		//RD->dumpColor();
-		for (auto field: RD->fields()) {
-			SourceRange SR;
-			bool implicit = true;
-			auto idx = field->getFieldIndex();
-			if (idx < ILE->getNumInits()) {
-				auto init = ILE->getInit(idx);
-				if (!init) {
-					llvm::errs() << "null initializer for " <<
-							field->getFieldIndex() << "\n";
-					field->dumpColor();
-					RD->dumpColor();
-					ILE->dumpColor();
-					abort();
-				}
-
-				SR = init->getSourceRange();
-				implicit = llvm::isa<ImplicitValueInitExpr>(init);
-
-				/*llvm::errs() << "field " << field->getFieldIndex() << "\n";
-				field->dumpColor();
-				llvm::errs() << "init\n";
-				init->dumpColor();
-				SR.dump(SM);*/
-			}
-			// implicit initializers have invalid SR, so have nested ILEs
-			if (SR.isInvalid()) {
-				auto parent = DynTypedNode::create(*ILE);
-				auto &map = AC->getParentMapContext();
-				for (unsigned jumps = 1;; jumps++) {
-					SR = parent.getSourceRange();
-					if (SR.isValid())
-						break;
-					parent = map.getParents(parent)[0];
-					if (!parent.get<InitListExpr>()) {
-						llvm::errs() << "idx=" << idx << " jumps=" <<
-								jumps << "\n";
-						field->dumpColor();
-						RD->dumpColor();
-						ILE->dumpColor();
-						parent.dump(llvm::errs(), *AC);
-						abort();
-					}
-				}
-			}
+#ifdef STANDALONE
+	SQLConn::Options sqlOpts;
+	if (!sqlOpts.parse(opts.sqlite))
+		return nullptr;
 
-			handleUse(SR, field, RD, 0, implicit);
-		}
-	} else if (T->isUnionType()) {
-	} else if (!T->isConstantArrayType() && !llvm::isa<TypeOfType>(T) &&
-		   !llvm::isa<BuiltinType>(T) && !llvm::isa<PointerType>(T)) {
-		llvm::errs() << __PRETTY_FUNCTION__ << ": unhandled type\n";
-		ILE->getSourceRange().dump(SM);
-		ILE->dumpColor();
-		T->dump();
-		abort();
-	}
+	return std::make_unique<SQLConnection>(opts.dbFile, sqlOpts);
+#else
+	auto format = opts.textMessages ? Msg::FORMAT::TEXT : Msg::FORMAT::BINARY;
+	auto batchSize = std::max(opts.batchSize, 0);
+
+	if (opts.transport == "shm")
+		return std::make_unique<ShmConnection>(format, batchSize);
+	if (opts.transport == "mq")
+		return std::make_unique<MQConnection>(format, batchSize, opts.spillDir);
+	if (opts.transport == "socket")
+		return std::make_unique<SocketConnection>(format, batchSize);
+
+	llvm::errs() << "unknown transport: " << opts.transport << "\n";
+	return nullptr;
+#endif
 }
 
-void MatchCallback::run(const MatchFinder::MatchResult &res)
+static void indexTU(ASTContext &AC, const Options &opts)
 {
-	if (auto ME = res.Nodes.getNodeAs<MemberExpr>("MESTORE"))
-		handleME(ME, 0);
+	auto conn = makeConnection(opts);
+	if (!conn || conn->open() < 0)
+		return;
 
-	if (auto ME = res.Nodes.getNodeAs<MemberExpr>("MELOAD"))
-		handleME(ME, 1);
+	//AC.getTranslationUnitDecl()->dumpColor();
 
-	if (auto ME = res.Nodes.getNodeAs<MemberExpr>("ME"))
-		handleME(ME, -1);
+	std::filesystem::path basePath(opts.basePath);
 
-	if (auto RD = res.Nodes.getNodeAs<RecordDecl>("RD")) {
-		if (RD->isThisDeclarationADefinition())
-			handleRD(RD);
-	}
-	if (auto ILE = res.Nodes.getNodeAs<InitListExpr>("ILE")) {
-		handleILE(ILE, res.Context);
-	}
+	ClaimTable claims;
+#ifndef STANDALONE
+	/* ENOENT: db_filler runs without claims */
+	if (opts.claimHeaders && claims.attach() < 0 && errno != ENOENT)
+		llvm::errs() << "cannot attach claim table: " << strerror(errno) << "\n";
+#endif
+
+	StructVisitor SV(AC.getSourceManager(), *conn, basePath,
+			 claims.isMapped() ? &claims : nullptr);
+
+	SV.match(AC);
+	SV.addStats(loadTime);
+
+	conn->endTU();
+
+	SV.finish(AC);
 }
 
 void MyChecker::checkEndOfTranslationUnit(const TranslationUnitDecl *TU,
 					  AnalysisManager &A,
 					  BugReporter &BR) const
 {
+	const auto &AO = A.getAnalyzerOptions();
+	Options opts;
+
+	opts.basePath = AO.getCheckerStringOption(this, "basePath").str();
 #ifdef STANDALONE
-	auto dbFile = A.getAnalyzerOptions().getCheckerStringOption(this, "dbFile");
-	SQLConnection conn(dbFile.str());
+	opts.dbFile = AO.getCheckerStringOption(this, "dbFile").str();
+	opts.sqlite = AO.getCheckerStringOption(this, "sqlite").str();
 #else
-	MQConnection conn;
+	opts.textMessages = AO.getCheckerBooleanOption(this, "textMessages");
+	opts.batchSize = AO.getCheckerIntegerOption(this, "batchSize");
+	opts.transport = AO.getCheckerStringOption(this, "transport").str();
+	opts.claimHeaders = AO.getCheckerBooleanOption(this, "claimHeaders");
+	opts.spillDir = AO.getCheckerStringOption(this, "spillDir").str();
 #endif
 
-	if (conn.open() < 0)
+	indexTU(A.getASTContext(), opts);
+}
+
+void StructConsumer::HandleTranslationUnit(ASTContext &AC)
+{
+	/* like the analyzer, do not index broken code */
+	if (AC.getDiagnostics().hasErrorOccurred())
 		return;
 
-	//TU->dumpColor();
-
-	auto basePathStr = A.getAnalyzerOptions().getCheckerStringOption(this, "basePath");
-	std::filesystem::path basePath(basePathStr.str());
-
-	MatchCallback CB(A.getSourceManager(), conn, basePath);
-
-	MatchFinder FRD;
-	FRD.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource, recordDecl().bind("RD")),
-		     &CB);
-	FRD.matchAST(A.getASTContext());
-
-	MatchFinder F;
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-			      binaryOperator(isAssignmentOperator(),
-					     hasLHS(memberExpr().bind("MESTORE")))),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-			      binaryOperator(hasEitherOperand(memberExpr().bind("MELOAD")))),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-			      unaryOperator(hasOperatorName("!"), hasUnaryOperand(memberExpr().bind("MELOAD")))),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-			      callExpr(forEachArgumentWithParam(memberExpr().bind("MELOAD"), anything()))),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource,
-			      memberExpr(has(memberExpr())).bind("MELOAD")),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource, memberExpr().bind("ME")),
-		     &CB);
-	F.addMatcher(traverse(TK_IgnoreUnlessSpelledInSource, initListExpr().bind("ILE")),
-		     &CB);
-
-	F.matchAST(A.getASTContext());
+	indexTU(AC, opts);
+}
+
+std::unique_ptr<ASTConsumer> StructAction::CreateASTConsumer(CompilerInstance &CI,
+							     llvm::StringRef file)
+{
+	/* the checker is loaded from the same module, do not index twice */
+	if (CI.getFrontendOpts().ProgramAction == frontend::RunAnalysis)
+		return std::make_unique<ASTConsumer>();
+
+	return std::make_unique<StructConsumer>(opts);
 }
 
+/* -fplugin-arg-clang-struct-<name>=<value>, names as of the checker options */
+bool StructAction::ParseArgs(const CompilerInstance &CI, const std::vector<std::string> &args)
+{
+	for (const auto &arg : args) {
+		auto [key, val] = llvm::StringRef(arg).split('=');
+		if (key == "basePath") {
+			opts.basePath = val.str();
+#ifdef STANDALONE
+		} else if (key == "dbFile") {
+			opts.dbFile = val.str();
+		} else if (key == "sqlite") {
+			opts.sqlite = val.str();
+#else
+		} else if (key == "textMessages") {
+			opts.textMessages = val != "false";
+		} else if (key == "batchSize") {
+			if (val.getAsInteger(0, opts.batchSize)) {
+				llvm::errs() << "clang-struct: bad batchSize: " << val << "\n";
+				return false;
+			}
+		} else if (key == "transport") {
+			opts.transport = val.str();
+		} else if (key == "claimHeaders") {
+			opts.claimHeaders = val != "false";
+		} else if (key == "spillDir") {
+			opts.spillDir = val.str();
+#endif
+		} else {
+			llvm::errs() << "clang-struct: unknown argument: " << arg << "\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static FrontendPluginRegistry::Add<StructAction>
+X("clang-struct", "Index structs, their members, and member uses");
+
 extern "C" void clang_registerCheckers(CheckerRegistry &registry) {
   registry.addChecker<MyChecker>("jirislaby.StructMembersChecker",
 				 "Searches for unused struct members",
@@ -511,6 +543,33 @@ extern "C" void clang_registerCheckers(CheckerRegistry &registry) {
 			    "dbFile", "structs.db",
 			    "Name of the database file to store into",
 			    "released");
+  registry.addCheckerOption("string", "jirislaby.StructMembersChecker",
+			    "sqlite", "",
+			    "SQLite pragmas set on open (journal_mode=wal;synchronous=off;...)",
+			    "released");
+#else
+  registry.addCheckerOption("bool", "jirislaby.StructMembersChecker",
+			    "textMessages", "false",
+			    "Send messages in the old text format (for debugging)",
+			    "released");
+  registry.addCheckerOption("int", "jirislaby.StructMembersChecker",
+			    "batchSize", "0",
+			    "Maximum size of a batch of messages sent at once "
+			    "(0 = message size of the queue)",
+			    "released");
+  registry.addCheckerOption("string", "jirislaby.StructMembersChecker",
+			    "transport", "mq",
+			    "Transport to send messages to db_filler by (mq, shm, or socket)",
+			    "released");
+  registry.addCheckerOption("bool", "jirislaby.StructMembersChecker",
+			    "claimHeaders", "true",
+			    "Skip headers already claimed by another TU (needs db_filler --claims)",
+			    "released");
+  registry.addCheckerOption("string", "jirislaby.StructMembersChecker",
+			    "spillDir", SpillFile::default_dir,
+			    "Directory to spill records to when the msg queue is full "
+			    "(empty = block, the same as db_filler --spill-dir)",
+			    "released");
 #endif
 }
 
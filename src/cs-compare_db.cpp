@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sl/sqlite/SQLiteSmart.h>
+#include <sl/sqlite/SQLConn.h>
+
+namespace {
+
+const struct Table {
+	const char *name;
+	const char *sql;
+} tables[] = {
+	{ "structs",
+		"SELECT source.src, struct.name, struct.begLine, struct.begCol "
+		"FROM struct "
+		"JOIN source ON source.id = struct.src "
+		"ORDER BY 1, 2, 3, 4;" },
+	{ "members",
+		"SELECT source.src, struct.name || '.' || member.name, "
+			"member.begLine, member.begCol "
+		"FROM member "
+		"JOIN struct ON struct.id = member.struct "
+		"JOIN source ON source.id = struct.src "
+		"ORDER BY 1, 2, 3, 4;" },
+	{ "uses",
+		"SELECT source.src, struct.name || '.' || member.name, use.begLine, use.begCol "
+		"FROM use "
+		"JOIN member ON member.id = use.member "
+		"JOIN struct ON struct.id = member.struct "
+		"JOIN source ON source.id = use.src "
+		"ORDER BY 1, 2, 3, 4;" },
+};
+
+/* rows of one (source, name) key */
+struct Group {
+	struct Loc {
+		int64_t line;
+		int64_t col;
+	};
+
+	std::string src;
+	std::string name;
+	std::vector<Loc> locs;
+
+	int compareKey(const Group &other) const {
+		if (int c = src.compare(other.src))
+			return c;
+		return name.compare(other.name);
+	}
+};
+
+/* one database, read in key order (BINARY collation is memcmp, as here) */
+class Stream : public SlSqlite::SQLConn {
+public:
+	Stream(const char *sql) : sql(sql) {}
+
+	/* false at the end or on an error */
+	bool next(Group &group);
+	bool failed() const { return error; }
+private:
+	virtual bool prepDB() override {
+		return prepareStatements({ { sel, sql } });
+	}
+	bool step();
+	std::string_view text(int col) const {
+		auto str = sqlite3_column_text(sel.get(), col);
+		return str ? std::string_view(reinterpret_cast<const char *>(str),
+					      sqlite3_column_bytes(sel.get(), col)) :
+			std::string_view();
+	}
+
+	const char *sql;
+	SlSqlite::SQLStmtHolder sel;
+	bool started = false;
+	bool row = false;
+	bool error = false;
+};
+
+/* diffs one table of the two databases into a temporary file */
+class Differ {
+public:
+	Differ(const Table &table, bool ignoreLines) : table(table), ignoreLines(ignoreLines),
+		oldDB(table.sql), newDB(table.sql) {}
+	~Differ() {
+		if (out)
+			fclose(out);
+	}
+
+	int open(const std::filesystem::path &oldFile, const std::filesystem::path &newFile);
+	int run();
+	/* prints the header and the differences */
+	void print(std::ostream &os);
+
+	uint64_t removed = 0;
+	uint64_t added = 0;
+private:
+	void report(char how, const Group &group, const Group::Loc &loc);
+	void reportAll(char how, const Group &group);
+	void diffExact(const Group &o, const Group &n);
+	void diffIgnoringLines(const Group &o, const Group &n);
+
+	const Table &table;
+	bool ignoreLines;
+	Stream oldDB;
+	Stream newDB;
+	FILE *out = nullptr;
+};
+
+}
+
+bool Stream::step()
+{
+	auto ret = sqlite3_step(sel.get());
+	if (ret == SQLITE_ROW)
+		return row = true;
+	if (ret != SQLITE_DONE) {
+		std::cerr << lastError() << "\n";
+		error = true;
+	}
+
+	return row = false;
+}
+
+bool Stream::next(Group &group)
+{
+	if (!started) {
+		started = true;
+		step();
+	}
+	if (!row)
+		return false;
+
+	group.src = text(0);
+	group.name = text(1);
+	group.locs.clear();
+	do {
+		group.locs.push_back({ sqlite3_column_int64(sel.get(), 2),
+				       sqlite3_column_int64(sel.get(), 3) });
+	} while (step() && text(0) == group.src && text(1) == group.name);
+
+	return true;
+}
+
+int Differ::open(const std::filesystem::path &oldFile, const std::filesystem::path &newFile)
+{
+	if (!oldDB.open(oldFile)) {
+		std::cerr << "cannot open " << oldFile << ": " << oldDB.lastError() << "\n";
+		return -1;
+	}
+	if (!newDB.open(newFile)) {
+		std::cerr << "cannot open " << newFile << ": " << newDB.lastError() << "\n";
+		return -1;
+	}
+
+	out = tmpfile();
+	if (!out) {
+		std::cerr << "cannot create a temporary file: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+void Differ::report(char how, const Group &group, const Group::Loc &loc)
+{
+	fprintf(out, "%c %s|%s|%lld:%lld\n", how, group.src.c_str(), group.name.c_str(),
+		(long long)loc.line, (long long)loc.col);
+	(how == '-' ? removed : added)++;
+}
+
+void Differ::reportAll(char how, const Group &group)
+{
+	for (const auto &loc : group.locs)
+		report(how, group, loc);
+}
+
+void Differ::diffExact(const Group &o, const Group &n)
+{
+	auto less = [](const Group::Loc &a, const Group::Loc &b) {
+		return a.line < b.line || (a.line == b.line && a.col < b.col);
+	};
+	size_t i = 0, j = 0;
+
+	while (i < o.locs.size() || j < n.locs.size()) {
+		if (j == n.locs.size() || (i < o.locs.size() && less(o.locs[i], n.locs[j]))) {
+			report('-', o, o.locs[i++]);
+		} else if (i == o.locs.size() || less(n.locs[j], o.locs[i])) {
+			report('+', n, n.locs[j++]);
+		} else {
+			i++;
+			j++;
+		}
+	}
+}
+
+/*
+ * Code moved up or down keeps its columns, so the rows are matched by the
+ * longest common subsequence of their columns.
+ */
+void Differ::diffIgnoringLines(const Group &o, const Group &n)
+{
+	auto rows = o.locs.size(), cols = n.locs.size();
+
+	/* not worth the memory, huge groups are rare */
+	if (rows * cols > (1U << 24)) {
+		diffExact(o, n);
+		return;
+	}
+
+	std::vector<uint32_t> lcs((rows + 1) * (cols + 1));
+	auto at = [&lcs, cols](size_t i, size_t j) -> uint32_t & {
+		return lcs[i * (cols + 1) + j];
+	};
+	for (size_t i = rows; i-- > 0; )
+		for (size_t j = cols; j-- > 0; )
+			at(i, j) = o.locs[i].col == n.locs[j].col ? at(i + 1, j + 1) + 1 :
+				std::max(at(i + 1, j), at(i, j + 1));
+
+	size_t i = 0, j = 0;
+	while (i < rows || j < cols) {
+		if (i < rows && j < cols && o.locs[i].col == n.locs[j].col) {
+			i++;
+			j++;
+		} else if (j == cols || (i < rows && at(i + 1, j) >= at(i, j + 1))) {
+			report('-', o, o.locs[i++]);
+		} else {
+			report('+', n, n.locs[j++]);
+		}
+	}
+}
+
+int Differ::run()
+{
+	Group o, n;
+	bool haveOld = oldDB.next(o);
+	bool haveNew = newDB.next(n);
+
+	while (haveOld || haveNew) {
+		int cmp = !haveNew ? -1 : !haveOld ? 1 : o.compareKey(n);
+		if (cmp < 0) {
+			reportAll('-', o);
+			haveOld = oldDB.next(o);
+		} else if (cmp > 0) {
+			reportAll('+', n);
+			haveNew = newDB.next(n);
+		} else {
+			if (ignoreLines)
+				diffIgnoringLines(o, n);
+			else
+				diffExact(o, n);
+			haveOld = oldDB.next(o);
+			haveNew = newDB.next(n);
+		}
+	}
+
+	return oldDB.failed() || newDB.failed() ? -1 : 0;
+}
+
+void Differ::print(std::ostream &os)
+{
+	os << "--- " << table.name << ": " << removed << " removed, " << added << " added\n";
+
+	char buf[1 << 16];
+	size_t rd;
+	rewind(out);
+	while ((rd = fread(buf, 1, sizeof(buf), out)) > 0)
+		os.write(buf, rd);
+}
+
+int main(int argc, char **argv)
+{
+	bool ignoreLines;
+	std::vector<std::string> dbs;
+	cxxopts::Options options { argv[0],
+		"Compare structs, members, and uses of two databases. Lines starting "
+		"with '-' are only in OLD, '+' only in NEW." };
+	options.add_options()
+		("h,help", "Print this help message")
+		("l,ignore-lines", "Match rows by columns only, tolerating shifted lines",
+		 cxxopts::value(ignoreLines)->default_value("false"))
+		("dbs", "OLD and NEW databases", cxxopts::value(dbs))
+	;
+	options.parse_positional({ "dbs" });
+	options.positional_help("OLD.db NEW.db");
+
+	try {
+		const auto opts = options.parse(argc, argv);
+		if (opts.contains("help")) {
+			std::cout << options.help();
+			return 0;
+		}
+	} catch (const cxxopts::exceptions::parsing &e) {
+		std::cerr << "arguments error: " << e.what() << "\n";
+		std::cerr << options.help();
+		return 2;
+	}
+
+	if (dbs.size() != 2) {
+		std::cerr << options.help();
+		return 2;
+	}
+	for (const auto &db : dbs) {
+		if (!std::filesystem::exists(db)) {
+			std::cerr << db << " does not exist\n";
+			return 2;
+		}
+	}
+
+	std::vector<std::unique_ptr<Differ>> differs;
+	for (const auto &table : tables) {
+		differs.push_back(std::make_unique<Differ>(table, ignoreLines));
+		if (differs.back()->open(dbs[0], dbs[1]) < 0)
+			return 2;
+	}
+
+	/* each table has its own connections */
+	std::vector<int> rets(differs.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < differs.size(); i++)
+		threads.emplace_back([&differs, &rets, i] { rets[i] = differs[i]->run(); });
+	for (auto &t : threads)
+		t.join();
+
+	bool differ = false;
+	for (size_t i = 0; i < differs.size(); i++) {
+		if (rets[i] < 0)
+			return 2;
+		differs[i]->print(std::cout);
+		differ |= differs[i]->removed || differs[i]->added;
+	}
+
+	return differ;
+}
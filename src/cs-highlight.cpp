@@ -0,0 +1,522 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sl/sqlite/SQLiteSmart.h>
+#include <sl/sqlite/SQLConn.h>
+
+#include "BoundedQueue.h"
+
+using namespace ClangStruct;
+
+namespace {
+
+enum class Format {
+	ANSI,
+	HTML,
+};
+
+struct Use {
+	uint32_t begLine;
+	uint32_t begCol;
+	uint32_t endLine;
+	uint32_t endCol;
+	/* 1 load, 0 store, -1 unknown */
+	int load;
+};
+
+/* all uses of one source, ordered by location */
+struct File {
+	uint64_t seq;
+	std::string src;
+	std::vector<Use> uses;
+};
+
+/*
+ * Uses grouped by source. Only the current group is held. Sources are walked
+ * by their unique index and the uses of each by IDX_use_src, so SQLite needs
+ * no sorter.
+ */
+class UseStream : public SlSqlite::SQLConn {
+public:
+	UseStream(std::string filter) : filter(std::move(filter)) {}
+
+	/* false at the end or on an error */
+	bool next(File &file);
+	bool failed() const { return error; }
+private:
+	virtual bool prepDB() override;
+	bool step();
+	std::string_view text(int col) const {
+		auto str = sqlite3_column_text(sel.get(), col);
+		return str ? std::string_view(reinterpret_cast<const char *>(str),
+					      sqlite3_column_bytes(sel.get(), col)) :
+			std::string_view();
+	}
+
+	std::string filter;
+	SlSqlite::SQLStmtHolder sel;
+	bool started = false;
+	bool row = false;
+	bool error = false;
+};
+
+class MappedFile {
+public:
+	MappedFile() {}
+	~MappedFile() {
+		if (data)
+			munmap(data, size);
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	int open(const std::filesystem::path &path);
+	std::string_view view() const { return { static_cast<const char *>(data), size }; }
+private:
+	void *data = nullptr;
+	size_t size = 0;
+};
+
+/*
+ * Workers take files from a bounded queue, so that the reader runs at most
+ * a few files ahead of them. Output to stdout is written in the order of the
+ * files, each worker waits for its turn.
+ */
+class Highlighter {
+public:
+	Highlighter(const std::filesystem::path &basePath, const std::filesystem::path &outDir,
+		    Format format, bool onlyUses, unsigned jobs) :
+		basePath(basePath), outDir(outDir), format(format), onlyUses(onlyUses),
+		queue(2 * jobs) {}
+
+	int run(UseStream &stream, unsigned jobs);
+private:
+	void worker();
+	int highlight(const File &file, std::string &out);
+	void annotateLine(std::string &out, std::string_view line,
+			  std::vector<Use>::const_iterator &use,
+			  std::vector<Use>::const_iterator usesEnd);
+	void appendText(std::string &out, std::string_view text);
+	void begin(std::string &out, const std::string &src);
+	void end(std::string &out);
+	int emit(const File &file, const std::string &out);
+
+	const std::filesystem::path &basePath;
+	const std::filesystem::path &outDir;
+	Format format;
+	bool onlyUses;
+
+	BoundedQueue<File> queue;
+	std::mutex turnLock;
+	std::condition_variable turnCond;
+	uint64_t turn = 0;
+	std::atomic<unsigned> failed = 0;
+};
+
+const struct {
+	const char *ansi;
+	const char *html;
+} colors[] = {
+	/* load: -1, 0, 1 */
+	{ "\033[33m", "<span class=\"unknown\">" },
+	{ "\033[31m", "<span class=\"store\">" },
+	{ "\033[32m", "<span class=\"load\">" },
+};
+
+const char htmlHead[] =
+	"<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+	"<style>\n"
+	".load { color: green; }\n"
+	".store { color: red; }\n"
+	".unknown { color: olive; }\n"
+	".line { color: gray; }\n"
+	"</style>\n</head>\n<body>\n";
+const char htmlTail[] = "</body>\n</html>\n";
+
+}
+
+bool UseStream::prepDB()
+{
+	std::string sql = "SELECT source.src, use.begLine, use.begCol, use.endLine, use.endCol, "
+			"use.load "
+		"FROM use "
+		"JOIN source ON source.id = use.src ";
+	if (!filter.empty())
+		sql += "WHERE source.src GLOB :filter ";
+	sql += "ORDER BY source.src, use.begLine, use.begCol;";
+
+	if (!prepareStatements({ { sel, sql } }))
+		return false;
+
+	return filter.empty() || bind(sel, ":filter", filter);
+}
+
+bool UseStream::step()
+{
+	auto ret = sqlite3_step(sel.get());
+	if (ret == SQLITE_ROW)
+		return row = true;
+	if (ret != SQLITE_DONE) {
+		std::cerr << lastError() << "\n";
+		error = true;
+	}
+
+	return row = false;
+}
+
+bool UseStream::next(File &file)
+{
+	if (!started) {
+		started = true;
+		step();
+	}
+	if (!row)
+		return false;
+
+	file.src = text(0);
+	file.uses.clear();
+	do {
+		auto col = [this](int col) -> uint32_t {
+			return sqlite3_column_int64(sel.get(), col);
+		};
+		bool known = sqlite3_column_type(sel.get(), 5) != SQLITE_NULL;
+		file.uses.push_back({ col(1), col(2),
+				      sqlite3_column_type(sel.get(), 3) == SQLITE_NULL ? col(1) :
+				      col(3), col(4), known ? (int)col(5) : -1 });
+	} while (step() && text(0) == file.src);
+
+	return true;
+}
+
+int MappedFile::open(const std::filesystem::path &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* mmap() refuses empty mappings */
+	size = st.st_size;
+	if (size) {
+		data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			data = nullptr;
+			close(fd);
+			return -1;
+		}
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	return 0;
+}
+
+void Highlighter::appendText(std::string &out, std::string_view text)
+{
+	if (format == Format::ANSI) {
+		out.append(text);
+		return;
+	}
+
+	for (auto c : text) {
+		switch (c) {
+		case '&': out.append("&amp;"); break;
+		case '<': out.append("&lt;"); break;
+		case '>': out.append("&gt;"); break;
+		default: out.push_back(c);
+		}
+	}
+}
+
+void Highlighter::begin(std::string &out, const std::string &src)
+{
+	if (format == Format::ANSI) {
+		if (!onlyUses && outDir.empty())
+			out.append("\033[1m").append(src).append("\033[0m\n");
+		return;
+	}
+
+	if (!outDir.empty())
+		out.append(htmlHead);
+	out.append("<h2>");
+	appendText(out, src);
+	out.append("</h2>\n<pre>\n");
+}
+
+void Highlighter::end(std::string &out)
+{
+	if (format == Format::ANSI)
+		return;
+
+	out.append("</pre>\n");
+	if (!outDir.empty())
+		out.append(htmlTail);
+}
+
+/*
+ * Overlapping uses are skipped. The end column of a use points to the
+ * beginning of its last token (the member name), so the identifier there is
+ * included. Uses spanning more lines are highlighted to the end of the first.
+ */
+void Highlighter::annotateLine(std::string &out, std::string_view line,
+			       std::vector<Use>::const_iterator &use,
+			       std::vector<Use>::const_iterator usesEnd)
+{
+	auto lineNo = use->begLine;
+	size_t last = 0;
+
+	for (; use != usesEnd && use->begLine == lineNo; ++use) {
+		size_t beg = use->begCol - 1;
+		if (!use->begCol || beg < last)
+			continue;
+		if (beg >= line.size())
+			continue;
+
+		size_t stop = line.size();
+		if (use->endLine == use->begLine && use->endCol >= use->begCol) {
+			stop = std::min<size_t>(use->endCol - 1, line.size());
+			/* a designator ('.member') */
+			if (stop == beg)
+				stop++;
+			while (stop < line.size() && (isalnum((unsigned char)line[stop]) ||
+						      line[stop] == '_'))
+				stop++;
+		}
+
+		const auto &color = colors[std::clamp(use->load, -1, 1) + 1];
+		appendText(out, line.substr(last, beg - last));
+		out.append(format == Format::ANSI ? color.ansi : color.html);
+		appendText(out, line.substr(beg, stop - beg));
+		out.append(format == Format::ANSI ? "\033[0m" : "</span>");
+		last = stop;
+	}
+
+	appendText(out, line.substr(last));
+}
+
+int Highlighter::highlight(const File &file, std::string &out)
+{
+	MappedFile mapped;
+	if (mapped.open(basePath / file.src) < 0) {
+		std::cerr << "cannot open " << basePath / file.src << ": " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	auto text = mapped.view();
+	auto use = file.uses.cbegin();
+	auto usesEnd = file.uses.cend();
+	uint32_t lineNo = 1;
+
+	begin(out, file.src);
+
+	while (!text.empty()) {
+		auto eol = text.find('\n');
+		auto len = eol == text.npos ? text.size() : eol;
+		auto line = text.substr(0, len);
+		text.remove_prefix(eol == text.npos ? len : len + 1);
+
+		/* uses beyond the end of a (changed) line */
+		while (use != usesEnd && use->begLine < lineNo)
+			++use;
+
+		bool used = use != usesEnd && use->begLine == lineNo;
+		if (used || !onlyUses) {
+			if (onlyUses) {
+				if (format == Format::HTML)
+					out.append("<span class=\"line\">");
+				appendText(out, file.src);
+				out.append(":").append(std::to_string(lineNo)).append(": ");
+				if (format == Format::HTML)
+					out.append("</span>");
+			}
+			if (used)
+				annotateLine(out, line, use, usesEnd);
+			else
+				appendText(out, line);
+			out.push_back('\n');
+		}
+
+		lineNo++;
+	}
+
+	end(out);
+
+	return 0;
+}
+
+int Highlighter::emit(const File &file, const std::string &out)
+{
+	if (!outDir.empty()) {
+		auto path = outDir / std::filesystem::path(file.src).relative_path();
+		path += format == Format::HTML ? ".html" : ".ansi";
+
+		std::error_code ec;
+		std::filesystem::create_directories(path.parent_path(), ec);
+		if (ec) {
+			std::cerr << "cannot create " << path.parent_path() << ": " <<
+				     ec.message() << "\n";
+			return -1;
+		}
+
+		std::ofstream os(path);
+		if (!os.write(out.data(), out.size())) {
+			std::cerr << "cannot write " << path << ": " << strerror(errno) << "\n";
+			return -1;
+		}
+
+		return 0;
+	}
+
+	std::unique_lock lock(turnLock);
+	turnCond.wait(lock, [this, &file] { return turn == file.seq; });
+	std::cout.write(out.data(), out.size());
+	turn++;
+	lock.unlock();
+	turnCond.notify_all();
+
+	return std::cout ? 0 : -1;
+}
+
+void Highlighter::worker()
+{
+	std::string out;
+
+	while (auto file = queue.pop()) {
+		out.clear();
+		/* a missing file still has to pass its turn */
+		if (highlight(*file, out) < 0) {
+			out.clear();
+			failed++;
+		}
+		if (emit(*file, out) < 0)
+			failed++;
+	}
+}
+
+int Highlighter::run(UseStream &stream, unsigned jobs)
+{
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < jobs; i++)
+		workers.emplace_back(&Highlighter::worker, this);
+
+	if (format == Format::HTML && outDir.empty())
+		std::cout << htmlHead;
+
+	uint64_t seq = 0;
+	File file;
+	while (stream.next(file)) {
+		file.seq = seq++;
+		queue.push(std::move(file));
+		file = {};
+	}
+	queue.close();
+
+	for (auto &t : workers)
+		t.join();
+
+	if (format == Format::HTML && outDir.empty())
+		std::cout << htmlTail;
+
+	if (failed)
+		std::cerr << failed << " files failed\n";
+
+	return stream.failed() || failed ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::filesystem::path dbFile;
+	std::filesystem::path basePath;
+	std::filesystem::path outDir;
+	std::string filter;
+	std::string formatStr;
+	unsigned jobs;
+	bool onlyUses;
+	cxxopts::Options options { argv[0],
+		"Print sources with member uses highlighted: loads green, stores red, "
+		"unknown yellow" };
+	options.add_options()
+		("h,help", "Print this help message")
+		("d,db", "Database to read uses from",
+		 cxxopts::value(dbFile)->default_value("structs.db"))
+		("b,basepath", "Directory the sources are relative to",
+		 cxxopts::value(basePath)->default_value("."))
+		("f,filter", "Only sources matching this glob",
+		 cxxopts::value(filter))
+		("format", "Output format (ansi, html)",
+		 cxxopts::value(formatStr)->default_value("ansi"))
+		("o,output", "Write a file per source to this directory instead of stdout",
+		 cxxopts::value(outDir))
+		("j,jobs", "Number of highlighting threads (0 = number of CPUs)",
+		 cxxopts::value(jobs)->default_value("0"))
+		("u,only-uses", "Print only lines with uses, prefixed by file:line",
+		 cxxopts::value(onlyUses)->default_value("false"))
+	;
+
+	try {
+		const auto opts = options.parse(argc, argv);
+		if (opts.contains("help")) {
+			std::cout << options.help();
+			return 0;
+		}
+	} catch (const cxxopts::exceptions::parsing &e) {
+		std::cerr << "arguments error: " << e.what() << "\n";
+		std::cerr << options.help();
+		return EXIT_FAILURE;
+	}
+
+	Format format;
+	if (formatStr == "ansi")
+		format = Format::ANSI;
+	else if (formatStr == "html")
+		format = Format::HTML;
+	else {
+		std::cerr << "unknown format: " << formatStr << "\n";
+		return EXIT_FAILURE;
+	}
+
+	if (!std::filesystem::exists(dbFile)) {
+		std::cerr << dbFile << " does not exist\n";
+		return EXIT_FAILURE;
+	}
+
+	UseStream stream(filter);
+	if (!stream.open(dbFile)) {
+		std::cerr << "cannot open " << dbFile << ": " << stream.lastError() << "\n";
+		return EXIT_FAILURE;
+	}
+
+	if (!jobs)
+		jobs = std::max(std::thread::hardware_concurrency(), 1U);
+
+	Highlighter highlighter(basePath, outDir, format, onlyUses, jobs);
+	if (highlighter.run(stream, jobs) < 0)
+		return EXIT_FAILURE;
+
+	return 0;
+}
@@ -1,18 +1,20 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <csignal>
+#include <cstring>
 #include <cxxopts.hpp>
 #include <iostream>
 
 #include <fcntl.h>
 #include <unistd.h>
 
-//#include <sys/socket.h>
-//#include <sys/un.h>
 #include <sys/stat.h>
 
 #include <sl/helpers/Color.h>
 
+#include "ClaimTable.h"
+#include "metrics.h"
+#include "pipeline.h"
 #include "server.h"
 #include "sqlconn.h"
 
@@ -22,15 +24,13 @@ using Clr = SlHelpers::Color;
 
 namespace {
 
-volatile std::sig_atomic_t stop;
-
-Server server;
+std::unique_ptr<Server> server;
 SQLConn sqlConn;
 
 void sig(int sig)
 {
-	stop = true;
-	server.close();
+	if (server)
+		server->close();
 	if (sig == SIGABRT)
 		_exit(EXIT_FAILURE);
 }
@@ -44,12 +44,80 @@ int main(int argc, char **argv)
 	signal(SIGTERM, sig);
 
 	bool autocommit = false;
+	bool bulk = false;
+	bool summariesOnly = false;
+	std::string transport;
+	long mqMaxMsg, mqMsgSize;
+	unsigned shmRings;
+	unsigned commitInterval;
+	uint64_t commitRows;
+	SQLConn::Options sqlOpts;
+	std::string vacuum;
+	std::string vacuumInto;
+	uint64_t shmRingSize;
+	uint64_t claims;
+	unsigned decoders;
+	size_t queueDepth;
+	std::string metricsFile;
+	unsigned metricsInterval;
+	std::string spillDir;
 	cxxopts::Options options { argv[0], "Fill in structs.db" };
 	options.add_options()
 		("h,help", "Print this help message")
 		("a,autocommit", "Autocommit instead of transactions",
 		 cxxopts::value(autocommit)->default_value("false"))
+		("b,bulk", "Append to unindexed tables and build the real ones at exit",
+		 cxxopts::value(bulk)->default_value("false"))
 		("u,unlink", "Unlink the queue before any other work")
+		("summaries-only", "Only refresh the summary tables of structs.db and exit",
+		 cxxopts::value(summariesOnly)->default_value("false"))
+		("t,transport", "Transport to receive messages by (mq, shm, or socket)",
+		 cxxopts::value(transport)->default_value("mq"))
+		("mq-maxmsg", "Depth of the message queue (0 = system default)",
+		 cxxopts::value(mqMaxMsg)->default_value("0"))
+		("mq-msgsize", "Maximum size of one message in the queue (0 = system default)",
+		 cxxopts::value(mqMsgSize)->default_value("0"))
+		("shm-rings", "Number of shared memory rings (maximum of producers)",
+		 cxxopts::value(shmRings)->default_value("256"))
+		("shm-ring-size", "Size of one shared memory ring (power of 2)",
+		 cxxopts::value(shmRingSize)->default_value("1048576"))
+		("commit-interval", "Seconds between commits (0 = only when idle; "
+		 "at the end of a TU with the socket transport)",
+		 cxxopts::value(commitInterval)->default_value("5"))
+		("commit-rows", "Commit after this many records (0 = no limit)",
+		 cxxopts::value(commitRows)->default_value("500000"))
+		("journal-mode", "SQLite journal_mode (e.g. wal)",
+		 cxxopts::value(sqlOpts.journalMode))
+		("synchronous", "SQLite synchronous (off, normal, full)",
+		 cxxopts::value(sqlOpts.synchronous))
+		("cache-size", "SQLite cache_size (pages, or KiB if negative)",
+		 cxxopts::value(sqlOpts.cacheSize))
+		("mmap-size", "SQLite mmap_size in bytes",
+		 cxxopts::value(sqlOpts.mmapSize))
+		("page-size", "SQLite page_size of a new database",
+		 cxxopts::value(sqlOpts.pageSize))
+		("temp-store", "SQLite temp_store (default, file, memory)",
+		 cxxopts::value(sqlOpts.tempStore))
+		("auto-vacuum", "SQLite auto_vacuum of a new database (none, full, incremental)",
+		 cxxopts::value(sqlOpts.autoVacuum))
+		("vacuum", "Compaction at exit (full, incremental, or none)",
+		 cxxopts::value(vacuum)->default_value("full"))
+		("vacuum-into", "Write a compacted copy to this file at exit instead",
+		 cxxopts::value(vacuumInto))
+		("claims", "Slots of the header claim table (power of 2, 0 = every TU sends all headers)",
+		 cxxopts::value(claims)->default_value("1048576"))
+		("decoders", "Number of threads decoding messages",
+		 cxxopts::value(decoders)->default_value("2"))
+		("queue-depth", "Packets buffered between the receiving, decoding, and writing threads",
+		 cxxopts::value(queueDepth)->default_value("128"))
+		("metrics-file", "Append metrics as JSON lines to this file",
+		 cxxopts::value(metricsFile))
+		("metrics-interval", "Seconds between lines in --metrics-file",
+		 cxxopts::value(metricsInterval)->default_value("10"))
+		("spill-dir", "Directory of records spilled by the plugin when the queue was full "
+		 "(empty = none)",
+		 cxxopts::value(spillDir)->default_value(SpillFile::default_dir))
+		("stats", "Print metrics of the running db_filler and exit")
 	;
 
 	try {
@@ -58,18 +126,54 @@ int main(int argc, char **argv)
 			std::cout << options.help();
 			return 0;
 		}
-		if (opts.contains("unlink"))
-			server.unlink();
+		if (opts.contains("stats"))
+			return Metrics::poll(std::cout) < 0 ? EXIT_FAILURE : 0;
+		if (opts.contains("unlink")) {
+			Server::unlink();
+			ClaimTable::unlink();
+		}
 	} catch (const cxxopts::exceptions::parsing &e) {
 		Clr(std::cerr, Clr::RED) << "arguments error: " << e.what();
 		std::cerr << options.help();
 		return EXIT_FAILURE;
 	}
 
-	if (server.open() < 0)
+	if (vacuum != "full" && vacuum != "incremental" && vacuum != "none") {
+		Clr(std::cerr, Clr::RED) << "unknown vacuum: " << vacuum;
+		return EXIT_FAILURE;
+	}
+
+	if (summariesOnly) {
+		if (!sqlConn.open("structs.db", false, sqlOpts)) {
+			Clr(std::cerr, Clr::RED) << sqlConn.lastError();
+			return EXIT_FAILURE;
+		}
+		return sqlConn.refreshSummaries() ? 0 : EXIT_FAILURE;
+	}
+
+	if (transport == "mq") {
+		server = std::make_unique<MQServer>(mqMaxMsg, mqMsgSize);
+	} else if (transport == "shm") {
+		server = std::make_unique<ShmServer>(shmRings, shmRingSize);
+	} else if (transport == "socket") {
+		server = std::make_unique<SocketServer>(commitInterval);
+	} else {
+		Clr(std::cerr, Clr::RED) << "unknown transport: " << transport;
+		return EXIT_FAILURE;
+	}
+	if (!spillDir.empty())
+		server = std::make_unique<SpillServer>(std::move(server), spillDir);
+
+	if (server->open() < 0)
 		return EXIT_FAILURE;
 
-	if (!sqlConn.open()) {
+	ClaimTable claimTable;
+	if (claims && claimTable.create(claims) < 0) {
+		Clr(std::cerr, Clr::RED) << "cannot create claim table: " << strerror(errno);
+		return EXIT_FAILURE;
+	}
+
+	if (!sqlConn.open("structs.db", bulk, sqlOpts)) {
 		Clr(std::cerr, Clr::RED) << sqlConn.lastError();
 		return EXIT_FAILURE;
 	}
@@ -78,30 +182,34 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	Message<std::string_view> msg;
-	bool should_commit = false;
-
-	while (true) {
-		auto msgStr = server.read();
-		if (stop || !msgStr)
-			break;
-
-		if (msgStr->empty()) {
-			if (should_commit) {
-				std::cerr << "commiting\n";
-				if (!sqlConn.end() || !sqlConn.begin())
-					return EXIT_FAILURE;
-				should_commit = false;
-			}
-			continue;
-		}
+	/* only the receiving thread handles the signals */
+	sigset_t sigmask, oldmask;
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGINT);
+	sigaddset(&sigmask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigmask, &oldmask);
+
+	/* the socket server itself asks for commits at TU boundaries */
+	Pipeline pipeline(*server, sqlConn, autocommit, decoders, queueDepth, commitRows,
+			  transport == "socket" ? 0 : commitInterval);
+	Metrics metrics(pipeline, sqlConn, *server, metricsFile, metricsInterval);
+	if (metrics.start() < 0)
+		return EXIT_FAILURE;
+
+	if (pipeline.run(oldmask) < 0)
+		return EXIT_FAILURE;
 
-		msg.deserialize(*msgStr);
+	metrics.stop();
+	pipeline.printStats(std::cerr);
 
-		//std::cerr << "===" << msg << "\n";
+	sqlConn.retryDeferred(true);
+	if (claims)
+		ClaimTable::unlink();
 
-		sqlConn.handleMessage(msg);
-		should_commit = !autocommit;
+	if (bulk) {
+		std::cerr << "finalizing\n";
+		if (!sqlConn.finalizeBulk())
+			return EXIT_FAILURE;
 	}
 
 	if (!autocommit) {
@@ -109,7 +217,19 @@ int main(int argc, char **argv)
 		if (!sqlConn.end())
 			return EXIT_FAILURE;
 	}
-	sqlConn.exec("VACUUM;");
+	std::cerr << "summarizing\n";
+	if (!sqlConn.refreshSummaries())
+		return EXIT_FAILURE;
+
+	if (!vacuumInto.empty()) {
+		std::cerr << "vacuuming into " << vacuumInto << "\n";
+		if (!sqlConn.vacuum(vacuumInto))
+			return EXIT_FAILURE;
+	} else if (vacuum == "full") {
+		sqlConn.vacuum();
+	} else if (vacuum == "incremental") {
+		sqlConn.incrementalVacuum();
+	}
 	std::cerr << "bye\n";
 
 	return 0;
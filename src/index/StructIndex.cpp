@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "StructIndex.h"
+
+using namespace ClangStruct;
+
+bool StructIndex::UseReader::varint(uint32_t &val)
+{
+	val = 0;
+	for (unsigned shift = 0, i = 0; i < cur.length() && shift < 32; i++, shift += 7) {
+		auto b = (unsigned char)cur[i];
+		val |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			cur.remove_prefix(i + 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::optional<StructIndex::Use> StructIndex::UseReader::next()
+{
+	if (!left)
+		return std::nullopt;
+
+	uint32_t srcDelta, lineDelta, endLineDelta, flags;
+	Use use;
+	if (!varint(srcDelta) || !varint(lineDelta) || !varint(use.loc.begCol) ||
+			!varint(endLineDelta) || !varint(use.loc.endCol) || !varint(flags)) {
+		left = 0;
+		return std::nullopt;
+	}
+
+	if (srcDelta)
+		line = 0;
+	src += srcDelta;
+	line += lineDelta;
+
+	use.src = src;
+	use.loc.begLine = line;
+	use.loc.endLine = endLineDelta ? line + endLineDelta - 1 : 0;
+	use.load = (flags & 3) == 2 ? -1 : (flags & 1);
+	use.implicit = flags & 4;
+	left--;
+
+	return use;
+}
+
+template <typename T>
+bool StructIndex::section(const Section &sect, const T *&base, size_t &count, const char *name)
+{
+	if (sect.offset > mapSize || sect.size > mapSize - sect.offset ||
+			sect.offset % alignof(T) || sect.size % sizeof(T)) {
+		std::cerr << "bad " << name << " section in the index\n";
+		return false;
+	}
+
+	base = reinterpret_cast<const T *>(static_cast<const char *>(map) + sect.offset);
+	count = sect.size / sizeof(T);
+
+	return true;
+}
+
+int StructIndex::open(const std::filesystem::path &file)
+{
+	close();
+
+	int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "cannot open " << file << ": " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		std::cerr << "cannot stat " << file << ": " << strerror(errno) << "\n";
+		::close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.st_size < sizeof(Header)) {
+		std::cerr << file << " is not an index\n";
+		::close(fd);
+		return -1;
+	}
+
+	mapSize = st.st_size;
+	map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "cannot map " << file << ": " << strerror(errno) << "\n";
+		map = nullptr;
+		return -1;
+	}
+
+	const auto &hdr = *static_cast<const Header *>(map);
+	if (memcmp(hdr.magic, magic, sizeof(magic)) || hdr.byteOrder != byte_order) {
+		std::cerr << file << " is not an index of this machine\n";
+		close();
+		return -1;
+	}
+	if (hdr.version != version) {
+		std::cerr << file << " has version " << hdr.version << ", expected " <<
+			     version << ", run cs-export again\n";
+		close();
+		return -1;
+	}
+
+	size_t nrStrings;
+	if (!section(hdr.strings, strings, nrStrings, "strings") ||
+			!section(hdr.sources, sourcesBase, nrSources, "sources") ||
+			!section(hdr.structs, structsBase, nrStructs, "structs") ||
+			!section(hdr.members, membersBase, nrMembers, "members") ||
+			!section(hdr.uses, usesBase, usesSize, "uses")) {
+		close();
+		return -1;
+	}
+	if (!nrStrings || strings[nrStrings - 1]) {
+		std::cerr << "bad strings section in the index\n";
+		close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void StructIndex::close()
+{
+	if (map)
+		munmap(map, mapSize);
+	map = nullptr;
+	mapSize = 0;
+	nrSources = nrStructs = nrMembers = usesSize = 0;
+}
+
+std::span<const StructIndex::Struct> StructIndex::findStructs(std::string_view name) const
+{
+	auto found = std::ranges::equal_range(structs(), name, {},
+					      [this](const Struct &s) { return str(s.name); });
+
+	return { found.begin(), found.end() };
+}
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace ClangStruct {
+
+/*
+ * A compact read-only copy of structs.db for queries, written by cs-export
+ * and used directly from mmap. A Header is followed by sections at 8-byte
+ * aligned offsets:
+ *
+ *  strings: deduplicated NUL-terminated paths and names, offset 0 is ""
+ *  sources: uint32_t string offsets, indexed by source number
+ *  structs: Struct[] sorted by name, source, and location
+ *  members: Member[], those of one struct are consecutive and sorted by
+ *           location
+ *  uses:    for each member a run of varints, see UseReader
+ *
+ * Numbers are in the byte order of the writer, the reader refuses others.
+ */
+class StructIndex {
+public:
+	static constexpr char magic[8] = "CSINDEX";
+	static constexpr uint32_t version = 1;
+	static constexpr uint32_t byte_order = 0x01020304;
+
+	struct Section {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		Section strings;
+		Section sources;
+		Section structs;
+		Section members;
+		Section uses;
+	};
+
+	/* 0 for an unknown end */
+	struct Loc {
+		uint32_t begLine;
+		uint32_t begCol;
+		uint32_t endLine;
+		uint32_t endCol;
+	};
+
+	struct Struct {
+		uint32_t name;
+		uint32_t attrs;
+		uint32_t src;
+		Loc loc;
+		uint32_t firstMember;
+		uint32_t nrMembers;
+		char type;
+		uint8_t packed;
+		uint8_t inMacro;
+		uint8_t pad;
+	};
+
+	struct Member {
+		uint32_t name;
+		/* index of its Struct */
+		uint32_t strct;
+		Loc loc;
+		uint32_t uses;
+		uint32_t loads;
+		uint32_t stores;
+		uint32_t implicitUses;
+		/* byte offset into the uses section */
+		uint64_t firstUse;
+		uint32_t nrUses;
+		uint32_t pad;
+	};
+
+	struct Use {
+		uint32_t src;
+		Loc loc;
+		/* -1 if unknown */
+		int8_t load;
+		bool implicit;
+	};
+
+	/*
+	 * Uses of a member are sorted by source and location. Each is stored
+	 * as varints relative to the previous one: source delta, begLine delta
+	 * (absolute when the source changed), begCol, endLine - begLine + 1
+	 * (0 for an unknown end), endCol, and flags (load: 0, 1, or 2 for
+	 * unknown; implicit << 2).
+	 */
+	class UseReader {
+	public:
+		UseReader(std::string_view data, uint32_t count) : cur(data), left(count) {}
+
+		/* std::nullopt at the end or on a truncated run */
+		std::optional<Use> next();
+	private:
+		bool varint(uint32_t &val);
+
+		std::string_view cur;
+		uint32_t left;
+		uint32_t src = 0;
+		uint32_t line = 0;
+	};
+
+	StructIndex() {}
+	~StructIndex() { close(); }
+
+	StructIndex(const StructIndex &) = delete;
+	StructIndex &operator=(const StructIndex &) = delete;
+
+	/* returns -1 and prints why on failure */
+	int open(const std::filesystem::path &file);
+	void close();
+
+	std::span<const Struct> structs() const { return { structsBase, nrStructs }; }
+	std::span<const Member> members() const { return { membersBase, nrMembers }; }
+	std::span<const Member> members(const Struct &s) const {
+		return members().subspan(s.firstMember, s.nrMembers);
+	}
+	/* all structs of this name, from all sources */
+	std::span<const Struct> findStructs(std::string_view name) const;
+
+	std::string_view str(uint32_t offset) const { return strings + offset; }
+	std::string_view src(uint32_t idx) const { return str(sourcesBase[idx]); }
+
+	UseReader uses(const Member &m) const {
+		return UseReader(std::string_view(usesBase + m.firstUse, usesSize - m.firstUse),
+				 m.nrUses);
+	}
+private:
+	template <typename T>
+	bool section(const Section &sect, const T *&base, size_t &count, const char *name);
+
+	void *map = nullptr;
+	size_t mapSize = 0;
+
+	const char *strings = nullptr;
+	const uint32_t *sourcesBase = nullptr;
+	size_t nrSources = 0;
+	const Struct *structsBase = nullptr;
+	size_t nrStructs = 0;
+	const Member *membersBase = nullptr;
+	size_t nrMembers = 0;
+	const char *usesBase = nullptr;
+	size_t usesSize = 0;
+};
+
+}
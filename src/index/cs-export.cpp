@@ -0,0 +1,418 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <sl/sqlite/SQLiteSmart.h>
+#include <sl/sqlite/SQLConn.h>
+
+#include "StructIndex.h"
+
+using namespace ClangStruct;
+
+namespace {
+
+using Index = StructIndex;
+
+/* reads structs.db and writes it as a StructIndex */
+class Exporter : public SlSqlite::SQLConn {
+public:
+	Exporter() {}
+
+	int exportTo(const std::filesystem::path &file);
+private:
+	virtual bool prepDB() override;
+
+	template <typename F>
+	bool forEachRow(SlSqlite::SQLStmtHolder &sel, F f);
+	static std::string_view text(sqlite3_stmt *stmt, int col);
+	static uint32_t num(sqlite3_stmt *stmt, int col) {
+		return sqlite3_column_int64(stmt, col);
+	}
+	static Index::Loc loc(sqlite3_stmt *stmt, int col) {
+		return { num(stmt, col), num(stmt, col + 1), num(stmt, col + 2),
+			 num(stmt, col + 3) };
+	}
+
+	uint32_t addString(std::string_view str);
+	static void varint(std::string &out, uint32_t val);
+
+	bool readSources();
+	bool readStructs();
+	bool readMembers();
+	bool readUses();
+	int write(const std::filesystem::path &file);
+
+	SlSqlite::SQLStmtHolder selSrc;
+	SlSqlite::SQLStmtHolder selStr;
+	SlSqlite::SQLStmtHolder selMem;
+	SlSqlite::SQLStmtHolder selUse;
+
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> stringOffsets;
+
+	std::vector<uint32_t> sources;
+	std::unordered_map<int64_t, uint32_t> sourceIdx;
+	std::vector<Index::Struct> structs;
+	std::unordered_map<int64_t, uint32_t> structIdx;
+	std::vector<Index::Member> members;
+	std::unordered_map<int64_t, uint32_t> memberIdx;
+	/* per member until written */
+	std::vector<std::string> uses;
+};
+
+}
+
+bool Exporter::prepDB()
+{
+	const Statements stmts {
+		{ selSrc, "SELECT id, src FROM source ORDER BY id;" },
+		{ selStr, "SELECT id, type, name, attrs, packed, inMacro, src, "
+				"begLine, begCol, endLine, endCol FROM struct;" },
+		{ selMem, "SELECT id, struct, name, begLine, begCol, endLine, endCol, "
+				"uses, loads, stores, implicit_uses FROM member;" },
+		{ selUse, "SELECT member, src, begLine, begCol, endLine, endCol, load, implicit "
+				"FROM use ORDER BY member, src, begLine, begCol;" },
+	};
+
+	return prepareStatements(stmts);
+}
+
+template <typename F>
+bool Exporter::forEachRow(SlSqlite::SQLStmtHolder &sel, F f)
+{
+	int ret;
+
+	while ((ret = sqlite3_step(sel.get())) == SQLITE_ROW)
+		if (!f(sel.get()))
+			return false;
+
+	if (ret != SQLITE_DONE) {
+		std::cerr << lastError() << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+std::string_view Exporter::text(sqlite3_stmt *stmt, int col)
+{
+	auto str = sqlite3_column_text(stmt, col);
+	if (!str)
+		return {};
+
+	return { reinterpret_cast<const char *>(str), (size_t)sqlite3_column_bytes(stmt, col) };
+}
+
+uint32_t Exporter::addString(std::string_view str)
+{
+	auto [it, added] = stringOffsets.try_emplace(std::string(str), strings.size());
+	if (added) {
+		strings.append(str);
+		strings.push_back('\0');
+	}
+
+	return it->second;
+}
+
+void Exporter::varint(std::string &out, uint32_t val)
+{
+	while (val >= 0x80) {
+		out.push_back((char)(val | 0x80));
+		val >>= 7;
+	}
+	out.push_back((char)val);
+}
+
+bool Exporter::readSources()
+{
+	return forEachRow(selSrc, [this](sqlite3_stmt *stmt) {
+		sourceIdx[sqlite3_column_int64(stmt, 0)] = sources.size();
+		sources.push_back(addString(text(stmt, 1)));
+		return true;
+	});
+}
+
+bool Exporter::readStructs()
+{
+	std::vector<int64_t> ids;
+
+	auto ok = forEachRow(selStr, [this, &ids](sqlite3_stmt *stmt) {
+		auto src = sourceIdx.find(sqlite3_column_int64(stmt, 6));
+		if (src == sourceIdx.end()) {
+			std::cerr << "struct " << text(stmt, 2) << " has an unknown source\n";
+			return false;
+		}
+
+		ids.push_back(sqlite3_column_int64(stmt, 0));
+		structs.push_back({
+			.name = addString(text(stmt, 2)),
+			.attrs = addString(text(stmt, 3)),
+			.src = src->second,
+			.loc = loc(stmt, 7),
+			.firstMember = 0,
+			.nrMembers = 0,
+			.type = text(stmt, 1).empty() ? 's' : text(stmt, 1)[0],
+			.packed = (uint8_t)num(stmt, 4),
+			.inMacro = (uint8_t)num(stmt, 5),
+			.pad = 0,
+		});
+		return true;
+	});
+	if (!ok)
+		return false;
+
+	/* the order StructIndex::findStructs() relies on */
+	std::vector<uint32_t> order(structs.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	auto str = [this](uint32_t off) { return std::string_view(strings.data() + off); };
+	std::sort(order.begin(), order.end(), [this, &str](uint32_t a, uint32_t b) {
+		const auto &sa = structs[a], &sb = structs[b];
+		return std::tuple(str(sa.name), str(sources[sa.src]), sa.loc.begLine, sa.loc.begCol) <
+			std::tuple(str(sb.name), str(sources[sb.src]), sb.loc.begLine, sb.loc.begCol);
+	});
+
+	std::vector<Index::Struct> sorted;
+	sorted.reserve(structs.size());
+	for (auto i : order) {
+		structIdx[ids[i]] = sorted.size();
+		sorted.push_back(structs[i]);
+	}
+	structs = std::move(sorted);
+
+	return true;
+}
+
+bool Exporter::readMembers()
+{
+	std::vector<int64_t> ids;
+
+	auto ok = forEachRow(selMem, [this, &ids](sqlite3_stmt *stmt) {
+		auto strct = structIdx.find(sqlite3_column_int64(stmt, 1));
+		if (strct == structIdx.end()) {
+			std::cerr << "member " << text(stmt, 2) << " has an unknown struct\n";
+			return false;
+		}
+
+		ids.push_back(sqlite3_column_int64(stmt, 0));
+		members.push_back({
+			.name = addString(text(stmt, 2)),
+			.strct = strct->second,
+			.loc = loc(stmt, 3),
+			.uses = num(stmt, 7),
+			.loads = num(stmt, 8),
+			.stores = num(stmt, 9),
+			.implicitUses = num(stmt, 10),
+			.firstUse = 0,
+			.nrUses = 0,
+			.pad = 0,
+		});
+		return true;
+	});
+	if (!ok)
+		return false;
+
+	std::vector<uint32_t> order(members.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		const auto &ma = members[a], &mb = members[b];
+		return std::tuple(ma.strct, ma.loc.begLine, ma.loc.begCol, ma.name) <
+			std::tuple(mb.strct, mb.loc.begLine, mb.loc.begCol, mb.name);
+	});
+
+	std::vector<Index::Member> sorted;
+	sorted.reserve(members.size());
+	for (auto i : order) {
+		auto &s = structs[members[i].strct];
+		if (!s.nrMembers)
+			s.firstMember = sorted.size();
+		s.nrMembers++;
+		memberIdx[ids[i]] = sorted.size();
+		sorted.push_back(members[i]);
+	}
+	members = std::move(sorted);
+
+	return true;
+}
+
+bool Exporter::readUses()
+{
+	/* rows come sorted by member, source, and location */
+	int64_t lastMember = -1;
+	uint32_t idx = 0, lastSrc = 0, lastLine = 0;
+
+	uses.resize(members.size());
+
+	return forEachRow(selUse, [&](sqlite3_stmt *stmt) {
+		auto member = sqlite3_column_int64(stmt, 0);
+		if (member != lastMember) {
+			auto it = memberIdx.find(member);
+			if (it == memberIdx.end()) {
+				std::cerr << "use of an unknown member " << member << "\n";
+				return false;
+			}
+			lastMember = member;
+			idx = it->second;
+			lastSrc = lastLine = 0;
+		}
+
+		auto srcIt = sourceIdx.find(sqlite3_column_int64(stmt, 1));
+		if (srcIt == sourceIdx.end()) {
+			std::cerr << "use of member " << member << " has an unknown source\n";
+			return false;
+		}
+
+		auto src = srcIt->second;
+		auto l = loc(stmt, 2);
+		if (src != lastSrc)
+			lastLine = 0;
+		auto load = sqlite3_column_type(stmt, 6) == SQLITE_NULL ? 2U : num(stmt, 6) & 1;
+
+		auto &out = uses[idx];
+		varint(out, src - lastSrc);
+		varint(out, l.begLine - lastLine);
+		varint(out, l.begCol);
+		varint(out, l.endLine ? l.endLine - l.begLine + 1 : 0);
+		varint(out, l.endCol);
+		varint(out, load | (num(stmt, 7) ? 4 : 0));
+		members[idx].nrUses++;
+
+		lastSrc = src;
+		lastLine = l.begLine;
+		return true;
+	});
+}
+
+int Exporter::write(const std::filesystem::path &file)
+{
+	Index::Header hdr {};
+	uint64_t offset = sizeof(hdr);
+	auto place = [&offset](Index::Section &sect, uint64_t size) {
+		offset = (offset + 7) & ~7ULL;
+		sect = { offset, size };
+		offset += size;
+	};
+
+	for (auto &m : members) {
+		m.firstUse = hdr.uses.size;
+		hdr.uses.size += uses[&m - members.data()].size();
+	}
+
+	memcpy(hdr.magic, Index::magic, sizeof(hdr.magic));
+	hdr.version = Index::version;
+	hdr.byteOrder = Index::byte_order;
+	place(hdr.strings, strings.size());
+	place(hdr.sources, sources.size() * sizeof(sources[0]));
+	place(hdr.structs, structs.size() * sizeof(structs[0]));
+	place(hdr.members, members.size() * sizeof(members[0]));
+	place(hdr.uses, hdr.uses.size);
+
+	/* readers of the old file keep their mapping */
+	auto tmp = file;
+	tmp += ".tmp";
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cerr << "cannot create " << tmp << ": " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	auto put = [&out](const Index::Section &sect, const void *data) {
+		static const char zeros[8] = {};
+		out.write(zeros, sect.offset - out.tellp());
+		out.write(static_cast<const char *>(data), sect.size);
+	};
+
+	out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+	put(hdr.strings, strings.data());
+	put(hdr.sources, sources.data());
+	put(hdr.structs, structs.data());
+	put(hdr.members, members.data());
+	put({ hdr.uses.offset, 0 }, nullptr);
+	for (const auto &u : uses)
+		out.write(u.data(), u.size());
+
+	out.close();
+	if (!out) {
+		std::cerr << "cannot write " << tmp << ": " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmp, file, ec);
+	if (ec) {
+		std::cerr << "cannot rename " << tmp << " to " << file << ": " << ec.message() << "\n";
+		return -1;
+	}
+
+	std::cerr << "exported " << structs.size() << " structs, " << members.size() <<
+		     " members, " << hdr.uses.size << " bytes of uses, " << strings.size() <<
+		     " bytes of strings\n";
+
+	return 0;
+}
+
+int Exporter::exportTo(const std::filesystem::path &file)
+{
+	/* a consistent snapshot even if db_filler is writing */
+	if (!begin()) {
+		std::cerr << lastError() << "\n";
+		return -1;
+	}
+
+	/* "" is at offset 0 */
+	addString("");
+
+	auto ok = readSources() && readStructs() && readMembers() && readUses();
+	end();
+	if (!ok)
+		return -1;
+
+	return write(file);
+}
+
+int main(int argc, char **argv)
+{
+	std::string dbFile;
+	std::string indexFile;
+	cxxopts::Options options { argv[0], "Export structs.db to an index for cs-query" };
+	options.add_options()
+		("h,help", "Print this help message")
+		("d,db", "Database to export",
+		 cxxopts::value(dbFile)->default_value("structs.db"))
+		("o,output", "Index file to write",
+		 cxxopts::value(indexFile)->default_value("structs.idx"))
+	;
+
+	try {
+		const auto opts = options.parse(argc, argv);
+		if (opts.contains("help")) {
+			std::cout << options.help();
+			return 0;
+		}
+	} catch (const cxxopts::exceptions::parsing &e) {
+		std::cerr << "arguments error: " << e.what() << "\n";
+		std::cerr << options.help();
+		return EXIT_FAILURE;
+	}
+
+	if (!std::filesystem::exists(dbFile)) {
+		std::cerr << dbFile << " does not exist\n";
+		return EXIT_FAILURE;
+	}
+
+	Exporter exporter;
+	if (!exporter.open(dbFile)) {
+		std::cerr << "cannot open " << dbFile << ": " << exporter.lastError() << "\n";
+		return EXIT_FAILURE;
+	}
+
+	return exporter.exportTo(indexFile) < 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cxxopts.hpp>
+#include <iostream>
+
+#include <fnmatch.h>
+
+#include "StructIndex.h"
+
+using namespace ClangStruct;
+
+namespace {
+
+/* the columns and format of the views in structs.db, without ids */
+std::ostream &operator<<(std::ostream &os, const StructIndex::Loc &loc)
+{
+	/* NULL in the views */
+	if (!loc.endLine)
+		return os;
+
+	return os << loc.begLine << ':' << loc.begCol << '-' << loc.endLine << ':' << loc.endCol;
+}
+
+void printMember(const StructIndex &idx, const StructIndex::Member &m)
+{
+	const auto &s = idx.structs()[m.strct];
+
+	std::cout << idx.str(s.name) << '|' << idx.str(s.attrs) << '|' << idx.str(m.name) << '|' <<
+		     idx.src(s.src) << '|' << m.loc << '|' << m.uses << '|' << m.loads << '|' <<
+		     m.stores << '|' << m.implicitUses << '\n';
+}
+
+int queryStruct(const StructIndex &idx, const std::string &name)
+{
+	auto structs = idx.findStructs(name);
+	if (structs.empty()) {
+		std::cerr << "no struct " << name << "\n";
+		return -1;
+	}
+
+	for (const auto &s : structs)
+		for (const auto &m : idx.members(s))
+			printMember(idx, m);
+
+	return 0;
+}
+
+int queryUnused(const StructIndex &idx, const std::string &filePattern)
+{
+	for (const auto &m : idx.members()) {
+		if (m.uses)
+			continue;
+
+		const auto &s = idx.structs()[m.strct];
+		auto name = idx.str(s.name);
+		if (name == "<anonymous>" || name == "<unnamed>" || idx.str(m.name) == "<unnamed>")
+			continue;
+		/* the views are NUL-terminated */
+		auto src = idx.src(s.src);
+		if (!filePattern.empty() && fnmatch(filePattern.c_str(), src.data(), 0))
+			continue;
+
+		std::cout << name << '|' << idx.str(s.attrs) << '|' << idx.str(m.name) << '|' <<
+			     src << '|' << m.loc << '\n';
+	}
+
+	return 0;
+}
+
+int queryUses(const StructIndex &idx, const std::string &strct, const std::string &member)
+{
+	bool found = false;
+
+	for (const auto &s : idx.findStructs(strct)) {
+		for (const auto &m : idx.members(s)) {
+			if (idx.str(m.name) != member)
+				continue;
+
+			found = true;
+			auto reader = idx.uses(m);
+			while (auto use = reader.next()) {
+				std::cout << strct << '|' << idx.str(s.attrs) << '|' << member << '|' <<
+					     idx.src(use->src) << '|' << use->loc << '|';
+				if (use->load >= 0)
+					std::cout << (int)use->load;
+				std::cout << '|' << use->implicit << '\n';
+			}
+		}
+	}
+
+	if (!found) {
+		std::cerr << "no member " << strct << "." << member << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	std::string indexFile;
+	std::string filePattern;
+	std::string command;
+	std::vector<std::string> args;
+	cxxopts::Options options { argv[0], "Query an index written by cs-export" };
+	options.add_options()
+		("h,help", "Print this help message")
+		("i,index", "Index file to query",
+		 cxxopts::value(indexFile)->default_value("structs.idx"))
+		("file", "Only members of structs in files matching this glob (unused)",
+		 cxxopts::value(filePattern))
+		("command", "struct NAME, unused, or uses STRUCT MEMBER",
+		 cxxopts::value(command))
+		("args", "Arguments of the command",
+		 cxxopts::value(args))
+	;
+	options.parse_positional({ "command", "args" });
+	options.positional_help("struct NAME | unused [--file PATTERN] | uses STRUCT MEMBER");
+
+	try {
+		const auto opts = options.parse(argc, argv);
+		if (opts.contains("help") || command.empty()) {
+			std::cout << options.help();
+			return command.empty() && !opts.contains("help") ? EXIT_FAILURE : 0;
+		}
+	} catch (const cxxopts::exceptions::parsing &e) {
+		std::cerr << "arguments error: " << e.what() << "\n";
+		std::cerr << options.help();
+		return EXIT_FAILURE;
+	}
+
+	StructIndex idx;
+	if (idx.open(indexFile) < 0)
+		return EXIT_FAILURE;
+
+	int ret;
+	if (command == "struct" && args.size() == 1) {
+		ret = queryStruct(idx, args[0]);
+	} else if (command == "unused" && args.empty()) {
+		ret = queryUnused(idx, filePattern);
+	} else if (command == "uses" && args.size() == 2) {
+		ret = queryUses(idx, args[0], args[1]);
+	} else {
+		std::cerr << "bad command\n";
+		std::cerr << options.help();
+		return EXIT_FAILURE;
+	}
+
+	return ret < 0 ? EXIT_FAILURE : 0;
+}
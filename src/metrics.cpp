@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "Message.h"
+#include "Socket.h"
+#include "metrics.h"
+#include "server.h"
+#include "sqlconn.h"
+
+using namespace ClangStruct;
+
+namespace {
+
+using Msg = Message<std::string_view>;
+
+const struct {
+	Msg::KIND kind;
+	const char *name;
+} kindNames[] = {
+	{ Msg::KIND::SOURCE, "source" },
+	{ Msg::KIND::STRUCT, "struct" },
+	{ Msg::KIND::MEMBER, "member" },
+	{ Msg::KIND::USE, "use" },
+	{ Msg::KIND::DEP, "dep" },
+	{ Msg::KIND::STATS, "stats" },
+};
+
+}
+
+Metrics::~Metrics()
+{
+	stop();
+}
+
+int Metrics::start()
+{
+	if (!file.empty()) {
+		out.open(file, std::ios::app);
+		if (!out) {
+			std::cerr << "cannot open " << file << ": " << strerror(errno) << "\n";
+			return -1;
+		}
+	}
+
+	stopFd = eventfd(0, EFD_CLOEXEC);
+	if (stopFd < 0) {
+		std::cerr << "cannot create eventfd: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	/* another db_filler may run, the metrics are not worth failing for */
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr;
+	auto addrLen = Socket::fillAddr(addr, socket_name);
+	if (sock < 0 || bind(sock, (const struct sockaddr *)&addr, addrLen) < 0 ||
+			listen(sock, 8) < 0) {
+		std::cerr << "metrics socket disabled: " << strerror(errno) << "\n";
+		if (sock >= 0)
+			close(sock);
+		sock = -1;
+	}
+
+	started = fileWindow.time = pollWindow.time = Clock::now();
+	thread = std::thread(&Metrics::run, this);
+
+	return 0;
+}
+
+void Metrics::stop()
+{
+	if (thread.joinable()) {
+		uint64_t one = 1;
+		if (write(stopFd, &one, sizeof(one)) < 0)
+			std::cerr << "cannot stop metrics: " << strerror(errno) << "\n";
+		thread.join();
+	}
+
+	/* the final numbers */
+	if (out.is_open()) {
+		out << line(fileWindow) << std::endl;
+		out.close();
+	}
+
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+	if (stopFd >= 0) {
+		close(stopFd);
+		stopFd = -1;
+	}
+}
+
+void Metrics::run()
+{
+	struct pollfd fds[] = {
+		{ .fd = stopFd, .events = POLLIN },
+		{ .fd = sock, .events = POLLIN },
+	};
+	auto next = Clock::now() + std::chrono::seconds(interval);
+
+	while (true) {
+		int timeout = -1;
+		if (out.is_open()) {
+			auto left = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now());
+			timeout = std::max<int>(left.count(), 0);
+		}
+
+		/* a negative fd is ignored by poll() */
+		if (::poll(fds, std::size(fds), timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			std::cerr << "metrics poll: " << strerror(errno) << "\n";
+			return;
+		}
+
+		if (fds[0].revents)
+			return;
+
+		if (fds[1].revents & POLLIN)
+			serve();
+
+		if (out.is_open() && Clock::now() >= next) {
+			out << line(fileWindow) << std::endl;
+			next += std::chrono::seconds(interval);
+		}
+	}
+}
+
+void Metrics::serve()
+{
+	int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	auto str = line(pollWindow);
+	str.push_back('\n');
+	if (send(fd, str.c_str(), str.length(), MSG_NOSIGNAL) < 0)
+		std::cerr << "metrics send: " << strerror(errno) << "\n";
+
+	close(fd);
+}
+
+std::string Metrics::line(Window &last)
+{
+	auto now = Clock::now();
+	auto cur = pipeline.counters();
+	auto secs = std::chrono::duration<double>(now - last.time).count();
+	auto rate = [secs](uint64_t cur, uint64_t last) {
+		return secs > 0 ? (cur - last) / secs : 0.0;
+	};
+	std::ostringstream ss;
+
+	ss.precision(1);
+	ss << std::fixed;
+
+	ss << "{\"time\":" << time(NULL) <<
+	      ",\"uptime\":" << std::chrono::duration<double>(now - started).count() <<
+	      ",\"packets\":" << cur.received <<
+	      ",\"bytes\":" << cur.bytes <<
+	      ",\"bytes_per_s\":" << rate(cur.bytes, last.counters.bytes) <<
+	      ",\"messages\":" << cur.messages <<
+	      ",\"messages_per_s\":" << rate(cur.messages, last.counters.messages);
+
+	ss << ",\"kinds\":{";
+	bool first = true;
+	for (const auto &k : kindNames) {
+		ss << (first ? "" : ",") << '"' << k.name << "\":{\"count\":" <<
+		      cur.kinds[k.kind] << ",\"per_s\":" <<
+		      rate(cur.kinds[k.kind], last.counters.kinds[k.kind]) << '}';
+		first = false;
+	}
+	ss << '}';
+
+	ss << ",\"failures\":{";
+	for (unsigned f = 0; f < SQLConn::NR_FAILURES; f++)
+		ss << (f ? "," : "") << '"' << SQLConn::failureName((SQLConn::FAILURE)f) <<
+		      "\":" << sqlConn.failures((SQLConn::FAILURE)f);
+	ss << '}';
+
+	/* bucket i holds commits which took less than 2^i ms */
+	ss << ",\"commits\":" << cur.commits << ",\"commit_ms\":{";
+	for (unsigned i = 0; i < cur.commitMs.size(); i++) {
+		ss << (i ? "," : "") << '"';
+		if (i + 1 < cur.commitMs.size())
+			ss << "<" << (1U << i);
+		else
+			ss << ">=" << (1U << (i - 1));
+		ss << "\":" << cur.commitMs[i];
+	}
+	ss << '}';
+
+	ss << ",\"queues\":{\"raw\":" << cur.rawDepth << ",\"decoded\":" << cur.decodedDepth;
+	if (auto queued = server.queued())
+		ss << ",\"transport\":" << *queued;
+	ss << "}}";
+
+	last = { now, cur };
+
+	return ss.str();
+}
+
+int Metrics::poll(std::ostream &os)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		std::cerr << "cannot create socket: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	auto addrLen = Socket::fillAddr(addr, socket_name);
+	if (connect(fd, (const struct sockaddr *)&addr, addrLen) < 0) {
+		std::cerr << "cannot connect to db_filler: " << strerror(errno) << "\n";
+		close(fd);
+		return -1;
+	}
+
+	char buf[4096];
+	ssize_t rd;
+	while ((rd = read(fd, buf, sizeof(buf))) > 0)
+		os.write(buf, rd);
+
+	close(fd);
+
+	return rd < 0 ? -1 : 0;
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "pipeline.h"
+
+namespace ClangStruct {
+
+class Server;
+class SQLConn;
+
+/*
+ * Reports the counters of a running db_filler as JSON lines: every
+ * @interval seconds to a file (if any), and on request to clients of an
+ * abstract unix socket (db_filler --stats). It runs in its own thread and
+ * only reads the counters, so the receiving and writing threads are not
+ * slowed down.
+ *
+ * Rates are per second since the previous line of the same kind: the file
+ * and the polls have separate windows, so polls do not skew the file.
+ */
+class Metrics {
+public:
+	static constexpr char socket_name[] = "db_filler_metrics";
+
+	Metrics(const Pipeline &pipeline, const SQLConn &sqlConn, const Server &server,
+		std::filesystem::path file, unsigned interval) :
+		pipeline(pipeline), sqlConn(sqlConn), server(server), file(std::move(file)),
+		interval(interval ? interval : 1) {}
+	~Metrics();
+
+	Metrics(const Metrics &) = delete;
+	Metrics &operator=(const Metrics &) = delete;
+
+	int start();
+	void stop();
+
+	/* the client: print a line of the running db_filler */
+	static int poll(std::ostream &os);
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/* the counters of the previous line */
+	struct Window {
+		Clock::time_point time;
+		Pipeline::Counters counters {};
+	};
+
+	void run();
+	void serve();
+	std::string line(Window &last);
+
+	const Pipeline &pipeline;
+	const SQLConn &sqlConn;
+	const Server &server;
+	std::filesystem::path file;
+	unsigned interval;
+
+	std::ofstream out;
+	int sock = -1;
+	int stopFd = -1;
+	std::thread thread;
+
+	Clock::time_point started;
+	Window fileWindow;
+	Window pollWindow;
+};
+
+}
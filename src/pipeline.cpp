@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include <pthread.h>
+
+#include "Packet.h"
+#include "pipeline.h"
+#include "server.h"
+#include "sqlconn.h"
+
+using namespace ClangStruct;
+
+Pipeline::Pipeline(Server &server, SQLConn &sqlConn, bool autocommit, unsigned decoders,
+		   size_t depth, uint64_t commitRows, unsigned commitInterval) :
+	server(server), sqlConn(sqlConn), autocommit(autocommit),
+	decoders(decoders ? decoders : 1), commitRows(commitRows),
+	commitInterval(commitInterval), raw(depth), decoded(depth), spare(2 * depth)
+{
+}
+
+Pipeline::Batch Pipeline::getBatch()
+{
+	if (auto batch = spare.tryPop())
+		return std::move(*batch);
+
+	return Batch();
+}
+
+void Pipeline::putBatch(Batch &&batch)
+{
+	/* when there are too many spares, this one is simply freed */
+	spare.tryPush(batch);
+}
+
+void Pipeline::receive(const sigset_t &sigmask)
+{
+	pthread_sigmask(SIG_SETMASK, &sigmask, nullptr);
+
+	for (uint64_t seq = 0; ; seq++) {
+		auto str = server.read();
+		auto batch = getBatch();
+
+		batch.seq = seq;
+		batch.nrMsgs = 0;
+		if (!str) {
+			batch.type = Batch::END;
+			raw.push(std::move(batch));
+			return;
+		}
+
+		if (str->empty()) {
+			batch.type = Batch::COMMIT;
+		} else {
+			batch.type = Batch::DATA;
+			batch.data.assign(str->begin(), str->end());
+			bump(received);
+			bump(bytes, str->size());
+		}
+
+		if (!raw.push(std::move(batch)))
+			return;
+	}
+}
+
+void Pipeline::decode()
+{
+	while (auto batch = raw.pop()) {
+		if (batch->type == Batch::DATA) {
+			auto &msgs = batch->msgs;
+			Packet::Reader reader(std::string_view(batch->data.data(),
+							       batch->data.size()));
+			while (auto rec = reader.next()) {
+				if (batch->nrMsgs == msgs.size())
+					msgs.emplace_back();
+				if (!msgs[batch->nrMsgs].deserialize(*rec)) {
+					std::cerr << "malformed message of size " << rec->size() << "\n";
+					continue;
+				}
+				batch->nrMsgs++;
+			}
+		}
+
+		if (!decoded.push(std::move(*batch)))
+			return;
+	}
+}
+
+bool Pipeline::commit()
+{
+	sqlConn.retryDeferred(false);
+	std::cerr << "commiting\n";
+	auto start = std::chrono::steady_clock::now();
+	if (!sqlConn.end() || !sqlConn.begin())
+		return false;
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	auto bucket = std::bit_width((uint64_t)ms);
+	bump(commitMs[std::min<size_t>(bucket, commit_buckets - 1)]);
+	bump(commits);
+
+	return true;
+}
+
+int Pipeline::write()
+{
+	/* decoders finish out of order */
+	std::map<uint64_t, Batch> reorder;
+	uint64_t next = 0;
+	/* messages written since the last commit */
+	uint64_t pending = 0;
+	auto lastCommit = std::chrono::steady_clock::now();
+	auto commitPending = [&]() {
+		if (!commit())
+			return false;
+		pending = 0;
+		lastCommit = std::chrono::steady_clock::now();
+		return true;
+	};
+
+	while (auto batch = decoded.pop()) {
+		reorder.emplace(batch->seq, std::move(*batch));
+		maxReorder = std::max(maxReorder, reorder.size());
+
+		while (!reorder.empty() && reorder.begin()->first == next) {
+			auto &cur = reorder.begin()->second;
+
+			switch (cur.type) {
+			case Batch::END:
+				return 0;
+			case Batch::COMMIT:
+				if (pending && !autocommit && !commitPending())
+					return -1;
+				break;
+			case Batch::DATA:
+				for (size_t i = 0; i < cur.nrMsgs; i++) {
+					//std::cerr << "===" << cur.msgs[i] << "\n";
+					sqlConn.handleMessage(cur.msgs[i]);
+					bump(kinds[cur.msgs[i].getKind() & 127]);
+				}
+				bump(messages, cur.nrMsgs);
+				pending += cur.nrMsgs;
+				if (autocommit || !pending)
+					break;
+
+				if ((commitRows && pending >= commitRows) ||
+				    (commitInterval.count() &&
+				     std::chrono::steady_clock::now() - lastCommit >= commitInterval)) {
+					if (!commitPending())
+						return -1;
+				}
+				break;
+			}
+
+			putBatch(std::move(cur));
+			reorder.erase(reorder.begin());
+			next++;
+		}
+	}
+
+	return 0;
+}
+
+int Pipeline::run(const sigset_t &sigmask)
+{
+	std::vector<std::thread> threads;
+
+	for (unsigned i = 0; i < decoders; i++)
+		threads.emplace_back(&Pipeline::decode, this);
+	threads.emplace_back(&Pipeline::receive, this, std::cref(sigmask));
+
+	auto ret = write();
+	if (ret < 0)
+		server.close();
+
+	raw.close();
+	decoded.close();
+	for (auto &t : threads)
+		t.join();
+
+	return ret;
+}
+
+Pipeline::Counters Pipeline::counters() const
+{
+	Counters c;
+
+	c.received = received.load(std::memory_order_relaxed);
+	c.bytes = bytes.load(std::memory_order_relaxed);
+	c.messages = messages.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < kinds.size(); i++)
+		c.kinds[i] = kinds[i].load(std::memory_order_relaxed);
+	c.commits = commits.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < commitMs.size(); i++)
+		c.commitMs[i] = commitMs[i].load(std::memory_order_relaxed);
+	c.rawDepth = raw.size();
+	c.decodedDepth = decoded.size();
+
+	return c;
+}
+
+void Pipeline::printStats(std::ostream &os) const
+{
+	auto print = [&os](const char *stage, const BoundedQueue<Batch>::Stats &s) {
+		os << stage << " queue: max " << s.maxSize << '/' << s.depth <<
+		      ", waited " << s.fullWaits << "x full, " << s.emptyWaits << "x empty\n";
+	};
+
+	os << "received " << received << " packets, " << messages << " messages\n";
+	print("receive", raw.stats());
+	print("decode", decoded.stats());
+	os << "reorder: max " << maxReorder << " batches\n";
+}
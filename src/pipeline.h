@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <signal.h>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "Message.h"
+
+namespace ClangStruct {
+
+class Server;
+class SQLConn;
+
+/*
+ * db_filler in three stages, so that the transport is drained while SQLite
+ * steps or commits:
+ *
+ *  receiver thread: copies packets from the Server into the raw queue
+ *  decoder threads: split packets and deserialize the messages
+ *  writer (the caller of run()): the only one touching SQLite
+ *
+ * Batches carry a sequence number assigned by the receiver and the writer
+ * reorders them, so the records are written in the order they were received.
+ * Full queues block the stage before them. Batches are recycled through a
+ * free queue, so that the buffers are not reallocated all the time.
+ */
+class Pipeline {
+public:
+	/* commit latencies by powers of 2 of milliseconds, the last is open */
+	static constexpr unsigned commit_buckets = 17;
+
+	/* a snapshot for Metrics, the counters are only approximately in sync */
+	struct Counters {
+		uint64_t received;
+		uint64_t bytes;
+		uint64_t messages;
+		/* by Message::KIND */
+		std::array<uint64_t, 128> kinds;
+		uint64_t commits;
+		std::array<uint64_t, commit_buckets> commitMs;
+		size_t rawDepth;
+		size_t decodedDepth;
+	};
+
+	/*
+	 * Unless @autocommit, the writer commits when the transport is idle,
+	 * after @commitRows messages, and @commitInterval seconds after the
+	 * last commit (0 disables either).
+	 */
+	Pipeline(Server &server, SQLConn &sqlConn, bool autocommit, unsigned decoders,
+		 size_t depth, uint64_t commitRows = 0, unsigned commitInterval = 0);
+
+	/* @sigmask is applied to the receiver thread only */
+	int run(const sigset_t &sigmask);
+
+	void printStats(std::ostream &os) const;
+	Counters counters() const;
+private:
+	/* counters are written by one thread only, so no atomic RMW is needed */
+	static void bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + n,
+			      std::memory_order_relaxed);
+	}
+
+	struct Batch {
+		enum TYPE {
+			DATA,
+			COMMIT,
+			END,
+		};
+
+		uint64_t seq;
+		TYPE type;
+		std::vector<char> data;
+		std::vector<Message<std::string_view>> msgs;
+		size_t nrMsgs;
+	};
+
+	void receive(const sigset_t &sigmask);
+	void decode();
+	int write();
+	bool commit();
+
+	Batch getBatch();
+	void putBatch(Batch &&batch);
+
+	Server &server;
+	SQLConn &sqlConn;
+	bool autocommit;
+	unsigned decoders;
+	uint64_t commitRows;
+	std::chrono::seconds commitInterval;
+
+	BoundedQueue<Batch> raw;
+	BoundedQueue<Batch> decoded;
+	BoundedQueue<Batch> spare;
+
+	std::atomic<uint64_t> received = 0;
+	std::atomic<uint64_t> bytes = 0;
+	std::atomic<uint64_t> messages = 0;
+	std::array<std::atomic<uint64_t>, 128> kinds {};
+	std::atomic<uint64_t> commits = 0;
+	std::array<std::atomic<uint64_t>, commit_buckets> commitMs {};
+	size_t maxReorder = 0;
+};
+
+}
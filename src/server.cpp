@@ -1,24 +1,32 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
+#include <sys/resource.h>
+
 #include "server.h"
 
 using namespace ClangStruct;
 
-const char Server::queue_name[] = "/db_filler";
+void Server::unlink()
+{
+	MQServer::unlink();
+	ShmServer::unlink();
+}
 
-Server::~Server()
+MQServer::~MQServer()
 {
 	close();
 }
 
-std::optional<std::string_view> Server::read()
+std::optional<std::string_view> MQServer::read()
 {
 	struct timespec timeout = {
-		.tv_sec = time(NULL) + 5,
+		.tv_sec = time(NULL) + idle_timeout,
 	};
 	auto rd = mq_timedreceive(mq, buf.get(), buf_len, NULL, &timeout);
 	if (rd < 0) {
@@ -32,83 +40,92 @@ std::optional<std::string_view> Server::read()
 	return std::string_view(buf.get(), rd);
 }
 
-void Server::close()
+void MQServer::close()
 {
 	stop = true;
-#if 0
-	if (sock >= 0) {
-		::close(sock);
-		sock = -1;
-	}
-#else
 	if (mq >= 0) {
 		mq_unlink(queue_name);
 		mq_close(mq);
 		mq = -1;
 	}
-#endif
 }
 
-void Server::unlink()
+std::optional<long> MQServer::queued() const
+{
+	mq_attr attr;
+
+	if (mq < 0 || mq_getattr(mq, &attr) < 0)
+		return std::nullopt;
+
+	return attr.mq_curmsgs;
+}
+
+void MQServer::unlink()
 {
 	mq_unlink(queue_name);
 }
 
-int Server::open()
+long MQServer::readMQLimit(const char *name)
 {
-#if 0
-	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-	if (sock < 0) {
-		std::cerr << "cannot create socket: " << strerror(errno) << "\n";
-		return -1;
-	}
+	std::ifstream f(std::string("/proc/sys/fs/mqueue/") + name);
+	long ret = 0;
 
-	int one = 1;
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
-		std::cerr << "cannot setsockopt: " << strerror(errno) << "\n";
-		return -1;
-	}
+	f >> ret;
+
+	return ret;
+}
 
-	struct sockaddr_un addr = {
-		.sun_family = AF_UNIX,
-		.sun_path = "db_filler",
+mqd_t MQServer::openMQ(long maxMsg, long msgSize)
+{
+	if (!maxMsg && !msgSize)
+		return mq_open(queue_name, O_CREAT | O_EXCL | O_RDONLY, 0600, NULL);
+
+	mq_attr attr = {
+		.mq_maxmsg = maxMsg ? maxMsg : readMQLimit("msg_default"),
+		.mq_msgsize = msgSize ? msgSize : readMQLimit("msgsize_default"),
 	};
 
-	int ret = bind(sock, (const struct sockaddr *)&addr, sizeof(addr));
-	if (ret < 0) {
-		std::cerr << "cannot bind: " << strerror(errno) << "\n";
-		return -1;
+	auto ret = mq_open(queue_name, O_CREAT | O_EXCL | O_RDONLY, 0600, &attr);
+	if (ret >= 0 || errno != EMFILE)
+		return ret;
+
+	/* RLIMIT_MSGQUEUE is too low, try to raise it up to the hard limit */
+	rlimit rlim;
+	if (getrlimit(RLIMIT_MSGQUEUE, &rlim) < 0)
+		return ret;
+
+	rlim_t need = attr.mq_maxmsg * (attr.mq_msgsize + 2 * sizeof(void *));
+	if (need <= rlim.rlim_cur || (rlim.rlim_max != RLIM_INFINITY && need > rlim.rlim_max)) {
+		errno = EMFILE;
+		return ret;
 	}
 
-	ret = listen(sock, 20);
-	if (ret < 0) {
-		std::cerr << "cannot listen: " << strerror(errno) << "\n";
-		return -1;
+	rlim.rlim_cur = need;
+	if (setrlimit(RLIMIT_MSGQUEUE, &rlim) < 0) {
+		errno = EMFILE;
+		return ret;
 	}
 
-	while (true) {
-		int data_socket = accept(sock, NULL, NULL);
-		if (data_socket < 0) {
-			std::cerr << "cannot listen: " << strerror(errno) << "\n";
-			return -1;
-		}
-
-		while (true) {
-			char buf[128];
-			ssize_t rd = ::read(data_socket, buf, sizeof(buf));
-			if (!rd)
-				break;
-			if (rd < 0) {
-				std::cerr << "bad read: " << strerror(errno) << "\n";
-				break;
-			}
-			write(STDOUT_FILENO, buf, rd);
-		}
-
-		::close(data_socket);
+	return mq_open(queue_name, O_CREAT | O_EXCL | O_RDONLY, 0600, &attr);
+}
+
+int MQServer::open()
+{
+	mq = openMQ(maxMsg, msgSize);
+	if (mq < 0 && errno == EINVAL) {
+		auto maxMsgLimit = readMQLimit("msg_max");
+		auto msgSizeLimit = readMQLimit("msgsize_max");
+		std::cerr << "cannot open msg queue with maxmsg=" << maxMsg <<
+			     " msgsize=" << msgSize << ", limits in /proc/sys/fs/mqueue are " <<
+			     "msg_max=" << maxMsgLimit << " msgsize_max=" << msgSizeLimit <<
+			     ", clamping\n";
+		mq = openMQ(std::min(maxMsg, maxMsgLimit), std::min(msgSize, msgSizeLimit));
+	}
+	if (mq < 0 && (errno == EINVAL || errno == EMFILE) && (maxMsg || msgSize)) {
+		std::cerr << "cannot open msg queue with requested attributes: " <<
+			     strerror(errno) << ", falling back to system defaults\n";
+		mq = openMQ(0, 0);
 	}
-#else
-	mq = mq_open(queue_name, O_CREAT | O_EXCL | O_RDONLY,  0600, NULL);
 	if (mq < 0) {
 		std::cerr << "cannot open msg queue: " << strerror(errno) << "\n";
 		return -1;
@@ -120,9 +137,12 @@ int Server::open()
 		return -1;
 	}
 
+	if ((maxMsg && attr.mq_maxmsg != maxMsg) || (msgSize && attr.mq_msgsize != msgSize))
+		std::cerr << "msg queue opened with maxmsg=" << attr.mq_maxmsg <<
+			     " msgsize=" << attr.mq_msgsize << "\n";
+
 	buf_len = attr.mq_msgsize;
 	buf = std::make_unique<char[]>(buf_len);
-#endif
 
 	return 0;
 }
@@ -2,37 +2,169 @@
 
 #pragma once
 
+#include <chrono>
 #include <csignal>
+#include <deque>
+#include <filesystem>
 #include <optional>
 #include <memory>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <mqueue.h>
 
+#include "ShmRing.h"
+#include "Socket.h"
+#include "Spill.h"
+
 namespace ClangStruct {
 
+/*
+ * read() returns a received packet, "" when idle for a while (so that the
+ * caller can commit), or std::nullopt when stopped or on error.
+ */
 class Server {
 public:
 	Server() {}
-	~Server();
+	virtual ~Server() {}
+
+	virtual int open() = 0;
+	virtual void close() = 0;
+
+	virtual std::optional<std::string_view> read() = 0;
+	/* messages waiting in the transport, if it can tell */
+	virtual std::optional<long> queued() const { return std::nullopt; }
+
+	/* remove names of all transports */
+	static void unlink();
+protected:
+	static constexpr unsigned idle_timeout = 5;
+
+	volatile std::sig_atomic_t stop = false;
+};
+
+class MQServer : public Server {
+public:
+	static constexpr char queue_name[] = "/db_filler";
 
-	int open();
-	void close();
+	/* 0 means the system default */
+	MQServer(long maxMsg = 0, long msgSize = 0) : maxMsg(maxMsg), msgSize(msgSize) {}
+	~MQServer();
+
+	virtual int open() override;
+	virtual void close() override;
 
 	static void unlink();
 
-	std::optional<std::string_view> read();
+	virtual std::optional<std::string_view> read() override;
+	virtual std::optional<long> queued() const override;
 private:
-#if 0
-	int sock = -1;
-#else
+	static long readMQLimit(const char *name);
+	mqd_t openMQ(long maxMsg, long msgSize);
+
 	mqd_t mq = -1;
-#endif
+	long maxMsg;
+	long msgSize;
 	std::unique_ptr<char[]> buf;
 	unsigned buf_len;
-	volatile std::sig_atomic_t stop;
+};
+
+class ShmServer : public Server {
+public:
+	ShmServer(unsigned nrRings, uint64_t ringSize) : nrRings(nrRings), ringSize(ringSize) {}
+	~ShmServer();
+
+	virtual int open() override;
+	virtual void close() override;
+
+	static void unlink() { ShmRing::unlink(); }
+
+	virtual std::optional<std::string_view> read() override;
+private:
+	std::optional<std::string_view> next();
+
+	unsigned nrRings;
+	uint64_t ringSize;
+	ShmRing shm;
+	unsigned cur = 0;
+	std::optional<std::pair<unsigned, std::string_view>> pending;
+};
+
+/*
+ * Serves many stream clients from one epoll loop. Commits are requested by
+ * a timerfd and returned at the next end of a TU. SIGINT/SIGTERM are
+ * received by a signalfd, so they have to be blocked by the caller. close()
+ * wakes read() by an eventfd.
+ */
+class SocketServer : public Server {
+public:
+	SocketServer(unsigned commitInterval) : commitInterval(commitInterval) {}
+	~SocketServer();
+
+	virtual int open() override;
+	virtual void close() override;
+
+	virtual std::optional<std::string_view> read() override;
+private:
+	struct Client {
+		Client(int fd) : fd(fd) {}
+
+		int fd;
+		std::vector<char> buf;
+		size_t start = 0;
+		size_t end = 0;
+		bool inTU = false;
+		bool eof = false;
+		bool queued = false;
+	};
+
+	int addFd(int fd);
+	void accept();
+	void handleSignal();
+	void handleTimer();
+	bool fill(Client &client);
+	std::optional<std::string_view> frame(Client &client);
+	void drop(Client &client);
+
+	unsigned commitInterval;
+	int epoll = -1;
+	int sock = -1;
+	int sigFd = -1;
+	int timerFd = -1;
+	/* wakes up read() when closed */
+	int wakeFd = -1;
+	std::unordered_map<int, std::unique_ptr<Client>> clients;
+	std::deque<Client *> ready;
+	Client *current = nullptr;
+	unsigned commitTicks = 0;
+	bool stopping = false;
+};
+
+/*
+ * Wraps the transport and feeds in the spill files of producers (see
+ * SpillFile) once the transport caught up: when it is idle or its queue is
+ * empty. When stopped, the finished files are ingested before the end is
+ * reported.
+ */
+class SpillServer : public Server {
+public:
+	SpillServer(std::unique_ptr<Server> server, std::filesystem::path dir) :
+		server(std::move(server)), spill(std::move(dir)) {}
+
+	virtual int open() override;
+	virtual void close() override { server->close(); }
+
+	virtual std::optional<std::string_view> read() override;
+	virtual std::optional<long> queued() const override { return server->queued(); }
+private:
+	static constexpr std::chrono::seconds scan_interval { 1 };
 
-	static const char queue_name[];
+	std::unique_ptr<Server> server;
+	SpillDir spill;
+	bool draining = false;
+	bool stopped = false;
+	std::chrono::steady_clock::time_point lastScan;
 };
 
 }
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "server.h"
+
+using namespace ClangStruct;
+
+ShmServer::~ShmServer()
+{
+	close();
+	if (shm.isMapped())
+		ShmRing::unlink();
+}
+
+int ShmServer::open()
+{
+	if (shm.create(nrRings, ringSize) < 0) {
+		std::cerr << "cannot create shared memory " << ShmRing::shm_name << ": " <<
+			     strerror(errno) << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+void ShmServer::close()
+{
+	stop = true;
+	shm.wakeConsumer();
+}
+
+std::optional<std::string_view> ShmServer::next()
+{
+	auto nr = shm.nrRings();
+
+	for (unsigned n = 0; n < nr; n++) {
+		auto idx = (cur + n) % nr;
+		if (auto rec = shm.peek(idx)) {
+			cur = (idx + 1) % nr;
+			pending.emplace(idx, *rec);
+			return rec;
+		}
+	}
+
+	return std::nullopt;
+}
+
+std::optional<std::string_view> ShmServer::read()
+{
+	/* the previous record was processed by now, give the space back */
+	if (pending) {
+		shm.pop(pending->first, pending->second);
+		pending.reset();
+	}
+
+	auto hdr = shm.header();
+	time_t lastReap = 0;
+
+	while (!stop) {
+		if (auto rec = next())
+			return rec;
+
+		/* all rings are drained, free those of crashed producers */
+		auto now = time(nullptr);
+		if (now != lastReap) {
+			for (unsigned idx = 0; idx < shm.nrRings(); idx++)
+				if (shm.reap(idx))
+					std::cerr << "freed ring " << idx << " of a dead producer\n";
+			lastReap = now;
+		}
+
+		hdr->sleeping.store(1);
+		auto seq = hdr->doorbell.load();
+		if (auto rec = next()) {
+			hdr->sleeping.store(0);
+			return rec;
+		}
+
+		struct timespec timeout = {
+			.tv_sec = idle_timeout,
+			.tv_nsec = 0,
+		};
+		auto ret = ShmRing::futexWait(hdr->doorbell, seq, &timeout);
+		auto err = errno;
+		hdr->sleeping.store(0);
+		if (ret < 0 && err == ETIMEDOUT)
+			return "";
+	}
+
+	return std::nullopt;
+}
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "server.h"
+
+using namespace ClangStruct;
+
+namespace {
+
+constexpr size_t read_chunk = 1 << 20;
+
+}
+
+SocketServer::~SocketServer()
+{
+	close();
+	for (auto &c : clients)
+		::close(c.first);
+	for (auto fd : { sock, sigFd, timerFd, wakeFd, epoll })
+		if (fd >= 0)
+			::close(fd);
+}
+
+int SocketServer::addFd(int fd)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data = { .fd = fd },
+	};
+
+	if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		std::cerr << "cannot add to epoll: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+int SocketServer::open()
+{
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll < 0) {
+		std::cerr << "cannot create epoll: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		std::cerr << "cannot block signals: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sigFd < 0) {
+		std::cerr << "cannot create signalfd: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerFd < 0) {
+		std::cerr << "cannot create timerfd: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = commitInterval, .tv_nsec = 0 },
+		.it_value = { .tv_sec = commitInterval, .tv_nsec = 0 },
+	};
+	if (timerfd_settime(timerFd, 0, &its, NULL) < 0) {
+		std::cerr << "cannot set timerfd: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd < 0) {
+		std::cerr << "cannot create eventfd: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		std::cerr << "cannot create socket: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	auto addrLen = Socket::fillAddr(addr);
+	if (bind(sock, (const struct sockaddr *)&addr, addrLen) < 0) {
+		std::cerr << "cannot bind: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	if (listen(sock, SOMAXCONN) < 0) {
+		std::cerr << "cannot listen: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	if (addFd(sock) < 0 || addFd(sigFd) < 0 || addFd(timerFd) < 0 ||
+	    addFd(wakeFd) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* called from other threads and signal handlers, read() owns the fds */
+void SocketServer::close()
+{
+	stop = true;
+	if (wakeFd >= 0)
+		eventfd_write(wakeFd, 1);
+}
+
+void SocketServer::accept()
+{
+	while (true) {
+		int fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				std::cerr << "cannot accept: " << strerror(errno) << "\n";
+			return;
+		}
+
+		if (addFd(fd) < 0) {
+			::close(fd);
+			continue;
+		}
+
+		clients.emplace(fd, std::make_unique<Client>(fd));
+	}
+}
+
+void SocketServer::handleSignal()
+{
+	struct signalfd_siginfo si;
+
+	while (::read(sigFd, &si, sizeof(si)) == sizeof(si)) {
+		if (stopping) {
+			stop = true;
+			return;
+		}
+
+		/* finish what the connected clients send, but accept no more */
+		stopping = true;
+		epoll_ctl(epoll, EPOLL_CTL_DEL, sock, NULL);
+		::close(sock);
+		sock = -1;
+	}
+}
+
+void SocketServer::handleTimer()
+{
+	uint64_t expirations;
+
+	if (::read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations))
+		commitTicks++;
+}
+
+bool SocketServer::fill(Client &c)
+{
+	/* nothing points to the buffer now, move the unparsed rest to the front */
+	if (c.start) {
+		memmove(c.buf.data(), c.buf.data() + c.start, c.end - c.start);
+		c.end -= c.start;
+		c.start = 0;
+	}
+
+	while (true) {
+		size_t need = read_chunk;
+		Socket::flen len;
+		if (c.end >= sizeof(len)) {
+			memcpy(&len, c.buf.data(), sizeof(len));
+			if (len > Socket::max_frame) {
+				std::cerr << "frame too long (" << len << "), dropping client\n";
+				c.eof = true;
+				c.end = 0;
+				return true;
+			}
+			need = std::max(need, sizeof(len) + len);
+		}
+		if (c.buf.size() < need)
+			c.buf.resize(need);
+		if (c.end == c.buf.size())
+			return true;
+
+		auto rd = ::read(c.fd, c.buf.data() + c.end, c.buf.size() - c.end);
+		if (rd > 0) {
+			c.end += rd;
+			continue;
+		}
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd < 0 && errno == EAGAIN)
+			break;
+		if (rd < 0)
+			std::cerr << "cannot read: " << strerror(errno) << "\n";
+		c.eof = true;
+		break;
+	}
+
+	return c.end > c.start || c.eof;
+}
+
+std::optional<std::string_view> SocketServer::frame(Client &c)
+{
+	Socket::flen len;
+
+	if (c.end - c.start < sizeof(len))
+		return std::nullopt;
+
+	memcpy(&len, c.buf.data() + c.start, sizeof(len));
+	if (c.end - c.start - sizeof(len) < len)
+		return std::nullopt;
+
+	std::string_view ret(c.buf.data() + c.start + sizeof(len), len);
+	c.start += sizeof(len) + len;
+
+	return ret;
+}
+
+void SocketServer::drop(Client &c)
+{
+	if (c.inTU)
+		std::cerr << "client disconnected in the middle of a TU\n";
+
+	epoll_ctl(epoll, EPOLL_CTL_DEL, c.fd, NULL);
+	::close(c.fd);
+	clients.erase(c.fd);
+}
+
+std::optional<std::string_view> SocketServer::read()
+{
+	std::array<struct epoll_event, 64> events;
+
+	while (!stop) {
+		while (!ready.empty()) {
+			auto &client = *ready.front();
+			auto f = frame(client);
+			if (!f) {
+				ready.pop_front();
+				client.queued = false;
+				if (client.eof)
+					drop(client);
+				continue;
+			}
+
+			if (!f->empty()) {
+				client.inTU = true;
+				return f;
+			}
+
+			/* end of TU, a good time to commit if it is due */
+			client.inTU = false;
+			if (commitTicks) {
+				commitTicks = 0;
+				return "";
+			}
+		}
+
+		if (stopping && clients.empty())
+			break;
+
+		/*
+		 * Commit when due and no TU is in flight. Do not wait for the end
+		 * of a TU longer than another tick though.
+		 */
+		if (commitTicks) {
+			bool inTU = false;
+			for (auto &c : clients)
+				inTU |= c.second->inTU;
+			if (!inTU || commitTicks > 1) {
+				commitTicks = 0;
+				return "";
+			}
+		}
+
+		int n = epoll_wait(epoll, events.data(), events.size(), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			std::cerr << "cannot epoll_wait: " << strerror(errno) << "\n";
+			return std::nullopt;
+		}
+
+		for (int i = 0; i < n; i++) {
+			auto fd = events[i].data.fd;
+			if (fd == sock) {
+				accept();
+			} else if (fd == sigFd) {
+				handleSignal();
+			} else if (fd == timerFd) {
+				handleTimer();
+			} else if (fd == wakeFd) {
+				/* close(), stop is set */
+			} else {
+				auto it = clients.find(fd);
+				if (it == clients.end())
+					continue;
+				auto &client = *it->second;
+				if (fill(client) && !client.queued) {
+					client.queued = true;
+					ready.push_back(&client);
+				}
+			}
+		}
+	}
+
+	return std::nullopt;
+}
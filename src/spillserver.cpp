@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "server.h"
+
+using namespace ClangStruct;
+
+int SpillDir::create()
+{
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if (ec) {
+		errno = ec.value();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* consumed files are removed, so the directory holds exactly the pending ones */
+size_t SpillDir::scan()
+{
+	std::error_code ec;
+	std::vector<std::filesystem::path> found;
+
+	for (const auto &e : std::filesystem::directory_iterator(dir, ec)) {
+		const auto &path = e.path();
+		if (path.filename().string().ends_with(SpillFile::suffix) && path != curPath)
+			found.push_back(path);
+	}
+
+	std::sort(found.begin(), found.end());
+	files.assign(std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+
+	return files.size();
+}
+
+void SpillDir::closeCur()
+{
+	if (data)
+		munmap(const_cast<char *>(data), len);
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	data = nullptr;
+	len = off = 0;
+	curPath.clear();
+}
+
+/* files still locked by their producers stay queued */
+bool SpillDir::openNext()
+{
+	for (auto it = files.begin(); it != files.end(); ) {
+		fd = ::open(it->c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			std::cerr << "cannot open " << *it << ": " << strerror(errno) << "\n";
+			it = files.erase(it);
+			continue;
+		}
+		if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+			closeCur();
+			++it;
+			continue;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			std::cerr << "cannot stat " << *it << ": " << strerror(errno) << "\n";
+			closeCur();
+			it = files.erase(it);
+			continue;
+		}
+
+		len = st.st_size;
+		if (len) {
+			auto mem = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mem == MAP_FAILED) {
+				std::cerr << "cannot map " << *it << ": " << strerror(errno) << "\n";
+				closeCur();
+				it = files.erase(it);
+				continue;
+			}
+			madvise(mem, len, MADV_SEQUENTIAL);
+			data = static_cast<const char *>(mem);
+		}
+
+		curPath = std::move(*it);
+		files.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * A consumed file is removed right away, its records are committed with the
+ * rest of the transaction.
+ */
+std::optional<std::string_view> SpillDir::next()
+{
+	while (true) {
+		if (fd >= 0) {
+			SpillFile::rlen rl;
+			if (len - off >= sizeof(rl)) {
+				memcpy(&rl, data + off, sizeof(rl));
+				if (len - off - sizeof(rl) >= rl) {
+					std::string_view ret(data + off + sizeof(rl), rl);
+					off += sizeof(rl) + rl;
+					return ret;
+				}
+			}
+			if (off < len)
+				std::cerr << curPath << ": dropping a truncated packet of " <<
+					     len - off << " bytes\n";
+
+			if (::unlink(curPath.c_str()) < 0)
+				std::cerr << "cannot remove " << curPath << ": " << strerror(errno) << "\n";
+			closeCur();
+			nrIngested++;
+		}
+
+		if (!openNext())
+			return std::nullopt;
+	}
+}
+
+int SpillServer::open()
+{
+	if (spill.create() < 0) {
+		std::cerr << "cannot create spill directory: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	return server->open();
+}
+
+std::optional<std::string_view> SpillServer::read()
+{
+	if (draining) {
+		if (auto packet = spill.next())
+			return packet;
+		draining = false;
+	}
+
+	if (stopped) {
+		if (spill.ingested())
+			std::cerr << "ingested " << spill.ingested() << " spill files\n";
+		if (spill.pending())
+			std::cerr << spill.pending() << " spill files are still being written, " <<
+				     "left for the next run\n";
+		return std::nullopt;
+	}
+
+	auto ret = server->read();
+	if (!ret) {
+		/* the finished files before the end */
+		stopped = true;
+		spill.scan();
+		draining = true;
+		return read();
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (ret->empty() || (now - lastScan >= scan_interval && server->queued() == 0)) {
+		lastScan = now;
+		draining = spill.scan();
+	}
+
+	return ret;
+}
@@ -1,18 +1,149 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
-#include <charconv>
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 
 #include "sqlconn.h"
 
 using namespace ClangStruct;
 
+namespace {
+
+const SlSqlite::SQLConn::Triggers useTriggers {
+	{ "TRIG_use_A_INS AFTER INSERT ON use", "UPDATE member SET uses = uses+1, "
+		"loads = loads + (NEW.load IS 1), "
+		"stores = stores + (NEW.load IS 0), "
+		"implicit_uses = implicit_uses + (NEW.implicit == 1) "
+		"WHERE id = NEW.member" },
+	/* uses of a reindexed source are deleted by ON DELETE CASCADE */
+	{ "TRIG_use_A_DEL AFTER DELETE ON use", "UPDATE member SET uses = uses-1, "
+		"loads = loads - (OLD.load IS 1), "
+		"stores = stores - (OLD.load IS 0), "
+		"implicit_uses = implicit_uses - (OLD.implicit == 1) "
+		"WHERE id = OLD.member" },
+};
+
+struct Pragma {
+	std::string_view name;
+	std::string SQLConn::Options::*field;
+	/* set in createDB(), before any table */
+	bool onCreate;
+};
+
+/* in the order they are set */
+const Pragma pragmas[] {
+	{ "page_size", &SQLConn::Options::pageSize, true },
+	{ "auto_vacuum", &SQLConn::Options::autoVacuum, true },
+	{ "journal_mode", &SQLConn::Options::journalMode, false },
+	{ "synchronous", &SQLConn::Options::synchronous, false },
+	{ "cache_size", &SQLConn::Options::cacheSize, false },
+	{ "mmap_size", &SQLConn::Options::mmapSize, false },
+	{ "temp_store", &SQLConn::Options::tempStore, false },
+};
+
+}
+
+bool SQLConn::Options::parse(std::string_view spec)
+{
+	while (!spec.empty()) {
+		/* -analyzer-config splits at commas itself */
+		auto sep = spec.find_first_of(",;");
+		auto item = spec.substr(0, sep);
+		spec = sep == spec.npos ? std::string_view() : spec.substr(sep + 1);
+
+		auto eq = item.find('=');
+		if (eq == item.npos) {
+			std::cerr << "bad pragma, expected name=value: " << item << "\n";
+			return false;
+		}
+
+		auto name = item.substr(0, eq);
+		auto it = std::find_if(std::begin(pragmas), std::end(pragmas),
+				       [name](const auto &p) { return p.name == name; });
+		if (it == std::end(pragmas)) {
+			std::cerr << "unsupported pragma: " << name << "\n";
+			return false;
+		}
+
+		this->*it->field = item.substr(eq + 1);
+	}
+
+	return true;
+}
+
+bool SQLConn::open(const std::filesystem::path &dbFile, bool bulk, const Options &opts) noexcept
+{
+	this->bulk = bulk;
+	this->opts = opts;
+
+	if (!SlSqlite::SQLConn::open(dbFile, SlSqlite::CREATE))
+		return false;
+
+	/*
+	 * Not in createDB(), it may run in a transaction: journal_mode is
+	 * ignored there and synchronous fails.
+	 */
+	return setPragmas(false);
+}
+
+bool SQLConn::setPragmas(bool onCreate)
+{
+	for (const auto &[name, field, create] : pragmas) {
+		const auto &val = opts.*field;
+		if (create != onCreate || val.empty())
+			continue;
+
+		/* it goes to SQL as is */
+		if (!std::all_of(val.begin(), val.end(),
+				 [](char c) { return std::isalnum((unsigned char)c) || c == '-'; })) {
+			std::cerr << "bad value of pragma " << name << ": " << val << "\n";
+			return false;
+		}
+
+		std::string err;
+		if (!exec("PRAGMA " + std::string(name) + " = " + val + ";", &err)) {
+			std::cerr << "cannot set pragma " << name << ": " << err << "\n";
+			return false;
+		}
+	}
+
+	return onCreate || checkJournalMode();
+}
+
+/* a journal_mode which cannot be set is not an error to SQLite */
+bool SQLConn::checkJournalMode()
+{
+	if (opts.journalMode.empty())
+		return true;
+
+	SlSqlite::SQLStmtHolder sel;
+	if (!prepareStatements({ { sel, "PRAGMA journal_mode;" } }))
+		return false;
+
+	std::string mode;
+	if (sqlite3_step(sel.get()) == SQLITE_ROW)
+		if (auto str = sqlite3_column_text(sel.get(), 0))
+			mode = reinterpret_cast<const char *>(str);
+
+	if (!std::equal(mode.begin(), mode.end(), opts.journalMode.begin(), opts.journalMode.end(),
+			[](char a, char b) { return std::tolower((unsigned char)a) ==
+					std::tolower((unsigned char)b); })) {
+		std::cerr << "cannot set journal_mode to " << opts.journalMode <<
+			     ", it is " << mode << "\n";
+		return false;
+	}
+
+	return true;
+}
+
 bool SQLConn::createDB()
 {
 	static const Tables tables {
 		{ "source", {
 			"id INTEGER PRIMARY KEY",
 			"src TEXT NOT NULL UNIQUE",
+			"hash TEXT",
 		}},
 		{ "struct", {
 			"id INTEGER PRIMARY KEY",
@@ -53,14 +184,71 @@ bool SQLConn::createDB()
 			"UNIQUE(member, src, begLine)",
 			"CHECK(endLine >= begLine)",
 		}},
+		/* files (including itself) a TU was built from */
+		{ "tu_dep", {
+			"tu INTEGER NOT NULL REFERENCES source(id) ON DELETE CASCADE",
+			"dep INTEGER NOT NULL REFERENCES source(id) ON DELETE CASCADE",
+			"UNIQUE(tu, dep)",
+		}},
+		/* run_commands.pl has its own run table */
+		{ "filler_run", {
+			"id INTEGER PRIMARY KEY",
+			"start TEXT NOT NULL DEFAULT CURRENT_TIMESTAMP",
+		}},
+		/* indexing cost of a TU, times in microseconds, max_rss in kB */
+		{ "tu_stats", {
+			"id INTEGER PRIMARY KEY",
+			"run INTEGER NOT NULL REFERENCES filler_run(id) ON DELETE CASCADE",
+			"tu INTEGER NOT NULL REFERENCES source(id) ON DELETE CASCADE",
+			"wall_us INTEGER NOT NULL",
+			"match_us INTEGER NOT NULL",
+			"structs INTEGER NOT NULL",
+			"members INTEGER NOT NULL",
+			"uses INTEGER NOT NULL",
+			"bytes INTEGER",
+			"max_rss INTEGER",
+		}},
+		/*
+		 * Summaries, filled by refreshSummaries(). Names are copied, so
+		 * that listings are index range scans without joins.
+		 */
+		{ "unused_member", {
+			"member INTEGER PRIMARY KEY REFERENCES member(id) ON DELETE CASCADE",
+			"struct INTEGER NOT NULL REFERENCES struct(id) ON DELETE CASCADE",
+			"src INTEGER NOT NULL REFERENCES source(id) ON DELETE CASCADE",
+			"struct_name TEXT NOT NULL",
+			"member_name TEXT NOT NULL",
+			"begLine INTEGER NOT NULL, begCol INTEGER NOT NULL",
+			/* 0: unused, otherwise used only implicitly */
+			"uses INTEGER NOT NULL",
+		}},
+		{ "struct_summary", {
+			"struct INTEGER PRIMARY KEY REFERENCES struct(id) ON DELETE CASCADE",
+			"name TEXT NOT NULL",
+			"src INTEGER NOT NULL REFERENCES source(id) ON DELETE CASCADE",
+			"members INTEGER NOT NULL",
+			"used INTEGER NOT NULL",
+			"unused INTEGER NOT NULL",
+			"implicit_only INTEGER NOT NULL",
+		}},
+		{ "source_summary", {
+			"src INTEGER PRIMARY KEY REFERENCES source(id) ON DELETE CASCADE",
+			"structs INTEGER NOT NULL",
+			"members INTEGER NOT NULL",
+			"unused INTEGER NOT NULL",
+			"uses INTEGER NOT NULL",
+		}},
 	};
 
-	static const Triggers triggers {
-		{ "TRIG_use_A_INS AFTER INSERT ON use", "UPDATE member SET uses = uses+1, "
-			"loads = loads + (NEW.load IS 1), "
-			"stores = stores + (NEW.load IS 0), "
-			"implicit_uses = implicit_uses + (NEW.implicit == 1) "
-			"WHERE id = NEW.member" },
+	static const Indices indices {
+		{ "IDX_unused_member_uses", "unused_member(uses, struct_name, begLine, member_name)" },
+		{ "IDX_unused_member_struct", "unused_member(struct_name, begLine, member_name)" },
+		{ "IDX_unused_member_src", "unused_member(src, begLine)" },
+		{ "IDX_struct_summary_name", "struct_summary(name, src)" },
+		{ "IDX_struct_summary_unused", "struct_summary(unused, name)" },
+		{ "IDX_source_summary_unused", "source_summary(unused, src)" },
+		/* cs-highlight walks uses by source */
+		{ "IDX_use_src", "use(src, begLine, begCol)" },
 	};
 
 	static const Views views {
@@ -103,9 +291,49 @@ bool SQLConn::createDB()
 				"AND struct.name != '<anonymous>' AND struct.name != '<unnamed>' "
 				"AND member.name != '<unnamed>'"
 		},
+		{ "unused_member_view",
+			"SELECT unused_member.member AS id, struct_name AS struct, "
+				"member_name AS member, source.src, begLine, begCol, uses "
+			"FROM unused_member LEFT JOIN source ON unused_member.src=source.id"
+		},
+		{ "tu_stats_view",
+			"SELECT tu_stats.id, run, filler_run.start, source.src AS tu, wall_us, match_us, "
+				"structs, members, uses, bytes, max_rss "
+			"FROM tu_stats "
+			"LEFT JOIN filler_run ON tu_stats.run=filler_run.id "
+			"LEFT JOIN source ON tu_stats.tu=source.id"
+		},
 	};
 
-	return createTables(tables) && createTriggers(triggers) && createViews(views);
+	/* raw records as received, sources are resolved already */
+	static const Tables bulkTables {
+		{ "bulk_struct", {
+			"type TEXT, name TEXT, attrs TEXT, packed INTEGER, inMacro INTEGER",
+			"src INTEGER",
+			"begLine INTEGER, begCol INTEGER, endLine INTEGER, endCol INTEGER",
+		}},
+		{ "bulk_member", {
+			"name TEXT, struct TEXT, src INTEGER",
+			"strBegLine INTEGER, strBegCol INTEGER",
+			"begLine INTEGER, begCol INTEGER, endLine INTEGER, endCol INTEGER",
+		}},
+		{ "bulk_use", {
+			"member TEXT, struct TEXT, strSrc INTEGER",
+			"strLine INTEGER, strCol INTEGER, use_src INTEGER",
+			"load INTEGER, implicit INTEGER",
+			"begLine INTEGER, begCol INTEGER, endLine INTEGER, endCol INTEGER",
+		}},
+	};
+
+	/* before any table, so that page_size and auto_vacuum apply to new files */
+	if (!setPragmas(true))
+		return false;
+
+	if (bulk && !createTables(bulkTables))
+		return false;
+
+	return createTables(tables) && createIndices(indices) && createTriggers(useTriggers) &&
+		createViews(views);
 }
 
 bool SQLConn::prepDB()
@@ -114,102 +342,672 @@ bool SQLConn::prepDB()
 		{ insSrc, "INSERT INTO source(src) VALUES (:src);" },
 		{ insStr, "INSERT INTO "
 				"struct(type, name, attrs, packed, inMacro, src, begLine, begCol, endLine, endCol) "
-				"VALUES (:type, :name, :attrs, :packed, :inMacro, "
-				"(SELECT id FROM source WHERE src=:src), "
+				"VALUES (:type, :name, :attrs, :packed, :inMacro, :src, "
 				":begLine, :begCol, :endLine, :endCol);" },
 		{ insMem, "INSERT INTO "
 				"member(name, struct, begLine, begCol, endLine, endCol) "
-				"VALUES (:name, "
-				"(SELECT id "
-				  "FROM struct "
-				  "WHERE src = (SELECT id FROM source WHERE src = :src) AND "
-				  "begLine = :strBegLine AND begCol = :strBegCol AND "
-				  "name = :struct), "
-				":begLine, :begCol, :endLine, :endCol);" },
+				"VALUES (:name, :struct, :begLine, :begCol, :endLine, :endCol);" },
 		{ insUse, "INSERT INTO "
 				"use(member, src, begLine, begCol, endLine, endCol, load, implicit) "
-				"VALUES ("
-				  "(SELECT id FROM member "
-				    "WHERE name = :member AND "
-				    "struct = (SELECT id FROM struct "
-					"WHERE name = :struct AND begLine = :strLine AND "
-					"begCol = :strCol AND "
-					"src = (SELECT id FROM source WHERE src = :strSrc))), "
-				  "(SELECT id FROM source WHERE src = :use_src), "
-				":begLine, :begCol, :endLine, :endCol, :load, :implicit);" },
+				"VALUES (:member, :src, :begLine, :begCol, :endLine, :endCol, "
+				":load, :implicit);" },
+		{ updSrcHash, "UPDATE source SET hash = :hash WHERE id = :id;" },
+		{ insDep, "INSERT OR IGNORE INTO tu_dep(tu, dep) VALUES (:tu, :dep);" },
+		{ insRun, "INSERT INTO filler_run DEFAULT VALUES;" },
+		{ insStats, "INSERT INTO "
+				"tu_stats(run, tu, wall_us, match_us, structs, members, uses, "
+				"bytes, max_rss) "
+				"VALUES (:run, :tu, :wall_us, :match_us, :structs, :members, :uses, "
+				":bytes, :max_rss);" },
+		{ selSrc, "SELECT id FROM source WHERE src = :src;" },
+		{ selStr, "SELECT id FROM struct "
+				"WHERE name = :name AND src = :src AND "
+				"begLine = :begLine AND begCol = :begCol;" },
+		{ selMem, "SELECT id FROM member WHERE struct = :struct AND name = :name;" },
+		{ selMemLoc, "SELECT id FROM member "
+				"WHERE struct = :struct AND name = :name AND "
+				"begLine = :begLine AND begCol = :begCol;" },
+	};
+	const Statements bulkStmts {
+		{ insBulkStr, "INSERT INTO "
+				"bulk_struct(type, name, attrs, packed, inMacro, src, "
+				"begLine, begCol, endLine, endCol) "
+				"VALUES (:type, :name, :attrs, :packed, :inMacro, :src, "
+				":begLine, :begCol, :endLine, :endCol);" },
+		{ insBulkMem, "INSERT INTO "
+				"bulk_member(name, struct, src, strBegLine, strBegCol, "
+				"begLine, begCol, endLine, endCol) "
+				"VALUES (:name, :struct, :src, :strBegLine, :strBegCol, "
+				":begLine, :begCol, :endLine, :endCol);" },
+		{ insBulkUse, "INSERT INTO "
+				"bulk_use(member, struct, strSrc, strLine, strCol, use_src, "
+				"load, implicit, begLine, begCol, endLine, endCol) "
+				"VALUES (:member, :struct, :strSrc, :strLine, :strCol, :use_src, "
+				":load, :implicit, :begLine, :begCol, :endLine, :endCol);" },
 	};
-	return prepareStatements(stmts);
+
+	if (!prepareStatements(stmts) ||
+			!prepareParams<Record::Struct>(insStr, insStrParams, { "src" }) ||
+			!prepareParams<Record::Member>(insMem, insMemParams,
+					{ "struct", "src", "strBegLine", "strBegCol" }) ||
+			!prepareParams<Record::Use>(insUse, insUseParams,
+					{ "member", "struct", "strSrc", "strLine", "strCol", "use_src" }) ||
+			!prepareParams<Record::Stats>(insStats, insStatsParams, { "tu" }))
+		return false;
+
+	if (!bulk)
+		return true;
+
+	return prepareStatements(bulkStmts) &&
+		prepareParams<Record::Struct>(insBulkStr, insBulkStrParams, { "src" }) &&
+		prepareParams<Record::Member>(insBulkMem, insBulkMemParams, { "src" }) &&
+		prepareParams<Record::Use>(insBulkUse, insBulkUseParams, { "strSrc", "use_src" });
 }
 
-template <typename T>
-int SQLConn::bindAndStep(SlSqlite::SQLStmtHolder &ins, const Message<T> &msg)
+/*
+ * Do what the row-by-row inserts do, but set-based: the first of duplicate
+ * records wins (hence ORDER BY rowid), records referring to unknown structs
+ * or members are dropped, and the use counters are computed at once with
+ * the trigger dropped.
+ */
+bool SQLConn::finalizeBulk()
 {
-	using Msg = Message<T>;
-	SlSqlite::SQLStmtResetter insSrcResetter(ins);
-
-	for (auto e: msg) {
-		const auto [type, key, val] = e;
-
-		std::string bindKey(":");
-		bindKey.append(key);
-
-		bool ret;
-		if (type == Msg::TYPE::TEXT) {
-			ret = bind(ins, bindKey, val, true);
-		} else if (type == Msg::TYPE::INT) {
-			auto end = val.data() + val.size();
-			int i;
-			auto res = std::from_chars(val.data(), end, i);
-			if (res.ptr != end) {
-				std::cerr << "bad int val=\"" << val << "\"\n";
-				return -1;
-			}
-			ret = bind(ins, bindKey, i);
-		} else if (type == Msg::TYPE::NUL) {
-			ret = bind(ins, bindKey, std::monostate());
-		} else {
-			std::cerr << "bad type: " << msg << "\n";
-			abort();
+	static const std::vector<std::string> finalize {
+		"INSERT OR IGNORE INTO "
+			"struct(type, name, attrs, packed, inMacro, src, "
+			"begLine, begCol, endLine, endCol) "
+			"SELECT type, name, attrs, packed, inMacro, src, "
+			"begLine, begCol, endLine, endCol "
+			"FROM bulk_struct ORDER BY rowid;",
+		"INSERT OR IGNORE INTO "
+			"member(name, struct, begLine, begCol, endLine, endCol) "
+			"SELECT m.name, s.id, m.begLine, m.begCol, m.endLine, m.endCol "
+			"FROM bulk_member AS m "
+			"JOIN struct AS s ON s.name = m.struct AND s.src = m.src AND "
+				"s.begLine = m.strBegLine AND s.begCol = m.strBegCol "
+			"ORDER BY m.rowid;",
+		"DROP TRIGGER IF EXISTS TRIG_use_A_INS;",
+		"INSERT OR IGNORE INTO "
+			"use(member, src, begLine, begCol, endLine, endCol, load, implicit) "
+			"SELECT mid, use_src, begLine, begCol, endLine, endCol, load, implicit "
+			"FROM (SELECT u.rowid AS rid, u.*, "
+				"(SELECT min(m.id) FROM member AS m "
+					"WHERE m.struct = s.id AND m.name = u.member) AS mid "
+				"FROM bulk_use AS u "
+				"JOIN struct AS s ON s.name = u.struct AND s.src = u.strSrc AND "
+					"s.begLine = u.strLine AND s.begCol = u.strCol) "
+			"WHERE mid IS NOT NULL ORDER BY rid;",
+		"UPDATE member SET uses = agg.uses, loads = agg.loads, stores = agg.stores, "
+			"implicit_uses = agg.implicit_uses "
+			"FROM (SELECT member, count(*) AS uses, "
+				"sum(load IS 1) AS loads, sum(load IS 0) AS stores, "
+				"sum(implicit == 1) AS implicit_uses "
+				"FROM use GROUP BY member) AS agg "
+			"WHERE member.id = agg.member;",
+		"DROP TABLE bulk_struct;",
+		"DROP TABLE bulk_member;",
+		"DROP TABLE bulk_use;",
+	};
+
+	for (const auto &sql : finalize) {
+		std::string err;
+		if (!exec(sql, &err)) {
+			std::cerr << "bulk finalize failed: " << err << "\n\t" << sql << "\n";
+			return false;
 		}
+	}
 
-		if (!ret) {
-			std::cerr << lastError() << '\n';
-			return -1;
+	return createTriggers(useTriggers);
+}
+
+/*
+ * The summaries are recomputed from scratch: incremental runs delete rows
+ * and change use counters of members in headers, which are not worth
+ * tracking row by row.
+ */
+bool SQLConn::refreshSummaries()
+{
+	static const std::vector<std::string> refresh {
+		"DELETE FROM unused_member;",
+		"DELETE FROM struct_summary;",
+		"DELETE FROM source_summary;",
+		"INSERT INTO "
+			"unused_member(member, struct, src, struct_name, member_name, "
+			"begLine, begCol, uses) "
+			"SELECT member.id, struct.id, struct.src, struct.name, member.name, "
+			"member.begLine, member.begCol, member.uses "
+			"FROM member JOIN struct ON member.struct = struct.id "
+			"WHERE member.uses = member.implicit_uses "
+				"AND struct.name != '<anonymous>' AND struct.name != '<unnamed>' "
+				"AND member.name != '<unnamed>';",
+		"INSERT INTO "
+			"struct_summary(struct, name, src, members, used, unused, implicit_only) "
+			"SELECT struct.id, struct.name, struct.src, count(member.id), "
+			"coalesce(sum(member.uses > 0), 0), coalesce(sum(member.uses = 0), 0), "
+			"coalesce(sum(member.uses > 0 AND member.uses = member.implicit_uses), 0) "
+			"FROM struct LEFT JOIN member ON member.struct = struct.id "
+			"GROUP BY struct.id;",
+		"INSERT INTO "
+			"source_summary(src, structs, members, unused, uses) "
+			"SELECT source.id, coalesce(s.structs, 0), coalesce(s.members, 0), "
+			"coalesce(s.unused, 0), coalesce(u.uses, 0) "
+			"FROM source "
+			"LEFT JOIN (SELECT src, count(*) AS structs, sum(members) AS members, "
+				"sum(unused) AS unused FROM struct_summary GROUP BY src) AS s "
+				"ON s.src = source.id "
+			"LEFT JOIN (SELECT src, count(*) AS uses FROM use GROUP BY src) AS u "
+				"ON u.src = source.id;",
+	};
+
+	if (!begin()) {
+		sqlError();
+		return false;
+	}
+
+	for (const auto &sql : refresh) {
+		std::string err;
+		if (!exec(sql, &err)) {
+			std::cerr << "summary refresh failed: " << err << "\n\t" << sql << "\n";
+			exec("ROLLBACK;");
+			return false;
+		}
+	}
+
+	if (!end()) {
+		sqlError();
+		return false;
+	}
+
+	return true;
+}
+
+bool SQLConn::vacuum(const std::filesystem::path &into)
+{
+	std::string sql = "VACUUM;";
+
+	if (!into.empty()) {
+		std::string quoted;
+		for (auto c : into.string()) {
+			if (c == '\'')
+				quoted.push_back(c);
+			quoted.push_back(c);
 		}
+		sql = "VACUUM INTO '" + quoted + "';";
 	}
 
+	std::string err;
+	if (!exec(sql, &err)) {
+		std::cerr << "vacuum failed: " << err << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool SQLConn::incrementalVacuum()
+{
+	std::string err;
+	if (!exec("PRAGMA incremental_vacuum;", &err)) {
+		std::cerr << "incremental vacuum failed: " << err << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+/* resolved once, so that records are bound by index and without key strings */
+template <Record::IsRecord R>
+bool SQLConn::prepareParams(SlSqlite::SQLStmtHolder &stmt, Params<R> &params,
+			    std::initializer_list<std::string_view> byId)
+{
+	bool ret = true;
+
+	Record::forEachField<R>([&](auto i, const auto &field) {
+		params[i] = 0;
+		if (std::find(byId.begin(), byId.end(), field.key) != byId.end())
+			return;
+
+		auto name = ":" + std::string(field.key);
+		params[i] = sqlite3_bind_parameter_index(stmt.get(), name.c_str());
+		if (!params[i]) {
+			std::cerr << "no parameter " << name << " in " <<
+				     sqlite3_sql(stmt.get()) << "\n";
+			ret = false;
+		}
+	});
+
+	return ret;
+}
+
+/*
+ * The texts are not copied, they live in the message until the statement
+ * is stepped and reset. All fields are bound each time, so that none is
+ * left over from the previous record.
+ */
+template <Record::IsRecord R>
+bool SQLConn::bindRecord(SlSqlite::SQLStmtHolder &stmt, const Params<R> &params, const R &rec)
+{
+	auto s = stmt.get();
+	int ret = SQLITE_OK;
+
+	Record::forEachField<R>([&](auto i, const auto &field) {
+		auto idx = params[i];
+		if (!idx || ret != SQLITE_OK)
+			return;
+
+		const auto &val = rec.*field.member;
+		using V = std::decay_t<decltype(val)>;
+		if constexpr (std::is_same_v<V, Record::Text>)
+			/* a null pointer would bind NULL */
+			ret = sqlite3_bind_text(s, idx, val.data() ? val.data() : "", val.size(),
+						SQLITE_STATIC);
+		else if constexpr (std::is_same_v<V, Record::Int>)
+			ret = sqlite3_bind_int64(s, idx, val);
+		else
+			ret = val ? sqlite3_bind_int64(s, idx, *val) : sqlite3_bind_null(s, idx);
+	});
+
+	if (ret != SQLITE_OK) {
+		sqlError();
+		return false;
+	}
+
+	return true;
+}
+
+bool SQLConn::bindId(SlSqlite::SQLStmtHolder &stmt, const char *key, int64_t id)
+{
+	auto idx = sqlite3_bind_parameter_index(stmt.get(), key);
+	if (sqlite3_bind_int64(stmt.get(), idx, id) != SQLITE_OK) {
+		sqlError();
+		return false;
+	}
+
+	return true;
+}
+
+std::optional<int64_t> SQLConn::stepId(SlSqlite::SQLStmtHolder &sel)
+{
+	auto ret = sqlite3_step(sel.get());
+	if (ret == SQLITE_ROW)
+		return sqlite3_column_int64(sel.get(), 0);
+	if (ret != SQLITE_DONE)
+		sqlError();
+
+	return std::nullopt;
+}
+
+std::optional<int64_t> SQLConn::insert(SlSqlite::SQLStmtHolder &ins)
+{
 	if (!step(ins)) {
-		std::cerr << lastError() << '\n';
-		std::cerr << "\t" << msg << "\n";
+		sqlError();
+		return std::nullopt;
+	}
+
+	return sqlite3_last_insert_rowid(sqlHolder.get());
+}
+
+std::optional<int64_t> SQLConn::getSrcId(std::string_view src)
+{
+	auto it = srcIds.find(src);
+	if (it != srcIds.end())
+		return it->second;
+
+	std::optional<int64_t> id;
+	{
+		SlSqlite::SQLStmtResetter selResetter(selSrc);
+		if (!bind(selSrc, ":src", src, true)) {
+			sqlError();
+			return std::nullopt;
+		}
+		id = stepId(selSrc);
+	}
+
+	if (!id) {
+		SlSqlite::SQLStmtResetter insResetter(insSrc);
+		if (!bind(insSrc, ":src", src, true)) {
+			sqlError();
+			return std::nullopt;
+		}
+		id = insert(insSrc);
+		if (!id)
+			return std::nullopt;
+	}
+
+	srcIds.emplace(src, *id);
+
+	return id;
+}
+
+std::optional<int64_t> SQLConn::getStructId(const StructKeyView &key)
+{
+	auto it = structIds.find(key);
+	if (it != structIds.end())
+		return it->second;
+
+	SlSqlite::SQLStmtResetter selResetter(selStr);
+	if (!bind(selStr, ":name", key.name, true) || !bindId(selStr, ":src", key.src) ||
+			!bindId(selStr, ":begLine", key.begLine) ||
+			!bindId(selStr, ":begCol", key.begCol))
+		return std::nullopt;
+
+	auto id = stepId(selStr);
+	if (id)
+		structIds.emplace(StructKey { std::string(key.name), key.src, key.begLine,
+			key.begCol }, *id);
+
+	return id;
+}
+
+std::optional<int64_t> SQLConn::getMemberId(int64_t strId, std::string_view name)
+{
+	auto &members = memberIds[strId];
+	auto it = members.find(name);
+	if (it != members.end())
+		return it->second;
+
+	SlSqlite::SQLStmtResetter selResetter(selMem);
+	if (!bindId(selMem, ":struct", strId) || !bind(selMem, ":name", name, true)) {
+		sqlError();
+		return std::nullopt;
+	}
+
+	auto id = stepId(selMem);
+	if (id)
+		members.emplace(name, *id);
+
+	return id;
+}
+
+template <Record::IsRecord R>
+int SQLConn::appendBulk(SlSqlite::SQLStmtHolder &ins, const Params<R> &params, const R &rec,
+			BulkSrcs srcs)
+{
+	SlSqlite::SQLStmtResetter insResetter(ins);
+	if (!bindRecord(ins, params, rec))
+		return -1;
+
+	for (const auto &[key, src] : srcs) {
+		auto srcId = getSrcId(src);
+		if (!srcId || !bindId(ins, key, *srcId))
+			return -1;
+	}
+
+	if (!step(ins)) {
+		sqlError();
+		std::cerr << "\t" << rec << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+template <Record::IsRecord R>
+int SQLConn::defer(const R &rec, const char *what)
+{
+	if (reportUnresolved) {
+		std::cerr << what << ": " << rec << "\n";
+		return fail(UNRESOLVED);
+	}
+
+	Message<std::string_view> msg;
+	msg.fromRecord(rec);
+	deferred.push_back(msg.serialize());
+	failureCounts[DEFERRED].fetch_add(1, std::memory_order_relaxed);
+
+	return 0;
+}
+
+const char *SQLConn::failureName(FAILURE failure)
+{
+	static const char *names[] = {
+		"bad_record",
+		"sql_error",
+		"deferred",
+		"unresolved",
+	};
+	static_assert(std::size(names) == NR_FAILURES);
+
+	return names[failure];
+}
+
+void SQLConn::sqlError()
+{
+	std::cerr << lastError() << '\n';
+	fail(SQL_ERROR);
+}
+
+int SQLConn::retryDeferred(bool final)
+{
+	auto todo = std::move(deferred);
+	int ret = 0;
+
+	deferred.clear();
+	reportUnresolved = final;
+
+	for (const auto &str : todo) {
+		Message<std::string_view> msg;
+		if (!msg.deserialize(str) || handleMessage(msg) < 0)
+			ret = -1;
+	}
+
+	reportUnresolved = false;
+
+	return ret;
+}
+
+int SQLConn::handleSource(const Record::Source &rec)
+{
+	return getSrcId(rec.src) ? 0 : -1;
+}
+
+int SQLConn::handleStruct(const Record::Struct &rec)
+{
+	if (bulk)
+		return appendBulk(insBulkStr, insBulkStrParams, rec, { { ":src", rec.src } });
+
+	auto srcId = getSrcId(rec.src);
+	if (!srcId)
+		return -1;
+
+	/* the same header is seen by many TUs */
+	StructKeyView key { rec.name, *srcId, rec.begLine, rec.begCol };
+	if (getStructId(key))
+		return 0;
+
+	SlSqlite::SQLStmtResetter insResetter(insStr);
+	if (!bindRecord(insStr, insStrParams, rec) || !bindId(insStr, ":src", *srcId))
+		return -1;
+
+	auto id = insert(insStr);
+	if (!id) {
+		std::cerr << "\t" << rec << "\n";
+		return -1;
+	}
+
+	structIds.emplace(StructKey { std::string(key.name), key.src, key.begLine, key.begCol },
+			  *id);
+
+	return 0;
+}
+
+int SQLConn::handleMember(const Record::Member &rec)
+{
+	if (bulk)
+		return appendBulk(insBulkMem, insBulkMemParams, rec, { { ":src", rec.src } });
+
+	auto srcId = getSrcId(rec.src);
+	if (!srcId)
+		return -1;
+
+	auto strId = getStructId({ rec.strct, *srcId, rec.strBegLine, rec.strBegCol });
+	if (!strId)
+		return defer(rec, "unknown struct of member");
+
+	MemberKeyView key { *strId, rec.name, rec.begLine, rec.begCol };
+	if (memberLocs.contains(key))
+		return 0;
+
+	{
+		SlSqlite::SQLStmtResetter selResetter(selMemLoc);
+		if (!bindId(selMemLoc, ":struct", *strId) ||
+				!bind(selMemLoc, ":name", rec.name, true) ||
+				!bindId(selMemLoc, ":begLine", rec.begLine) ||
+				!bindId(selMemLoc, ":begCol", rec.begCol))
+			return -1;
+		if (auto id = stepId(selMemLoc)) {
+			memberLocs.emplace(MemberKey { *strId, std::string(rec.name),
+				rec.begLine, rec.begCol }, *id);
+			memberIds[*strId].emplace(rec.name, *id);
+			return 0;
+		}
+	}
+
+	SlSqlite::SQLStmtResetter insResetter(insMem);
+	if (!bindRecord(insMem, insMemParams, rec) || !bindId(insMem, ":struct", *strId))
+		return -1;
+
+	auto id = insert(insMem);
+	if (!id) {
+		std::cerr << "\t" << rec << "\n";
+		return -1;
+	}
+
+	memberLocs.emplace(MemberKey { *strId, std::string(rec.name), rec.begLine,
+		rec.begCol }, *id);
+	memberIds[*strId].emplace(rec.name, *id);
+
+	return 0;
+}
+
+int SQLConn::handleUse(const Record::Use &rec)
+{
+	if (bulk)
+		return appendBulk(insBulkUse, insBulkUseParams, rec,
+				  { { ":strSrc", rec.strSrc }, { ":use_src", rec.useSrc } });
+
+	auto strSrcId = getSrcId(rec.strSrc);
+	auto useSrcId = getSrcId(rec.useSrc);
+	if (!strSrcId || !useSrcId)
+		return -1;
+
+	std::optional<int64_t> memberId;
+	if (auto strId = getStructId({ rec.strct, *strSrcId, rec.strLine, rec.strCol }))
+		memberId = getMemberId(*strId, rec.member);
+	if (!memberId)
+		return defer(rec, "unknown member of use");
+
+	SlSqlite::SQLStmtResetter insResetter(insUse);
+	if (!bindRecord(insUse, insUseParams, rec) ||
+			!bindId(insUse, ":member", *memberId) ||
+			!bindId(insUse, ":src", *useSrcId))
+		return -1;
+
+	if (!step(insUse)) {
+		sqlError();
+		std::cerr << "\t" << rec << "\n";
 		return -1;
 	}
 
 	return 0;
 }
 
+int SQLConn::handleDep(const Record::Dep &rec)
+{
+	auto tuId = getSrcId(rec.tu);
+	auto depId = getSrcId(rec.dep);
+	if (!tuId || !depId)
+		return -1;
+
+	/* headers are reported by every TU, update them only once */
+	auto &known = srcHashes[*depId];
+	if (known != rec.hash) {
+		SlSqlite::SQLStmtResetter updResetter(updSrcHash);
+		if (!bind(updSrcHash, ":hash", rec.hash, true) || !bindId(updSrcHash, ":id", *depId))
+			return -1;
+		if (!step(updSrcHash)) {
+			sqlError();
+			return -1;
+		}
+		known = rec.hash;
+	}
+
+	SlSqlite::SQLStmtResetter insResetter(insDep);
+	if (!bindId(insDep, ":tu", *tuId) || !bindId(insDep, ":dep", *depId))
+		return -1;
+	if (!step(insDep)) {
+		sqlError();
+		return -1;
+	}
+
+	return 0;
+}
+
+int SQLConn::handleStats(const Record::Stats &rec)
+{
+	auto tuId = getSrcId(rec.tu);
+	if (!tuId)
+		return -1;
+
+	if (!runId) {
+		SlSqlite::SQLStmtResetter runResetter(insRun);
+		if (!(runId = insert(insRun)))
+			return -1;
+	}
+
+	SlSqlite::SQLStmtResetter insResetter(insStats);
+	if (!bindRecord(insStats, insStatsParams, rec) || !bindId(insStats, ":tu", *tuId) ||
+			!bindId(insStats, ":run", *runId))
+		return -1;
+
+	if (!step(insStats)) {
+		sqlError();
+		std::cerr << "\t" << rec << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+template <Record::IsRecord R, typename T>
+int SQLConn::handle(const Message<T> &msg, int (SQLConn::*handler)(const R &))
+{
+	R rec;
+
+	if (!msg.toRecord(rec)) {
+		std::cerr << "bad record: " << msg << "\n";
+		return fail(BAD_RECORD);
+	}
+
+	return (this->*handler)(rec);
+}
+
 template <typename T>
 int SQLConn::handleMessage(const Message<T> &msg)
 {
 	using Msg = Message<T>;
-	auto kind = msg.getKind();
-
-	if (kind == Msg::KIND::SOURCE)
-		return bindAndStep(insSrc, msg);
-	if (kind == Msg::KIND::STRUCT)
-		return bindAndStep(insStr, msg);
-	if (kind == Msg::KIND::MEMBER)
-		return bindAndStep(insMem, msg);
-	if (kind == Msg::KIND::USE)
-		return bindAndStep(insUse, msg);
-
-	std::cerr << "bad message kind: " << kind << "\n";
+
+	switch (msg.getKind()) {
+	case Msg::KIND::SOURCE:
+		return handle(msg, &SQLConn::handleSource);
+	case Msg::KIND::STRUCT:
+		return handle(msg, &SQLConn::handleStruct);
+	case Msg::KIND::MEMBER:
+		return handle(msg, &SQLConn::handleMember);
+	case Msg::KIND::USE:
+		return handle(msg, &SQLConn::handleUse);
+	case Msg::KIND::DEP:
+		return handle(msg, &SQLConn::handleDep);
+	case Msg::KIND::STATS:
+		return handle(msg, &SQLConn::handleStats);
+	default:
+		break;
+	}
+
+	std::cerr << "bad message kind: " << msg.getKind() << "\n";
 	std::cerr << "\t" << msg << "\n";
 
-	return -1;
+	return fail(BAD_RECORD);
 }
 
-#ifdef STANDALONE
-template int SQLConn::handleMessage(const Message<std::string> &msg);
-#else
 template int SQLConn::handleMessage(const Message<std::string_view> &msg);
-#endif
@@ -2,34 +2,245 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include <sl/sqlite/SQLiteSmart.h>
 #include <sl/sqlite/SQLConn.h>
 
 #include "Message.h"
+#include "Record.h"
 
 namespace ClangStruct {
 
 class SQLConn : public SlSqlite::SQLConn {
 public:
+	/* why records were not stored (or not yet) */
+	enum FAILURE {
+		BAD_RECORD,
+		SQL_ERROR,
+		DEFERRED,
+		UNRESOLVED,
+		NR_FAILURES,
+	};
+
+	/* pragmas set on open, empty ones are left at the SQLite defaults */
+	struct Options {
+		std::string journalMode;
+		std::string synchronous;
+		std::string cacheSize;
+		std::string mmapSize;
+		std::string tempStore;
+		/* these two take effect only when the database is created */
+		std::string pageSize;
+		std::string autoVacuum;
+
+		/* from "journal_mode=wal;synchronous=normal;...", ',' works too */
+		bool parse(std::string_view spec);
+	};
+
 	SQLConn() {}
 
-	bool open(const std::filesystem::path &dbFile = "structs.db") noexcept {
-		return SlSqlite::SQLConn::open(dbFile, SlSqlite::CREATE);
-	}
+	/*
+	 * In @bulk mode, records are only appended to the unindexed bulk_*
+	 * tables. finalizeBulk() moves them to the real tables at the end.
+	 */
+	bool open(const std::filesystem::path &dbFile = "structs.db", bool bulk = false,
+		  const Options &opts = {}) noexcept;
+
+	bool finalizeBulk();
+	/*
+	 * Fills unused_member, struct_summary, and source_summary. Call it
+	 * outside of a transaction once the records are complete, and again
+	 * after rows were deleted.
+	 */
+	bool refreshSummaries();
+	/* rebuilds the database, or writes a compacted copy to @into if set */
+	bool vacuum(const std::filesystem::path &into = {});
+	/* returns free pages to the system, needs auto_vacuum=incremental */
+	bool incrementalVacuum();
 
 	template <typename T>
 	int handleMessage(const Message<T> &msg);
+	/*
+	 * Members and uses whose struct is not known yet are deferred: with
+	 * header claims, the TU owning a header may send it after its users.
+	 * @final reports what is still unresolved instead of deferring again.
+	 */
+	int retryDeferred(bool final);
+	size_t deferredCount() const { return deferred.size(); }
+
+	/* can be read from other threads */
+	uint64_t failures(FAILURE failure) const {
+		return failureCounts[failure].load(std::memory_order_relaxed);
+	}
+	static const char *failureName(FAILURE failure);
 private:
+	/*
+	 * IDs of rows inserted (or found) so far, so that records can be
+	 * inserted with plain integer references and duplicates dropped.
+	 */
+	template <typename S>
+	struct StructKeyBase {
+		S name;
+		int64_t src;
+		int64_t begLine;
+		int64_t begCol;
+	};
+	using StructKey = StructKeyBase<std::string>;
+	using StructKeyView = StructKeyBase<std::string_view>;
+
+	template <typename S>
+	struct MemberKeyBase {
+		int64_t strId;
+		S name;
+		int64_t begLine;
+		int64_t begCol;
+	};
+	using MemberKey = MemberKeyBase<std::string>;
+	using MemberKeyView = MemberKeyBase<std::string_view>;
+
+	struct KeyHash {
+		using is_transparent = void;
+
+		size_t operator()(std::string_view sv) const {
+			return std::hash<std::string_view>()(sv);
+		}
+		template <typename S>
+		size_t operator()(const StructKeyBase<S> &k) const {
+			return combine((*this)(k.name), k.src, k.begLine, k.begCol);
+		}
+		template <typename S>
+		size_t operator()(const MemberKeyBase<S> &k) const {
+			return combine((*this)(k.name), k.strId, k.begLine, k.begCol);
+		}
+	private:
+		static size_t combine(size_t h, int64_t a, int64_t b, int64_t c) {
+			for (auto v : { a, b, c })
+				h ^= std::hash<int64_t>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct KeyEqual {
+		using is_transparent = void;
+
+		bool operator()(std::string_view a, std::string_view b) const {
+			return a == b;
+		}
+		template <typename S, typename U>
+		bool operator()(const StructKeyBase<S> &a, const StructKeyBase<U> &b) const {
+			return a.src == b.src && a.begLine == b.begLine && a.begCol == b.begCol &&
+				std::string_view(a.name) == std::string_view(b.name);
+		}
+		template <typename S, typename U>
+		bool operator()(const MemberKeyBase<S> &a, const MemberKeyBase<U> &b) const {
+			return a.strId == b.strId && a.begLine == b.begLine &&
+				a.begCol == b.begCol &&
+				std::string_view(a.name) == std::string_view(b.name);
+		}
+	};
+
+	template <typename K>
+	using IdMap = std::unordered_map<K, int64_t, KeyHash, KeyEqual>;
+
 	virtual bool createDB() override;
 	virtual bool prepDB() override;
+	/* those set in createDB() resp. once opened */
+	bool setPragmas(bool onCreate);
+	bool checkJournalMode();
 
-	template <typename T>
-	int bindAndStep(SlSqlite::SQLStmtHolder &ins, const Message<T> &msg);
+	/* the parameter index of each field of a record, 0 for those bound by id */
+	template <Record::IsRecord R>
+	using Params = std::array<int, Record::fieldCount<R>>;
+	/* the source paths of a bulk record, bound as ids to the parameters */
+	using BulkSrcs = std::initializer_list<std::pair<const char *, std::string_view>>;
+
+	template <Record::IsRecord R, typename T>
+	int handle(const Message<T> &msg, int (SQLConn::*handler)(const R &));
+	int handleSource(const Record::Source &rec);
+	int handleStruct(const Record::Struct &rec);
+	int handleMember(const Record::Member &rec);
+	int handleUse(const Record::Use &rec);
+	int handleDep(const Record::Dep &rec);
+	int handleStats(const Record::Stats &rec);
+
+	template <Record::IsRecord R>
+	int appendBulk(SlSqlite::SQLStmtHolder &ins, const Params<R> &params, const R &rec,
+		       BulkSrcs srcs);
+
+	template <Record::IsRecord R>
+	int defer(const R &rec, const char *what);
+
+	int fail(FAILURE failure) {
+		failureCounts[failure].fetch_add(1, std::memory_order_relaxed);
+		return -1;
+	}
+	void sqlError();
+
+	/* every field not in @byId has to have a parameter */
+	template <Record::IsRecord R>
+	bool prepareParams(SlSqlite::SQLStmtHolder &stmt, Params<R> &params,
+			   std::initializer_list<std::string_view> byId);
+	template <Record::IsRecord R>
+	bool bindRecord(SlSqlite::SQLStmtHolder &stmt, const Params<R> &params, const R &rec);
+	bool bindId(SlSqlite::SQLStmtHolder &stmt, const char *key, int64_t id);
+	std::optional<int64_t> stepId(SlSqlite::SQLStmtHolder &sel);
+	std::optional<int64_t> insert(SlSqlite::SQLStmtHolder &ins);
+
+	std::optional<int64_t> getSrcId(std::string_view src);
+	std::optional<int64_t> getStructId(const StructKeyView &key);
+	std::optional<int64_t> getMemberId(int64_t strId, std::string_view name);
 
 	SlSqlite::SQLStmtHolder insSrc;
 	SlSqlite::SQLStmtHolder insStr;
 	SlSqlite::SQLStmtHolder insMem;
 	SlSqlite::SQLStmtHolder insUse;
+	SlSqlite::SQLStmtHolder updSrcHash;
+	SlSqlite::SQLStmtHolder insDep;
+	SlSqlite::SQLStmtHolder insRun;
+	SlSqlite::SQLStmtHolder insStats;
+	SlSqlite::SQLStmtHolder selSrc;
+	SlSqlite::SQLStmtHolder selStr;
+	SlSqlite::SQLStmtHolder selMem;
+	SlSqlite::SQLStmtHolder selMemLoc;
+	SlSqlite::SQLStmtHolder insBulkStr;
+	SlSqlite::SQLStmtHolder insBulkMem;
+	SlSqlite::SQLStmtHolder insBulkUse;
+
+	Params<Record::Struct> insStrParams;
+	Params<Record::Member> insMemParams;
+	Params<Record::Use> insUseParams;
+	Params<Record::Stats> insStatsParams;
+	Params<Record::Struct> insBulkStrParams;
+	Params<Record::Member> insBulkMemParams;
+	Params<Record::Use> insBulkUseParams;
+
+	bool bulk = false;
+	Options opts;
+	/* created with the first stats of this connection */
+	std::optional<int64_t> runId;
+
+	IdMap<std::string> srcIds;
+	std::unordered_map<int64_t, std::string> srcHashes;
+	IdMap<StructKey> structIds;
+	/* (struct, name) -> id, uses refer to members this way */
+	std::unordered_map<int64_t, IdMap<std::string>> memberIds;
+	/* full keys of inserted members, to drop duplicates */
+	IdMap<MemberKey> memberLocs;
+
+	std::vector<std::string> deferred;
+	bool reportUnresolved = false;
+
+	std::array<std::atomic<uint64_t>, NR_FAILURES> failureCounts {};
 };
 
 }
@@ -0,0 +1,873 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+/*
+ * A loadable extension for listings of structs.db (.load csstruct):
+ *
+ *  structs(struct_pattern, file_pattern, after_id)
+ *  members(struct_pattern, member_pattern, file_pattern, after_id)
+ *  unused_members(struct_pattern, member_pattern, file_pattern, after_id, implicit)
+ *  cs_estimate_count(table, struct_pattern, member_pattern, file_pattern[, implicit])
+ *
+ * Patterns are LIKE ... ESCAPE '\' patterns, NULL or '' match everything.
+ * Rows come in the order of the index (structs by name, source, and
+ * location; their members by location) and after_id continues after the row
+ * with this id in that order, so that pages need no OFFSET. unused_members
+ * are members without uses, or with implicit = 1, also those used only
+ * implicitly; <unnamed> ones and those of <anonymous>/<unnamed> structs are
+ * skipped, as unused_view and unused_member do.
+ *
+ * The index is built from the tables on the first query and rebuilt when
+ * the database changed since (PRAGMA data_version or changes of this
+ * connection).
+ */
+
+namespace {
+
+using Int = sqlite3_int64;
+
+constexpr Int null_int = std::numeric_limits<Int>::min();
+
+/* LIKE with ESCAPE '\': ASCII letters match case-insensitively */
+bool like(std::string_view pat, std::string_view str)
+{
+	auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; };
+	size_t p = 0, s = 0;
+	size_t starP = std::string_view::npos, starS = 0;
+
+	while (s < str.size()) {
+		if (p < pat.size() && pat[p] == '%') {
+			starP = ++p;
+			starS = s;
+			continue;
+		}
+		if (p < pat.size()) {
+			char c = pat[p];
+			size_t len = 1;
+			bool any = c == '_';
+			if (c == '\\' && p + 1 < pat.size()) {
+				c = pat[p + 1];
+				len = 2;
+			}
+			if (any || lower(c) == lower(str[s])) {
+				p += len;
+				s++;
+				continue;
+			}
+		}
+		if (starP == std::string_view::npos)
+			return false;
+		p = starP;
+		s = ++starS;
+	}
+
+	while (p < pat.size() && pat[p] == '%')
+		p++;
+
+	return p == pat.size();
+}
+
+class Index {
+public:
+	/* which members a listing or a count is about */
+	enum KIND {
+		ALL,
+		UNUSED,
+		NO_EXPLICIT,
+		NR_KINDS,
+	};
+
+	struct Struct {
+		Int id;
+		uint32_t name;
+		uint32_t attrs;
+		uint32_t src;
+		Int begLine, begCol, endLine, endCol;
+		char type;
+		bool packed;
+		bool inMacro;
+		uint32_t firstMember;
+		uint32_t nrMembers;
+		/* members of each KIND */
+		uint32_t counts[NR_KINDS];
+		/* as in struct_summary */
+		uint32_t unused;
+		uint32_t implicitOnly;
+	};
+
+	struct Member {
+		Int id;
+		uint32_t name;
+		uint32_t strct;
+		Int begLine, begCol, endLine, endCol;
+		Int uses, loads, stores, implicitUses;
+		/* bit per KIND */
+		uint8_t kinds;
+	};
+
+	/* returns an error message, empty on success */
+	std::string build(sqlite3 *db);
+
+	std::string_view str(uint32_t off) const { return strings.data() + off; }
+	std::string_view src(const Struct &s) const { return str(sources[s.src]); }
+
+	std::vector<uint32_t> sources;
+	std::vector<Struct> structs;
+	std::vector<Member> members;
+	std::unordered_map<Int, uint32_t> structPos;
+	std::unordered_map<Int, uint32_t> memberPos;
+private:
+	template <typename F>
+	std::string forEachRow(sqlite3 *db, const char *sql, F f);
+	uint32_t addString(const unsigned char *str);
+	static Int optInt(sqlite3_stmt *stmt, int col) {
+		return sqlite3_column_type(stmt, col) == SQLITE_NULL ? null_int :
+			sqlite3_column_int64(stmt, col);
+	}
+
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> stringOffsets;
+};
+
+template <typename F>
+std::string Index::forEachRow(sqlite3 *db, const char *sql, F f)
+{
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+		return sqlite3_errmsg(db);
+
+	int ret;
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+		f(stmt);
+
+	std::string err;
+	if (ret != SQLITE_DONE)
+		err = sqlite3_errmsg(db);
+	sqlite3_finalize(stmt);
+
+	return err;
+}
+
+uint32_t Index::addString(const unsigned char *str)
+{
+	std::string s(str ? reinterpret_cast<const char *>(str) : "");
+	auto [it, added] = stringOffsets.try_emplace(s, strings.size());
+	if (added) {
+		strings.append(s);
+		strings.push_back('\0');
+	}
+
+	return it->second;
+}
+
+std::string Index::build(sqlite3 *db)
+{
+	std::unordered_map<Int, uint32_t> sourceIdx;
+
+	auto err = forEachRow(db, "SELECT id, src FROM source;", [&](sqlite3_stmt *stmt) {
+		sourceIdx[sqlite3_column_int64(stmt, 0)] = sources.size();
+		sources.push_back(addString(sqlite3_column_text(stmt, 1)));
+	});
+	if (!err.empty())
+		return err;
+	/* for structs of a vanished source */
+	auto noSrc = sources.size();
+	sources.push_back(addString(nullptr));
+
+	std::vector<Struct> unsorted;
+	err = forEachRow(db, "SELECT id, type, name, attrs, packed, inMacro, src, "
+			 "begLine, begCol, endLine, endCol FROM struct;", [&](sqlite3_stmt *stmt) {
+		auto src = sourceIdx.find(sqlite3_column_int64(stmt, 6));
+		auto type = sqlite3_column_text(stmt, 1);
+		unsorted.push_back({
+			.id = sqlite3_column_int64(stmt, 0),
+			.name = addString(sqlite3_column_text(stmt, 2)),
+			.attrs = addString(sqlite3_column_text(stmt, 3)),
+			.src = src == sourceIdx.end() ? (uint32_t)noSrc : src->second,
+			.begLine = sqlite3_column_int64(stmt, 7),
+			.begCol = sqlite3_column_int64(stmt, 8),
+			.endLine = optInt(stmt, 9),
+			.endCol = optInt(stmt, 10),
+			.type = type ? (char)type[0] : 's',
+			.packed = sqlite3_column_int(stmt, 4) != 0,
+			.inMacro = sqlite3_column_int(stmt, 5) != 0,
+			.firstMember = 0,
+			.nrMembers = 0,
+			.counts = {},
+			.unused = 0,
+			.implicitOnly = 0,
+		});
+	});
+	if (!err.empty())
+		return err;
+
+	/* the order of the listings, ORDER BY struct, src, struct_begLine */
+	std::sort(unsorted.begin(), unsorted.end(), [this](const Struct &a, const Struct &b) {
+		return std::tuple(str(a.name), src(a), a.begLine, a.begCol, a.id) <
+			std::tuple(str(b.name), src(b), b.begLine, b.begCol, b.id);
+	});
+	structs = std::move(unsorted);
+	for (uint32_t i = 0; i < structs.size(); i++)
+		structPos[structs[i].id] = i;
+
+	auto unnamed = addString(reinterpret_cast<const unsigned char *>("<unnamed>"));
+	auto anonymous = addString(reinterpret_cast<const unsigned char *>("<anonymous>"));
+	std::vector<Member> unsortedMembers;
+	err = forEachRow(db, "SELECT id, struct, name, begLine, begCol, endLine, endCol, "
+			 "uses, loads, stores, implicit_uses FROM member;", [&](sqlite3_stmt *stmt) {
+		auto strct = structPos.find(sqlite3_column_int64(stmt, 1));
+		if (strct == structPos.end())
+			return;
+
+		Member m {
+			.id = sqlite3_column_int64(stmt, 0),
+			.name = addString(sqlite3_column_text(stmt, 2)),
+			.strct = strct->second,
+			.begLine = sqlite3_column_int64(stmt, 3),
+			.begCol = sqlite3_column_int64(stmt, 4),
+			.endLine = optInt(stmt, 5),
+			.endCol = optInt(stmt, 6),
+			.uses = sqlite3_column_int64(stmt, 7),
+			.loads = sqlite3_column_int64(stmt, 8),
+			.stores = sqlite3_column_int64(stmt, 9),
+			.implicitUses = sqlite3_column_int64(stmt, 10),
+			.kinds = 1 << ALL,
+		};
+		auto strName = structs[m.strct].name;
+		if (m.name != unnamed && strName != unnamed && strName != anonymous) {
+			if (!m.uses)
+				m.kinds |= 1 << UNUSED;
+			if (m.uses == m.implicitUses)
+				m.kinds |= 1 << NO_EXPLICIT;
+		}
+		unsortedMembers.push_back(m);
+	});
+	if (!err.empty())
+		return err;
+
+	std::sort(unsortedMembers.begin(), unsortedMembers.end(), [](const Member &a,
+								     const Member &b) {
+		return std::tuple(a.strct, a.begLine, a.begCol, a.id) <
+			std::tuple(b.strct, b.begLine, b.begCol, b.id);
+	});
+	members = std::move(unsortedMembers);
+
+	for (uint32_t i = 0; i < members.size(); i++) {
+		const auto &m = members[i];
+		auto &s = structs[m.strct];
+		if (!s.nrMembers)
+			s.firstMember = i;
+		s.nrMembers++;
+		for (unsigned k = 0; k < NR_KINDS; k++)
+			if (m.kinds & (1 << k))
+				s.counts[k]++;
+		if (!m.uses)
+			s.unused++;
+		else if (m.uses == m.implicitUses)
+			s.implicitOnly++;
+		memberPos[m.id] = i;
+	}
+
+	return {};
+}
+
+/* the index of one connection, shared by its tables and functions */
+class State {
+public:
+	State(sqlite3 *db) : db(db) {}
+
+	/* nullptr and @err set on failure */
+	std::shared_ptr<const Index> get(std::string &err);
+private:
+	std::optional<Int> dataVersion();
+
+	sqlite3 *db;
+	std::shared_ptr<const Index> idx;
+	Int version = 0;
+	Int changes = 0;
+};
+
+std::optional<Int> State::dataVersion()
+{
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, nullptr) != SQLITE_OK)
+		return std::nullopt;
+
+	std::optional<Int> ret;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		ret = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+std::shared_ptr<const Index> State::get(std::string &err)
+{
+	auto ver = dataVersion();
+	Int chg = sqlite3_total_changes(db);
+	if (idx && ver && *ver == version && chg == changes)
+		return idx;
+
+	auto fresh = std::make_shared<Index>();
+	err = fresh->build(db);
+	if (!err.empty())
+		return nullptr;
+
+	idx = std::move(fresh);
+	version = ver.value_or(0);
+	changes = chg;
+
+	return idx;
+}
+
+/* the arguments of a listing or a count */
+class Query {
+public:
+	enum PARAM {
+		STRUCT_PAT,
+		MEMBER_PAT,
+		FILE_PAT,
+		AFTER_ID,
+		IMPLICIT,
+		NR_PARAMS,
+	};
+
+	Query(const Index &idx) : idx(idx) {}
+
+	void setPattern(PARAM param, const unsigned char *pat) {
+		auto &p = patterns[param];
+		p.reset();
+		/* the frontend passes blank filters as '%' too */
+		if (pat && *pat && std::string_view(reinterpret_cast<const char *>(pat)) != "%")
+			p = reinterpret_cast<const char *>(pat);
+	}
+	const std::optional<std::string> &pattern(PARAM param) const { return patterns[param]; }
+
+	bool structMatches(const Index::Struct &s);
+	bool memberMatches(const Index::Member &m) const {
+		return (m.kinds & (1 << kind)) &&
+			(!patterns[MEMBER_PAT] || like(*patterns[MEMBER_PAT], idx.str(m.name)));
+	}
+
+	std::optional<Int> after;
+	Index::KIND kind = Index::ALL;
+	/* a structs listing, it does not care about their members */
+	bool structsOnly = false;
+private:
+	const Index &idx;
+	std::optional<std::string> patterns[FILE_PAT + 1];
+	/* per source: 0 = not matched yet, 1 = matches, 2 = does not */
+	std::vector<uint8_t> srcMatches;
+};
+
+bool Query::structMatches(const Index::Struct &s)
+{
+	if (!structsOnly && !s.counts[kind])
+		return false;
+	if (patterns[STRUCT_PAT] && !like(*patterns[STRUCT_PAT], idx.str(s.name)))
+		return false;
+	if (!patterns[FILE_PAT])
+		return true;
+
+	if (srcMatches.empty())
+		srcMatches.resize(idx.sources.size());
+	auto &m = srcMatches[s.src];
+	if (!m)
+		m = like(*patterns[FILE_PAT], idx.src(s)) ? 1 : 2;
+
+	return m == 1;
+}
+
+enum TABLE {
+	STRUCTS,
+	MEMBERS,
+	UNUSED_MEMBERS,
+};
+
+struct Module {
+	TABLE table;
+	std::shared_ptr<State> state;
+};
+
+struct Table : sqlite3_vtab {
+	TABLE table;
+	std::shared_ptr<State> state;
+	/* the first hidden column and the params in their order */
+	int firstHidden;
+	std::vector<Query::PARAM> params;
+};
+
+struct Cursor : sqlite3_vtab_cursor {
+	std::shared_ptr<const Index> idx;
+	std::optional<Query> query;
+	std::vector<sqlite3_value *> args;
+	/* position in structs or members */
+	uint32_t pos = 0;
+	uint32_t curStruct = ~0U;
+};
+
+namespace Col {
+
+enum STRUCTS {
+	S_ID, S_NAME, S_TYPE, S_ATTRS, S_PACKED, S_IN_MACRO, S_SRC,
+	S_BEG_LINE, S_BEG_COL, S_END_LINE, S_END_COL, S_MEMBERS, S_UNUSED, S_IMPLICIT_ONLY,
+	S_HIDDEN,
+};
+
+enum MEMBERS {
+	M_ID, M_STRUCT_ID, M_STRUCT, M_MEMBER, M_SRC, M_STRUCT_TYPE, M_STRUCT_BEG_LINE, M_PACKED,
+	M_BEG_LINE, M_BEG_COL, M_END_LINE, M_END_COL, M_USES, M_LOADS, M_STORES,
+	M_IMPLICIT_USES,
+	M_HIDDEN,
+};
+
+}
+
+const char *const param_names[] = {
+	"struct_pattern", "member_pattern", "file_pattern", "after_id", "implicit",
+};
+
+int connect(sqlite3 *db, void *aux, int, const char *const *, sqlite3_vtab **vtab, char **)
+{
+	auto mod = static_cast<const Module *>(aux);
+	std::string sql;
+	auto tab = std::make_unique<Table>();
+
+	tab->table = mod->table;
+	tab->state = mod->state;
+	if (mod->table == STRUCTS) {
+		sql = "CREATE TABLE x(id, struct, type, attrs, packed, inMacro, src, "
+			"begLine, begCol, endLine, endCol, members, unused, implicit_only";
+		tab->firstHidden = Col::S_HIDDEN;
+		tab->params = { Query::STRUCT_PAT, Query::FILE_PAT, Query::AFTER_ID };
+	} else {
+		sql = "CREATE TABLE x(id, struct_id, struct, member, src, struct_type, "
+			"struct_begLine, packed, begLine, begCol, endLine, endCol, "
+			"uses, loads, stores, implicit_uses";
+		tab->firstHidden = Col::M_HIDDEN;
+		tab->params = { Query::STRUCT_PAT, Query::MEMBER_PAT, Query::FILE_PAT,
+			Query::AFTER_ID };
+		if (mod->table == UNUSED_MEMBERS)
+			tab->params.push_back(Query::IMPLICIT);
+	}
+	for (auto p : tab->params)
+		sql.append(", ").append(param_names[p]).append(" HIDDEN");
+	sql.append(");");
+
+	auto ret = sqlite3_declare_vtab(db, sql.c_str());
+	if (ret != SQLITE_OK)
+		return ret;
+
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+	*vtab = tab.release();
+
+	return SQLITE_OK;
+}
+
+int disconnect(sqlite3_vtab *vtab)
+{
+	delete static_cast<Table *>(vtab);
+	return SQLITE_OK;
+}
+
+/* ORDER BY of a prefix of the index order is free */
+bool orderConsumed(const Table *tab, const sqlite3_index_info *info)
+{
+	static const int structsOrder[] = {
+		Col::S_NAME, Col::S_SRC, Col::S_BEG_LINE, Col::S_BEG_COL, Col::S_ID,
+	};
+	/* members of structs with the same location would interleave past these */
+	static const int membersOrder[] = {
+		Col::M_STRUCT, Col::M_SRC, Col::M_STRUCT_BEG_LINE,
+	};
+	const int *order = tab->table == STRUCTS ? structsOrder : membersOrder;
+	size_t len = tab->table == STRUCTS ? std::size(structsOrder) : std::size(membersOrder);
+
+	if ((size_t)info->nOrderBy > len)
+		return false;
+	for (int i = 0; i < info->nOrderBy; i++)
+		if (info->aOrderBy[i].desc || info->aOrderBy[i].iColumn != order[i])
+			return false;
+
+	return true;
+}
+
+/* idxNum has a bit per Query::PARAM given, their values come in that order */
+int bestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	auto tab = static_cast<Table *>(vtab);
+	int constraint[Query::NR_PARAMS];
+	int idxNum = 0;
+
+	std::fill(std::begin(constraint), std::end(constraint), -1);
+	for (int i = 0; i < info->nConstraint; i++) {
+		const auto &c = info->aConstraint[i];
+		if (c.iColumn < tab->firstHidden || c.op != SQLITE_INDEX_CONSTRAINT_EQ)
+			continue;
+		/* the arguments have to be known, try another plan */
+		if (!c.usable)
+			return SQLITE_CONSTRAINT;
+		auto param = tab->params[c.iColumn - tab->firstHidden];
+		constraint[param] = i;
+		idxNum |= 1 << param;
+	}
+
+	int argv = 0;
+	for (unsigned p = 0; p < Query::NR_PARAMS; p++) {
+		if (constraint[p] < 0)
+			continue;
+		info->aConstraintUsage[constraint[p]].argvIndex = ++argv;
+		info->aConstraintUsage[constraint[p]].omit = 1;
+	}
+
+	info->idxNum = idxNum;
+	info->orderByConsumed = orderConsumed(tab, info);
+	/* a struct name or a keyset cursor narrows the scan most */
+	double cost = 1e6;
+	if (idxNum & (1 << Query::STRUCT_PAT))
+		cost /= 10;
+	if (idxNum & (1 << Query::AFTER_ID))
+		cost /= 10;
+	info->estimatedCost = cost;
+
+	return SQLITE_OK;
+}
+
+int open(sqlite3_vtab *, sqlite3_vtab_cursor **cursor)
+{
+	*cursor = new Cursor();
+	return SQLITE_OK;
+}
+
+int close(sqlite3_vtab_cursor *cursor)
+{
+	delete static_cast<Cursor *>(cursor);
+	return SQLITE_OK;
+}
+
+/* moves to the first matching row at or after pos */
+void seek(Cursor *cur)
+{
+	auto tab = static_cast<const Table *>(cur->pVtab);
+	const auto &idx = *cur->idx;
+	auto &q = *cur->query;
+
+	if (tab->table == STRUCTS) {
+		while (cur->pos < idx.structs.size() && !q.structMatches(idx.structs[cur->pos]))
+			cur->pos++;
+		return;
+	}
+
+	while (cur->pos < idx.members.size()) {
+		const auto &m = idx.members[cur->pos];
+		if (m.strct != cur->curStruct) {
+			const auto &s = idx.structs[m.strct];
+			cur->curStruct = m.strct;
+			if (!q.structMatches(s)) {
+				/* skip the whole struct */
+				cur->pos = s.firstMember + s.nrMembers;
+				continue;
+			}
+		}
+		if (q.memberMatches(m))
+			return;
+		cur->pos++;
+	}
+}
+
+int filter(sqlite3_vtab_cursor *cursor, int idxNum, const char *, int argc, sqlite3_value **argv)
+{
+	auto cur = static_cast<Cursor *>(cursor);
+	auto tab = static_cast<Table *>(cursor->pVtab);
+	std::string err;
+
+	cur->idx = tab->state->get(err);
+	if (!cur->idx) {
+		sqlite3_free(tab->zErrMsg);
+		tab->zErrMsg = sqlite3_mprintf("cannot build the index: %s", err.c_str());
+		return SQLITE_ERROR;
+	}
+
+	const auto &idx = *cur->idx;
+	auto &q = cur->query.emplace(idx);
+	q.structsOnly = tab->table == STRUCTS;
+	q.kind = tab->table == UNUSED_MEMBERS ? Index::UNUSED : Index::ALL;
+
+	cur->args.assign(Query::NR_PARAMS, nullptr);
+	for (unsigned p = 0, arg = 0; p < Query::NR_PARAMS && arg < (unsigned)argc; p++)
+		if (idxNum & (1 << p))
+			cur->args[p] = argv[arg++];
+
+	for (auto p : { Query::STRUCT_PAT, Query::MEMBER_PAT, Query::FILE_PAT })
+		if (cur->args[p])
+			q.setPattern(p, sqlite3_value_text(cur->args[p]));
+	if (cur->args[Query::IMPLICIT] && sqlite3_value_int(cur->args[Query::IMPLICIT]))
+		q.kind = Index::NO_EXPLICIT;
+
+	cur->pos = 0;
+	cur->curStruct = ~0U;
+	if (auto after = cur->args[Query::AFTER_ID];
+			after && sqlite3_value_type(after) != SQLITE_NULL) {
+		const auto &pos = q.structsOnly ? idx.structPos : idx.memberPos;
+		auto it = pos.find(sqlite3_value_int64(after));
+		/* the row is gone, the listing cannot continue */
+		cur->pos = it == pos.end() ? ~0U : it->second + 1;
+	}
+
+	seek(cur);
+
+	return SQLITE_OK;
+}
+
+int next(sqlite3_vtab_cursor *cursor)
+{
+	auto cur = static_cast<Cursor *>(cursor);
+
+	cur->pos++;
+	seek(cur);
+
+	return SQLITE_OK;
+}
+
+int eof(sqlite3_vtab_cursor *cursor)
+{
+	auto cur = static_cast<Cursor *>(cursor);
+	auto tab = static_cast<const Table *>(cursor->pVtab);
+	size_t size = tab->table == STRUCTS ? cur->idx->structs.size() : cur->idx->members.size();
+
+	return cur->pos >= size;
+}
+
+void resultText(sqlite3_context *ctx, std::string_view str)
+{
+	/* the index outlives the statement step */
+	sqlite3_result_text(ctx, str.data(), str.size(), SQLITE_TRANSIENT);
+}
+
+void resultOptInt(sqlite3_context *ctx, Int val)
+{
+	if (val == null_int)
+		sqlite3_result_null(ctx);
+	else
+		sqlite3_result_int64(ctx, val);
+}
+
+void structColumn(sqlite3_context *ctx, const Index &idx, const Index::Struct &s, int col)
+{
+	switch (col) {
+	case Col::S_ID: sqlite3_result_int64(ctx, s.id); break;
+	case Col::S_NAME: resultText(ctx, idx.str(s.name)); break;
+	case Col::S_TYPE: resultText(ctx, std::string_view(&s.type, 1)); break;
+	case Col::S_ATTRS: resultText(ctx, idx.str(s.attrs)); break;
+	case Col::S_PACKED: sqlite3_result_int(ctx, s.packed); break;
+	case Col::S_IN_MACRO: sqlite3_result_int(ctx, s.inMacro); break;
+	case Col::S_SRC: resultText(ctx, idx.src(s)); break;
+	case Col::S_BEG_LINE: sqlite3_result_int64(ctx, s.begLine); break;
+	case Col::S_BEG_COL: sqlite3_result_int64(ctx, s.begCol); break;
+	case Col::S_END_LINE: resultOptInt(ctx, s.endLine); break;
+	case Col::S_END_COL: resultOptInt(ctx, s.endCol); break;
+	case Col::S_MEMBERS: sqlite3_result_int64(ctx, s.nrMembers); break;
+	case Col::S_UNUSED: sqlite3_result_int64(ctx, s.unused); break;
+	case Col::S_IMPLICIT_ONLY: sqlite3_result_int64(ctx, s.implicitOnly); break;
+	}
+}
+
+void memberColumn(sqlite3_context *ctx, const Index &idx, const Index::Member &m, int col)
+{
+	const auto &s = idx.structs[m.strct];
+
+	switch (col) {
+	case Col::M_ID: sqlite3_result_int64(ctx, m.id); break;
+	case Col::M_STRUCT_ID: sqlite3_result_int64(ctx, s.id); break;
+	case Col::M_STRUCT: resultText(ctx, idx.str(s.name)); break;
+	case Col::M_MEMBER: resultText(ctx, idx.str(m.name)); break;
+	case Col::M_SRC: resultText(ctx, idx.src(s)); break;
+	case Col::M_STRUCT_TYPE: resultText(ctx, std::string_view(&s.type, 1)); break;
+	case Col::M_STRUCT_BEG_LINE: sqlite3_result_int64(ctx, s.begLine); break;
+	case Col::M_PACKED: sqlite3_result_int(ctx, s.packed); break;
+	case Col::M_BEG_LINE: sqlite3_result_int64(ctx, m.begLine); break;
+	case Col::M_BEG_COL: sqlite3_result_int64(ctx, m.begCol); break;
+	case Col::M_END_LINE: resultOptInt(ctx, m.endLine); break;
+	case Col::M_END_COL: resultOptInt(ctx, m.endCol); break;
+	case Col::M_USES: sqlite3_result_int64(ctx, m.uses); break;
+	case Col::M_LOADS: sqlite3_result_int64(ctx, m.loads); break;
+	case Col::M_STORES: sqlite3_result_int64(ctx, m.stores); break;
+	case Col::M_IMPLICIT_USES: sqlite3_result_int64(ctx, m.implicitUses); break;
+	}
+}
+
+int column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+	auto cur = static_cast<Cursor *>(cursor);
+	auto tab = static_cast<const Table *>(cursor->pVtab);
+	const auto &idx = *cur->idx;
+
+	if (col >= tab->firstHidden) {
+		if (auto arg = cur->args[tab->params[col - tab->firstHidden]])
+			sqlite3_result_value(ctx, arg);
+		return SQLITE_OK;
+	}
+
+	if (tab->table == STRUCTS)
+		structColumn(ctx, idx, idx.structs[cur->pos], col);
+	else
+		memberColumn(ctx, idx, idx.members[cur->pos], col);
+
+	return SQLITE_OK;
+}
+
+int rowid(sqlite3_vtab_cursor *cursor, sqlite_int64 *rowid)
+{
+	auto cur = static_cast<Cursor *>(cursor);
+	auto tab = static_cast<const Table *>(cursor->pVtab);
+
+	*rowid = tab->table == STRUCTS ? cur->idx->structs[cur->pos].id :
+		cur->idx->members[cur->pos].id;
+
+	return SQLITE_OK;
+}
+
+/* eponymous only: no xCreate and xDestroy */
+const sqlite3_module module = [] {
+	sqlite3_module m {};
+
+	m.xConnect = connect;
+	m.xBestIndex = bestIndex;
+	m.xDisconnect = disconnect;
+	m.xOpen = open;
+	m.xClose = close;
+	m.xFilter = filter;
+	m.xNext = next;
+	m.xEof = eof;
+	m.xColumn = column;
+	m.xRowid = rowid;
+
+	return m;
+}();
+
+/*
+ * Exact without a member pattern, from the per-struct counts. With one, the
+ * pattern is tried on at most max_samples evenly spread candidates.
+ */
+Int estimateCount(const Index &idx, Query &q)
+{
+	static constexpr Int max_samples = 4096;
+	Int candidates = 0;
+
+	for (const auto &s : idx.structs)
+		if (q.structMatches(s))
+			candidates += q.structsOnly ? 1 : s.counts[q.kind];
+
+	if (q.structsOnly || !q.pattern(Query::MEMBER_PAT) || !candidates)
+		return candidates;
+
+	Int stride = std::max<Int>(1, candidates / max_samples);
+	Int seen = 0, sampled = 0, hits = 0;
+	for (const auto &s : idx.structs) {
+		if (!q.structMatches(s))
+			continue;
+		for (uint32_t i = s.firstMember; i < s.firstMember + s.nrMembers; i++) {
+			const auto &m = idx.members[i];
+			if (!(m.kinds & (1 << q.kind)) || seen++ % stride)
+				continue;
+			sampled++;
+			if (q.memberMatches(m))
+				hits++;
+		}
+	}
+
+	return stride == 1 ? hits : hits * candidates / sampled;
+}
+
+void estimateCountFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	auto state = *static_cast<std::shared_ptr<State> *>(sqlite3_user_data(ctx));
+	std::string err;
+
+	auto idx = state->get(err);
+	if (!idx) {
+		sqlite3_result_error(ctx, ("cannot build the index: " + err).c_str(), -1);
+		return;
+	}
+
+	Query q(*idx);
+	auto table = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+	std::string_view t(table ? table : "");
+	if (t == "structs") {
+		q.structsOnly = true;
+	} else if (t == "members") {
+		q.kind = Index::ALL;
+	} else if (t == "unused_members") {
+		q.kind = argc > 4 && sqlite3_value_int(argv[4]) ? Index::NO_EXPLICIT :
+			Index::UNUSED;
+	} else {
+		sqlite3_result_error(ctx, "unknown table, expected structs, members, or "
+				     "unused_members", -1);
+		return;
+	}
+
+	q.setPattern(Query::STRUCT_PAT, sqlite3_value_text(argv[1]));
+	q.setPattern(Query::MEMBER_PAT, sqlite3_value_text(argv[2]));
+	q.setPattern(Query::FILE_PAT, sqlite3_value_text(argv[3]));
+
+	sqlite3_result_int64(ctx, estimateCount(*idx, q));
+}
+
+void destroyModule(void *aux)
+{
+	delete static_cast<Module *>(aux);
+}
+
+void destroyState(void *state)
+{
+	delete static_cast<std::shared_ptr<State> *>(state);
+}
+
+}
+
+extern "C" int sqlite3_csstruct_init(sqlite3 *db, char **errMsg, const sqlite3_api_routines *api)
+{
+	SQLITE_EXTENSION_INIT2(api);
+
+	auto state = std::make_shared<State>(db);
+	static const struct {
+		const char *name;
+		TABLE table;
+	} tables[] = {
+		{ "structs", STRUCTS },
+		{ "members", MEMBERS },
+		{ "unused_members", UNUSED_MEMBERS },
+	};
+
+	for (const auto &t : tables) {
+		auto ret = sqlite3_create_module_v2(db, t.name, &module,
+						    new Module { t.table, state }, destroyModule);
+		if (ret != SQLITE_OK)
+			return ret;
+	}
+
+	for (int args : { 4, 5 }) {
+		auto ret = sqlite3_create_function_v2(db, "cs_estimate_count", args,
+						      SQLITE_UTF8 | SQLITE_INNOCUOUS,
+						      new std::shared_ptr<State>(state),
+						      estimateCountFunc, nullptr, nullptr,
+						      destroyState);
+		if (ret != SQLITE_OK)
+			return ret;
+	}
+
+	return SQLITE_OK;
+}
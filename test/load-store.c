@@ -0,0 +1,22 @@
+// SQL: SELECT group_concat(member || '=' || ifnull(load, 'NULL'), '/') FROM (SELECT member, load FROM use_view WHERE struct = 'A' AND src LIKE '%/load-store.c' ORDER BY member);
+// EXPECT: ^cast_arg=NULL/compound=0/compound_rhs=NULL/paren_arg=NULL/plain_arg=1$
+
+struct A {
+	int plain_arg;
+	int cast_arg;
+	int paren_arg;
+	int compound;
+	int compound_rhs;
+};
+
+void take(long v);
+
+void fun(struct A *a)
+{
+	take(a->plain_arg);
+	/* explicit casts and parens are spelled, the argument is not the member */
+	take((long)a->cast_arg);
+	take((a->paren_arg));
+	/* the left-hand side wins */
+	a->compound += a->compound_rhs;
+}
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "../src/Message.h"
+
+using namespace ClangStruct;
+
+using Msg = Message<std::string>;
+using MsgView = Message<std::string_view>;
+
+static int failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cerr << __FILE__ << ':' << __LINE__ << ": " << #cond << " failed\n"; \
+		failed++; \
+	} \
+} while (0)
+
+static std::string binary(std::initializer_list<unsigned char> bytes)
+{
+	return std::string(bytes.begin(), bytes.end());
+}
+
+static void testRoundTrip(Msg::FORMAT format)
+{
+	Msg msg(Msg::KIND::USE);
+	msg.add("member", "len");
+	msg.add("struct", "sk_buff");
+	msg.add("load");
+	msg.add("implicit", 0);
+	msg.add("begLine", 1234567);
+	msg.add("endLine", -1);
+	msg.add("not_in_schema", "x");
+
+	auto str = msg.serialize(format);
+
+	MsgView out;
+	CHECK(out.deserialize(str));
+	CHECK(out.getKind() == MsgView::KIND::USE);
+	CHECK(out.size() == msg.size());
+	for (size_t i = 0; i < std::min(out.size(), msg.size()); i++) {
+		CHECK(out[i].type == (MsgView::TYPE)msg[i].type);
+		CHECK(out[i].key == msg[i].key);
+		CHECK(out[i].val == msg[i].val);
+		CHECK(out[i].num == msg[i].num);
+	}
+}
+
+/* zigzag keeps small negative numbers short, 7 bits per byte */
+static void testVarints()
+{
+	static const struct {
+		int64_t num;
+		size_t bytes;
+	} ints[] = {
+		{ 0, 1 }, { -1, 1 }, { 63, 1 }, { -64, 1 },
+		{ 64, 2 }, { -65, 2 }, { 8191, 2 }, { -8192, 2 },
+		{ 8192, 3 }, { (1LL << 31) - 1, 5 }, { 1LL << 31, 5 },
+		{ std::numeric_limits<int64_t>::max(), 10 },
+		{ std::numeric_limits<int64_t>::min(), 10 },
+	};
+
+	for (const auto &i : ints) {
+		Msg msg(Msg::KIND::STRUCT);
+		msg.add("begLine", i.num);
+
+		auto str = msg.serialize();
+		/* version, kind, tag */
+		CHECK(str.length() == 3 + i.bytes);
+
+		MsgView out;
+		CHECK(out.deserialize(str));
+		CHECK(out.size() == 1 && out[0].type == MsgView::TYPE::INT && out[0].num == i.num);
+	}
+
+	for (size_t len : { 0, 127, 128, 16383, 16384 }) {
+		std::string text(len, 'a');
+		Msg msg(Msg::KIND::SOURCE);
+		msg.add("src", text);
+
+		auto str = msg.serialize();
+		CHECK(str.length() == 3 + (len < 128 ? 1 : len < 16384 ? 2 : 3) + len);
+
+		MsgView out;
+		CHECK(out.deserialize(str));
+		CHECK(out.size() == 1 && out[0].val == text);
+	}
+}
+
+static void testTags()
+{
+	constexpr unsigned char K = Msg::KIND::SOURCE;
+	MsgView out;
+
+	/* tag 0 is "src", TEXT */
+	CHECK(out.deserialize(binary({ Msg::BINARY_V1, K, 0 << 2 | 2, 1, 'x' })));
+	CHECK(out.size() == 1 && out[0].key == "src" && out[0].val == "x");
+
+	/* an escaped key unknown to the schema is kept */
+	CHECK(out.deserialize(binary({ Msg::BINARY_V1, K, 0x3f << 2 | 1, 3, 'n', 'e', 'w', 4 })));
+	CHECK(out.size() == 1 && out[0].key == "new" && out[0].num == 2);
+
+	/* a tag past the schema */
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 1 << 2 | 0 })));
+	/* an unknown kind has no tags */
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, 'X', 0 << 2 | 0 })));
+
+	/* truncated: value, varint, blob, escaped key */
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 0 << 2 | 1 })));
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 0 << 2 | 1, 0x80 })));
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 0 << 2 | 2, 2, 'x' })));
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 0x3f << 2 | 0, 5, 'a' })));
+
+	/* a varint longer than 64 bits */
+	CHECK(!out.deserialize(binary({ Msg::BINARY_V1, K, 0 << 2 | 1,
+					0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 })));
+
+	CHECK(!out.deserialize(""));
+	CHECK(out.getKind() == MsgView::KIND::INVALID);
+
+	/* no fields */
+	CHECK(out.deserialize(binary({ Msg::BINARY_V1, K })));
+	CHECK(out.getKind() == MsgView::KIND::SOURCE && out.size() == 0);
+}
+
+/* the text format ends with an empty or NULL value, or is cut short */
+static void testText()
+{
+	MsgView out;
+
+	Msg src(Msg::KIND::SOURCE);
+	src.add("src", "");
+	auto str = src.serialize(Msg::FORMAT::TEXT);
+	CHECK(out.deserialize(str));
+	CHECK(out.size() == 1 && out[0].type == MsgView::TYPE::TEXT && out[0].val.empty());
+
+	Msg use(Msg::KIND::USE);
+	use.add("begLine", 1);
+	use.add("load");
+	str = use.serialize(Msg::FORMAT::TEXT);
+	CHECK(out.deserialize(str));
+	CHECK(out.size() == 2 && out[1].type == MsgView::TYPE::NUL);
+
+	/* cut anywhere but after the kind or between the fields */
+	Msg begLine(Msg::KIND::USE);
+	begLine.add("begLine", 1);
+	auto first = begLine.serialize(Msg::FORMAT::TEXT).length();
+	for (size_t len = 2; len < str.length(); len++)
+		if (len != first)
+			CHECK(!out.deserialize(std::string_view(str).substr(0, len)));
+}
+
+int main()
+{
+	testRoundTrip(Msg::FORMAT::BINARY);
+	testRoundTrip(Msg::FORMAT::TEXT);
+	testVarints();
+	testTags();
+	testText();
+
+	return !!failed;
+}
@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <sqlite3.h>
+
+#include "../src/Message.h"
+#include "../src/Record.h"
+#include "../src/sqlconn.h"
+
+using namespace ClangStruct;
+
+using Msg = Message<std::string>;
+using MsgView = Message<std::string_view>;
+
+static int failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cerr << __FILE__ << ':' << __LINE__ << ": " << #cond << " failed\n"; \
+		failed++; \
+	} \
+} while (0)
+
+static const Record::Struct str { "A", "s", "packed", 1, 0, "a.h", 2, 3, 4, 5 };
+static const Record::Member mem { "m", "A", "a.h", 2, 3, 6, 7, 8, 9 };
+static const Record::Use use { "m", "A", "a.h", 2, 3, "a.c", 0, 1, 10, 11, 12, 13 };
+static const Record::Stats stats { "a.c", 100, 101, 102, 103, 104, 105, std::nullopt };
+
+/* @rec through a serialized message */
+template <Record::IsRecord R>
+static bool parse(const Msg &msg, MsgView &view, R &rec)
+{
+	static std::string str;
+
+	str = msg.serialize();
+	return view.deserialize(str) && view.toRecord(rec);
+}
+
+static void testToRecord()
+{
+	Record::Use out;
+	MsgView view;
+
+	/* reversed, with a key unknown to the schema */
+	Msg msg(Msg::KIND::USE);
+	msg.add("unknown", 1);
+	msg.add("endCol", 13);
+	msg.add("endLine", 12);
+	msg.add("begCol", 11);
+	msg.add("begLine", 10);
+	msg.add("implicit", 1);
+	msg.add("load", 0);
+	msg.add("use_src", "a.c");
+	msg.add("strCol", 3);
+	msg.add("strLine", 2);
+	msg.add("strSrc", "a.h");
+	msg.add("struct", "A");
+	msg.add("member", "m");
+	CHECK(parse(msg, view, out));
+	CHECK(out.member == "m" && out.strct == "A" && out.strSrc == "a.h" &&
+	      out.strLine == 2 && out.strCol == 3 && out.useSrc == "a.c" &&
+	      out.load == 0 && out.implicit == 1 && out.begLine == 10 &&
+	      out.begCol == 11 && out.endLine == 12 && out.endCol == 13);
+
+	/* NULL and missing optional fields */
+	Msg stats(Msg::KIND::STATS);
+	stats.fromRecord(::stats);
+	Record::Stats statsOut { .bytes = 1, .maxRss = 1 };
+	CHECK(parse(stats, view, statsOut));
+	CHECK(statsOut.bytes == 105 && !statsOut.maxRss && statsOut.uses == 104);
+
+	Msg noOpt(Msg::KIND::STATS);
+	noOpt.add("tu", "a.c");
+	for (auto key : Record::keys<Record::Stats>)
+		if (key != "tu" && key != "bytes" && key != "max_rss")
+			noOpt.add(std::string(key), 1);
+	statsOut.bytes = statsOut.maxRss = 1;
+	CHECK(parse(noOpt, view, statsOut));
+	CHECK(!statsOut.bytes && !statsOut.maxRss);
+
+	/* a missing, a NULL, and a mistyped required field */
+	for (auto bad : { "missing", "null", "type" }) {
+		Msg m(Msg::KIND::USE);
+		m.fromRecord(use);
+		Msg copy(Msg::KIND::USE);
+		for (const auto &e : m) {
+			if (e.key != "begLine")
+				copy.add(e.type, e.key, e.val, e.num);
+			else if (bad == std::string_view("null"))
+				copy.add(e.key);
+			else if (bad == std::string_view("type"))
+				copy.add(e.key, "10");
+		}
+		CHECK(!parse(copy, view, out));
+	}
+
+	/* a text where an optional integer is expected */
+	Msg m(Msg::KIND::USE);
+	m.fromRecord(use);
+	Msg copy(Msg::KIND::USE);
+	for (const auto &e : m)
+		if (e.key == "load")
+			copy.add(e.key, "0");
+		else
+			copy.add(e.type, e.key, e.val, e.num);
+	CHECK(!parse(copy, view, out));
+
+	/* a different kind */
+	Msg mem(Msg::KIND::MEMBER);
+	mem.fromRecord(::mem);
+	CHECK(!parse(mem, view, out));
+}
+
+static std::string query(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	std::string ret;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+		std::cerr << sql << ": " << sqlite3_errmsg(db) << "\n";
+		return ret;
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+			auto text = sqlite3_column_text(stmt, i);
+			ret.append(i ? "|" : "").append(text ? (const char *)text : "NULL");
+		}
+		ret.push_back('\n');
+	}
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+template <Record::IsRecord R>
+static void store(SQLConn &conn, const R &rec)
+{
+	Msg msg;
+	msg.fromRecord(rec);
+
+	auto str = msg.serialize();
+	MsgView view;
+	CHECK(view.deserialize(str) && conn.handleMessage(view) == 0);
+}
+
+/*
+ * Records are bound to the statements by field index (see prepareParams()).
+ * Each field carries a distinct value, so that a field bound to the column of
+ * another one shows up.
+ */
+static void testColumns(const std::filesystem::path &dir, bool bulk)
+{
+	auto dbFile = dir / (bulk ? "bulk.db" : "structs.db");
+
+	{
+		SQLConn conn;
+		CHECK(conn.open(dbFile, bulk));
+		store(conn, Record::Source { "a.h" });
+		store(conn, Record::Source { "a.c" });
+		store(conn, str);
+		store(conn, mem);
+		store(conn, use);
+		store(conn, stats);
+		CHECK(!conn.retryDeferred(true));
+		if (bulk)
+			CHECK(conn.finalizeBulk());
+	}
+
+	sqlite3 *db;
+	CHECK(sqlite3_open(dbFile.c_str(), &db) == SQLITE_OK);
+
+	CHECK(query(db, "SELECT s.name, s.type, s.attrs, s.packed, s.inMacro, src.src, "
+			"s.begLine, s.begCol, s.endLine, s.endCol "
+			"FROM struct AS s JOIN source AS src ON src.id = s.src;") ==
+	      "A|s|packed|1|0|a.h|2|3|4|5\n");
+	CHECK(query(db, "SELECT m.name, s.name, m.begLine, m.begCol, m.endLine, m.endCol "
+			"FROM member AS m JOIN struct AS s ON s.id = m.struct;") ==
+	      "m|A|6|7|8|9\n");
+	CHECK(query(db, "SELECT m.name, src.src, u.load, u.implicit, "
+			"u.begLine, u.begCol, u.endLine, u.endCol "
+			"FROM use AS u JOIN member AS m ON m.id = u.member "
+			"JOIN source AS src ON src.id = u.src;") ==
+	      "m|a.c|0|1|10|11|12|13\n");
+	CHECK(query(db, "SELECT src.src, s.wall_us, s.match_us, s.structs, s.members, "
+			"s.uses, s.bytes, s.max_rss "
+			"FROM tu_stats AS s JOIN source AS src ON src.id = s.tu;") ==
+	      "a.c|100|101|102|103|104|105|NULL\n");
+
+	sqlite3_close(db);
+}
+
+int main()
+{
+	testToRecord();
+
+	char tmpl[] = "/tmp/test-record.XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		std::cerr << "cannot create a temporary directory\n";
+		return 1;
+	}
+	testColumns(tmpl, false);
+	testColumns(tmpl, true);
+	std::filesystem::remove_all(tmpl);
+
+	return !!failed;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/bash
+# tools.sh TOOL DB_FILLER BINARIES...: smoke test of a tool reading structs.db
+
+set -e
+
+TOOL="$1"
+DB_FILLER="$2"
+shift 2
+
+SQL=`readlink -f "$(dirname "$0")/tools.sql"`
+DIR=`mktemp -d`
+trap "rm -rf '$DIR'" EXIT
+cd "$DIR"
+
+# the schema as db_filler creates it, the content from tools.sql
+"$DB_FILLER" --summaries-only
+sqlite3 -batch -bail structs.db < "$SQL"
+"$DB_FILLER" --summaries-only
+
+expect() {
+	EXPECT=`cat`
+}
+
+check() {
+	local GOT=`"$@"`
+
+	if [ "$GOT" != "$EXPECT" ]; then
+		echo "$*"
+		echo "EXPECTED:"
+		echo "$EXPECT"
+		echo "GOT:"
+		echo "$GOT"
+		exit 1
+	fi
+}
+
+case "$TOOL" in
+cs-query)
+	"$1" -d structs.db -o structs.idx
+
+	expect <<'EOT'
+A||used|include/a.h|2:6-2:9|3|1|1|0
+A||unused|include/a.h|3:6-3:11|0|0|0|0
+A||implicit|include/a.h|4:6-4:13|1|0|0|1
+EOT
+	check "$2" -i structs.idx struct A
+
+	expect <<'EOT'
+A||used|a.c|3:12-3:15|1|0
+A||used|a.c|4:5-4:8|0|0
+A||used|drivers/b.c|||0
+EOT
+	check "$2" -i structs.idx uses A used
+
+	expect <<'EOT'
+B||x|drivers/b.c|2:6-2:6
+EOT
+	check "$2" -i structs.idx unused --file 'drivers/*'
+	;;
+cs-highlight)
+	# the sources the uses in tools.sql point to
+	cat > a.c <<'EOT'
+#include "include/a.h"
+void f(struct A *a) {
+   int x = a->used;
+    a->used = x;
+    abcde->implicit;
+}
+EOT
+	mkdir drivers
+	cat > drivers/b.c <<'EOT'
+#include "../include/a.h"
+   int z = a->used;
+EOT
+
+	highlight() {
+		"$1" -d structs.db "${@:2}" | cat -v
+	}
+
+	expect <<'EOT'
+a.c:3:    int x = ^[[32ma->used^[[0m;
+a.c:4:     ^[[31ma->used^[[0m = x;
+a.c:5:     ^[[33mabcde->implicit^[[0m;
+drivers/b.c:2:    int z = ^[[33ma->used;^[[0m
+EOT
+	check highlight "$1" -u
+
+	expect <<'EOT'
+^[[1mdrivers/b.c^[[0m
+#include "../include/a.h"
+   int z = ^[[33ma->used;^[[0m
+EOT
+	check highlight "$1" -f 'drivers/*'
+	;;
+csstruct)
+	# the extension lists what the views and unused_member do
+	query() {
+		sqlite3 -batch -bail structs.db ".load $1" "$2"
+	}
+
+	expect <<'EOT'
+A|unused
+B|x
+EOT
+	check query "$1" "SELECT struct, member FROM unused_members ORDER BY struct, member;"
+	check query "$1" "SELECT struct, member FROM unused_view ORDER BY struct, member;"
+
+	expect <<'EOT'
+A|implicit
+A|unused
+B|x
+EOT
+	check query "$1" "SELECT struct, member FROM unused_members(NULL, NULL, NULL, NULL, 1) \
+		ORDER BY struct, member;"
+	check query "$1" "SELECT struct, member FROM unused_member_view ORDER BY struct, member;"
+	;;
+*)
+	echo "unknown tool $TOOL"
+	exit 1
+	;;
+esac
@@ -0,0 +1,18 @@
+-- a hand-written structs.db for the smoke tests of the tools, see tools.sh
+INSERT INTO source(id, src) VALUES (1, 'include/a.h'), (2, 'a.c'), (3, 'drivers/b.c');
+INSERT INTO struct(id, type, name, attrs, packed, inMacro, src, begLine, begCol, endLine, endCol) VALUES
+	(1, 's', 'A', '', 0, 0, 1, 1, 1, 5, 1),
+	(2, 's', 'B', '', 0, 0, 3, 1, 1, 3, 1),
+	(3, 's', '<anonymous>', '', 0, 0, 1, 7, 1, 9, 1);
+INSERT INTO member(id, name, struct, begLine, begCol, endLine, endCol) VALUES
+	(1, 'used', 1, 2, 6, 2, 9),
+	(2, 'unused', 1, 3, 6, 3, 11),
+	(3, 'implicit', 1, 4, 6, 4, 13),
+	(4, 'x', 2, 2, 6, 2, 6),
+	(5, 'anon', 3, 8, 6, 8, 9);
+-- the third use has an unknown end
+INSERT INTO use(member, src, begLine, begCol, endLine, endCol, load, implicit) VALUES
+	(1, 2, 3, 12, 3, 15, 1, 0),
+	(1, 2, 4, 5, 4, 8, 0, 0),
+	(1, 3, 2, 12, NULL, NULL, NULL, 0),
+	(3, 2, 5, 5, 5, 12, NULL, 1);